@@ -0,0 +1,27 @@
+//////////////////////////////////////////////////////////////////
+/// Arena-allocated ancillary hits (see AgataAncillaryHit.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataAncillaryHit.hh"
+
+AgataAncillaryHit::AgataAncillaryHit()
+{
+  detNb  = -1;
+  segNb  = -1;
+  edep   = 0.;
+  time   = 0.;
+  weight = 1.;
+}
+
+AgataAncillaryHit::~AgataAncillaryHit()
+{}
+
+AgataAncillaryHitsCollection::AgataAncillaryHitsCollection( G4String detName, G4String colName )
+  : G4VHitsCollection( detName, colName )
+{}
+
+AgataAncillaryHitsCollection::~AgataAncillaryHitsCollection()
+{
+  for( size_t ii=0; ii<hits.size(); ii++ )
+    delete hits[ii];
+}
@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////
+/// Hit of the ancillary detectors and its collection, both
+/// allocated in the event-scoped arena of the calling thread
+/// (AgataHitArena): creating them takes no lock and, after the
+/// first events, no heap allocation. The fields are those of
+/// the list-mode hits (AgataLMHit).
+/// The collection owns its hits; the G4Event deleting the
+/// collection returns the memory of the whole event.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataAncillaryHit_h
+#define AgataAncillaryHit_h 1
+
+#include "AgataHitArena.hh"
+
+#include "globals.hh"
+#include "G4VHit.hh"
+#include "G4VHitsCollection.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class AgataAncillaryHit : public G4VHit, public AgataArenaObject<AgataAncillaryHit>
+{
+  public:
+    AgataAncillaryHit();
+    ~AgataAncillaryHit();
+
+  private:
+    G4int         detNb;
+    G4int         segNb;
+    G4double      edep;
+    G4ThreeVector pos;
+    G4double      time;
+    G4double      weight;    //> statistical weight of the track
+
+  public:
+    inline void SetDetNb ( G4int num )                { detNb  = num; };
+    inline void SetSegNb ( G4int num )                { segNb  = num; };
+    inline void SetEdep  ( G4double de )              { edep   = de;  };
+    inline void SetPos   ( const G4ThreeVector& xyz ) { pos    = xyz; };
+    inline void SetTime  ( G4double tt )              { time   = tt;  };
+    inline void SetWeight( G4double ww )              { weight = ww;  };
+
+  public:
+    inline G4int                GetDetNb () const { return detNb;  };
+    inline G4int                GetSegNb () const { return segNb;  };
+    inline G4double             GetEdep  () const { return edep;   };
+    inline const G4ThreeVector& GetPos   () const { return pos;    };
+    inline G4double             GetTime  () const { return time;   };
+    inline G4double             GetWeight() const { return weight; };
+};
+
+class AgataAncillaryHitsCollection : public G4VHitsCollection,
+                                     public AgataArenaObject<AgataAncillaryHitsCollection>
+{
+  public:
+    AgataAncillaryHitsCollection( G4String detName, G4String colName );
+    ~AgataAncillaryHitsCollection();
+
+  private:
+    std::vector<AgataAncillaryHit*, AgataArenaAllocator<AgataAncillaryHit*> > hits;
+
+  public:
+    inline size_t insert( AgataAncillaryHit* hit ) { hits.push_back(hit); return hits.size(); };
+    inline size_t entries() const { return hits.size(); };
+    inline AgataAncillaryHit* operator[]( size_t ii ) const { return hits[ii]; };
+
+  public:
+    G4VHit* GetHit ( size_t ii ) const { return hits[ii];    };
+    size_t  GetSize() const            { return hits.size(); };
+};
+
+#endif
@@ -3,12 +3,22 @@
 #include "AgataDetectorAncillary.hh"
 #include "AgataDetectorConstruction.hh"
 #include "AgataSensitiveDetector.hh"
+#include "AgataSolidProperties.hh"
+#include "AgataVoxelMaterialMap.hh"
+#include "AgataGeometryMask.hh"
+#include "AgataGdmlValidator.hh"
+#include "AgataMeshHealer.hh"
+#include "AgataMeshMerger.hh"
+#include "AgataVolumeProfiler.hh"
+#include "AgataImportanceBiasing.hh"
+#include "AgataConvexDecomposition.hh"
 
 #include "G4Material.hh"
 #include "G4Box.hh"
 #include "G4Sphere.hh"
 #include "G4Tubs.hh"
 #include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
 #include "G4ThreeVector.hh"
 #include "G4Transform3D.hh"
 #include "G4RotationMatrix.hh"
@@ -23,6 +33,9 @@
 #include "G4RunManager.hh"
 #include "G4ios.hh"
 
+#include <chrono>
+
+static const G4String lnlChambFile = "/data/SIM_AGATA/trunk/LNL_gdml/assembly_LNL_chamb.gdml";
 
 AgataAncillaryLNLChamb::AgataAncillaryLNLChamb(G4String path, G4String name )
 {
@@ -85,8 +98,40 @@ void AgataAncillaryLNLChamb::GetDetectorConstruction()
 void AgataAncillaryLNLChamb::Placement()
 {	
  
-  m_gdmlparser.Read("/data/SIM_AGATA/trunk/LNL_gdml/assembly_LNL_chamb.gdml");
+  AgataGeometryMask* theMask = AgataGeometryMask::GetInstance();
+  G4String gdmlFile = theMask->Filter( lnlChambFile );
+  //> Release() below forgets them
+  std::vector<G4String> keptFiles = theMask->GetKeptFiles();
+
+  // the files which will be read are validated offline (bundled schemas,
+  // known-good files skipped): the parser itself would look for the
+  // schemas on the network
+  if( !AgataGdmlValidator::GetInstance()->Check( keptFiles ) ) {
+    G4Exception( "AgataAncillaryLNLChamb::Placement()", "LNLChamb001", FatalException,
+                 "Invalid GDML in the LNL chamber (see the errors above); "
+                 "/Agata/geometry/gdml/validate false reads it anyway" );
+    return;
+  }
+  size_t firstVolume = G4LogicalVolumeStore::GetInstance()->size();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  m_gdmlparser.Read(gdmlFile, false);
+  G4double parseSeconds = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+  theMask->Release();
   m_LogicalVol= m_gdmlparser.GetVolume("ReactChamber");
+  AgataImportanceBiasing::GetInstance()->ReadAuxiliary( m_gdmlparser, firstVolume );
+  theMask->Apply( m_LogicalVol );
+  theMask->Report( parseSeconds );
+  //> the volumes read are charged to their GDML file by /Agata/profile/
+  //> (the merged ones below to the files of their pieces)
+  AgataVolumeProfiler::GetInstance()->RegisterFile( lnlChambFile, firstVolume, keptFiles );
+  //> after the mask: no repairs of the volumes it removes
+  if( AgataMeshHealer::GetInstance()->IsEnabled() )
+    AgataMeshHealer::GetInstance()->Apply( m_LogicalVol );
+  if( AgataMeshMerger::GetInstance()->IsEnabled() )
+    AgataMeshMerger::GetInstance()->Apply( m_LogicalVol );
+  if( AgataConvexDecomposition::GetInstance()->IsEnabled() ) {
+    AgataConvexDecomposition::GetInstance()->Apply( m_LogicalVol );
+  }
 
 
     G4RotationMatrix* rm= new G4RotationMatrix();
@@ -105,6 +150,13 @@ void AgataAncillaryLNLChamb::Placement()
    
     
      
+    AgataVoxelMaterialMap* theVoxelMap = AgataVoxelMaterialMap::GetInstance();
+    if( theVoxelMap->IsEnabled() ) {
+      theVoxelMap->Build( m_LogicalVol );
+      theVoxelMap->Place( "ReactChamber", rm, G4ThreeVector(0., 0., 0.), theDetector->HallPhys() );
+      return;
+    }
+
     new G4PVPlacement(rm, G4ThreeVector(0., 0., 0.), "ReactChamber", m_LogicalVol, theDetector->HallPhys(), false, 0 );
 
 	return ;
@@ -115,6 +167,7 @@ void AgataAncillaryLNLChamb::Placement()
 void AgataAncillaryLNLChamb::ShowStatus()
 {
   G4cout << " LNL Chamber support has been constructed." << G4endl;
+  AgataSolidProperties::GetInstance()->PrintMassReport( m_LogicalVol );
 }
 
 void AgataAncillaryLNLChamb::WriteHeader(std::ofstream &/*outFileLMD*/, G4double /*unit*/)
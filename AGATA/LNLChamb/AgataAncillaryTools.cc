@@ -0,0 +1,65 @@
+//////////////////////////////////////////////////////////////////
+/// Creation and deletion of the ancillary singletons
+/// (see AgataAncillaryTools.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataAncillaryTools.hh"
+#include "AgataVoxelMaterialMap.hh"
+#include "AgataGeometryMask.hh"
+#include "AgataGdmlValidator.hh"
+#include "AgataMeshHealer.hh"
+#include "AgataMeshMerger.hh"
+#include "AgataConvexDecomposition.hh"
+#include "AgataSurfaceSampler.hh"
+#include "AgataSolidProperties.hh"
+#include "AgataMaterialBudgetScanner.hh"
+#include "AgataImportanceBiasing.hh"
+#include "AgataVolumeProfiler.hh"
+#include "AgataBenchmark.hh"
+#include "AgataListModeWriter.hh"
+#include "AgataHitArena.hh"
+#include "AgataUnitTests.hh"
+
+//////////////////////////////////////////////////////////////
+/// Only the singletons with commands need to exist early; the
+/// others are created when first used
+//////////////////////////////////////////////////////////////
+void AgataAncillaryTools::Create()
+{
+  AgataVoxelMaterialMap::GetInstance();       //> /Agata/geometry/voxel/
+  AgataGeometryMask::GetInstance();           //> /Agata/geometry/mask/
+  AgataGdmlValidator::GetInstance();          //> /Agata/geometry/gdml/
+  AgataMeshHealer::GetInstance();             //> /Agata/geometry/heal/
+  AgataMeshMerger::GetInstance();             //> /Agata/geometry/merge/
+  AgataConvexDecomposition::GetInstance();    //> /Agata/geometry/convex/
+  AgataSurfaceSampler::GetInstance();         //> /Agata/geometry/overlaps/
+  AgataMaterialBudgetScanner::GetInstance();  //> /Agata/geometry/budget/
+  AgataImportanceBiasing::GetInstance();      //> /Agata/biasing/
+  AgataVolumeProfiler::GetInstance();         //> /Agata/profile/
+  AgataBenchmark::GetInstance();              //> /Agata/benchmark/
+  AgataListModeWriter::GetInstance();         //> /Agata/file/binary/
+  AgataUnitTests::GetInstance();              //> /Agata/test/
+}
+
+//////////////////////////////////////////////////////////////
+/// The users go first (the list-mode file is closed first), then
+/// the geometry tools; the hit arena of the master goes last
+//////////////////////////////////////////////////////////////
+void AgataAncillaryTools::Delete()
+{
+  AgataUnitTests::DeleteInstance();
+  AgataListModeWriter::DeleteInstance();
+  AgataBenchmark::DeleteInstance();
+  AgataVolumeProfiler::DeleteInstance();
+  AgataImportanceBiasing::DeleteInstance();
+  AgataMaterialBudgetScanner::DeleteInstance();
+  AgataConvexDecomposition::DeleteInstance();
+  AgataSurfaceSampler::DeleteInstance();
+  AgataSolidProperties::DeleteInstance();
+  AgataMeshMerger::DeleteInstance();
+  AgataMeshHealer::DeleteInstance();
+  AgataGdmlValidator::DeleteInstance();
+  AgataGeometryMask::DeleteInstance();
+  AgataVoxelMaterialMap::DeleteInstance();
+  AgataHitArena::DeleteInstance();
+}
@@ -0,0 +1,25 @@
+//////////////////////////////////////////////////////////////////
+/// Owner of the singletons serving the ancillaries (geometry
+/// tools, list-mode output, biasing, profiling, benchmark).
+/// Create() is called by the AgataDetectorAncillary constructors,
+/// i.e. when the detector messenger sets up the ancillaries: all
+/// the /Agata/geometry/..., /Agata/biasing/, /Agata/profile/,
+/// /Agata/benchmark/, /Agata/file/binary/ and /Agata/test/ commands
+/// then exist before the macro uses them. Delete() is called by the
+/// AgataDetectorAncillary destructor. AgataHitArena and
+/// AgataSurfaceSampler have one instance per thread: Delete()
+/// destroys the one of the calling (master) thread, the arenas of
+/// the workers go with their threads.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataAncillaryTools_h
+#define AgataAncillaryTools_h 1
+
+class AgataAncillaryTools
+{
+  public:
+    static void Create();
+    static void Delete();
+};
+
+#endif
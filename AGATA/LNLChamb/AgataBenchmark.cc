@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////
+/// Throughput and scaling benchmark
+/// (see AgataBenchmark.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataBenchmark.hh"
+
+#include "G4RunManager.hh"
+#ifdef G4MULTITHREADED
+#include "G4MTRunManager.hh"
+#endif
+#include "G4GenericMessenger.hh"
+#include "G4Version.hh"
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace {
+
+  //> the children are told where to write by the environment
+  const char* resultVariable = "AGATA_BENCHMARK_RESULT";
+
+  //> set when the program is loaded: start of the startup time
+  const std::chrono::steady_clock::time_point programStart = std::chrono::steady_clock::now();
+
+  G4double Seconds( std::chrono::steady_clock::time_point start )
+  {
+    return std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+  }
+
+  //> peak resident set size of this process (kB), -1 if unknown
+  long PeakRSS()
+  {
+    std::ifstream status( "/proc/self/status" );
+    std::string line;
+    while( std::getline( status, line ) ) {
+      if( line.compare( 0, 6, "VmHWM:" ) == 0 )
+        return atol( line.c_str() + 6 );
+    }
+    return -1;
+  }
+
+  //> the command line this process was started with
+  std::vector<std::string> CommandLine()
+  {
+    std::ifstream in( "/proc/self/cmdline" );
+    std::vector<std::string> args;
+    std::string arg;
+    while( std::getline( in, arg, '\0' ) )
+      args.push_back( arg );
+    return args;
+  }
+
+  std::string JsonString( const std::string& text )
+  {
+    std::string out = "\"";
+    for( size_t ii=0; ii<text.size(); ii++ ) {
+      if( text[ii] == '"' || text[ii] == '\\' ) out += '\\';
+      out += text[ii];
+    }
+    return out + "\"";
+  }
+
+}
+
+AgataBenchmark* AgataBenchmark::instance = NULL;
+
+AgataBenchmark* AgataBenchmark::GetInstance()
+{
+  if( !instance )
+    instance = new AgataBenchmark();
+  return instance;
+}
+
+void AgataBenchmark::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataBenchmark::AgataBenchmark()
+{
+  nEvents    = 10000;
+  nWarmUp    = 200;
+  maxThreads = 1;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/benchmark/",
+                                        "Throughput and scaling benchmark of the loaded setup" );
+  myMessenger->DeclareProperty( "events", nEvents, "Events of the timed run" )
+    .SetParameterName( "num", false ).SetRange( "num>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "warmUp", nWarmUp, "Events of the warm-up run" )
+    .SetParameterName( "num", false ).SetRange( "num>=0" ).SetToBeBroadcasted( false );
+#ifdef G4MULTITHREADED
+  myMessenger->DeclareProperty( "threads", maxThreads, "Largest number of threads of the sweep" )
+    .SetParameterName( "num", false ).SetRange( "num>0" ).SetToBeBroadcasted( false );
+#endif
+  myMessenger->DeclareMethod( "run", &AgataBenchmark::Run,
+                              "Runs the sweep and writes the results (JSON) to the given file" )
+    .SetParameterName( "fileName", true )
+    .SetDefaultValue( "agataBenchmark.json" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataBenchmark::~AgataBenchmark()
+{
+  delete myMessenger;
+}
+
+std::vector<G4int> AgataBenchmark::ThreadCounts( G4int maxThreads )
+{
+  std::vector<G4int> counts;
+  for( G4int nThreads=1; nThreads<maxThreads; nThreads*=2 )
+    counts.push_back( nThreads );
+  counts.push_back( std::max( 1, maxThreads ) );
+  return counts;
+}
+
+G4bool AgataBenchmark::ReadValue( const std::string& result, const std::string& key, G4double& value )
+{
+  std::string field = "\"" + key + "\":";
+  size_t pos = result.find( field );
+  if( pos == std::string::npos ) return false;
+  const char* start = result.c_str() + pos + field.size();
+  char* end = NULL;
+  value = strtod( start, &end );
+  return end != start;
+}
+
+void AgataBenchmark::Run( G4String fileName )
+{
+  const char* resultFile = getenv( resultVariable );
+  if( resultFile ) {
+    RunChild( resultFile );
+    return;
+  }
+  if( RunSweep( fileName ) )
+    G4Exception( "AgataBenchmark::Run()", "AgataBenchmark001", JustWarning,
+                 "Benchmark failed (see above)" );
+}
+
+//////////////////////////////////////////////////////////////
+/// One thread count: the runs of the production setup, then
+/// the process ends (the rest of the macro belongs to the
+/// parent)
+//////////////////////////////////////////////////////////////
+void AgataBenchmark::RunChild( G4String resultFile )
+{
+  G4RunManager* runManager = G4RunManager::GetRunManager();
+  //> nothing to do if the macro already did /run/initialize
+  runManager->Initialize();
+  G4double startupTime = Seconds(programStart);
+
+  G4int nThreads = 1;
+#ifdef G4MULTITHREADED
+  G4MTRunManager* mtRunManager = dynamic_cast<G4MTRunManager*>(runManager);
+  if( mtRunManager ) nThreads = mtRunManager->GetNumberOfThreads();
+#endif
+
+  //> physics tables and worker geometry are built by the first run:
+  //> timed on their own, they belong neither to startup nor to the rate
+  std::chrono::steady_clock::time_point warmUpStart = std::chrono::steady_clock::now();
+  if( nWarmUp > 0 ) runManager->BeamOn( nWarmUp );
+  G4double warmUpTime = Seconds(warmUpStart);
+
+  std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
+  runManager->BeamOn( nEvents );
+  G4double runTime = Seconds(runStart);
+
+  long peakRSS = PeakRSS();
+  G4double rate = ( runTime > 0. ) ? nEvents/runTime : 0.;
+
+  std::ofstream out( resultFile.c_str() );
+  out << "{ \"threads\": " << nThreads
+      << ", \"startupTime_s\": " << startupTime
+      << ", \"warmUpTime_s\": " << warmUpTime
+      << ", \"runTime_s\": " << runTime
+      << ", \"events\": " << nEvents
+      << ", \"eventsPerSecond\": " << rate
+      << ", \"peakRSS_kB\": " << peakRSS << " }";
+  out.close();
+
+  G4cout << " ---> " << nThreads << " threads: startup " << startupTime << " s, warm-up "
+         << warmUpTime << " s, " << rate << " events/s, peak RSS " << peakRSS << " kB" << G4endl;
+  G4cout.flush();
+
+  //> no clean-up: the worker threads are still waiting for runs
+  _exit( out ? 0 : 1 );
+}
+
+//////////////////////////////////////////////////////////////
+/// Sweep: the executable once per thread count
+//////////////////////////////////////////////////////////////
+G4int AgataBenchmark::RunSweep( G4String fileName )
+{
+  std::vector<std::string> commandLine = CommandLine();
+  if( commandLine.empty() ) {
+    G4cout << " Could not read the command line of the job!" << G4endl;
+    return 1;
+  }
+  std::vector<char*> args;
+  for( size_t ii=0; ii<commandLine.size(); ii++ )
+    args.push_back( (char*)commandLine[ii].c_str() );
+  args.push_back( NULL );
+
+#ifdef G4MULTITHREADED
+  std::vector<G4int> threadCounts = ThreadCounts( maxThreads );
+#else
+  std::vector<G4int> threadCounts = ThreadCounts( 1 );
+#endif
+  std::vector<std::string> results;
+  std::vector<G4double>    rates;
+  std::vector<G4int>       threads;
+
+  for( size_t ii=0; ii<threadCounts.size(); ii++ ) {
+    char resultFile[] = "/tmp/agataBenchXXXXXX";
+    G4int fd = mkstemp( resultFile );
+    if( fd < 0 ) {
+      G4cout << " Could not create a temporary file for the results!" << G4endl;
+      return 1;
+    }
+    close(fd);
+
+    std::ostringstream threadArg;
+    threadArg << threadCounts[ii];
+
+    G4cout << " ---> Benchmark with " << threadCounts[ii] << " threads" << G4endl;
+    G4cout.flush();
+    pid_t pid = fork();
+    if( pid == 0 ) {
+      //> no terminal input: a job without macro ends instead of waiting
+      G4int devNull = open( "/dev/null", O_RDONLY );
+      if( devNull >= 0 ) dup2( devNull, 0 );
+      setenv( resultVariable, resultFile, 1 );
+      setenv( "G4FORCENUMBEROFTHREADS", threadArg.str().c_str(), 1 );
+      execv( "/proc/self/exe", &args[0] );
+      _exit(127);
+    }
+    G4int status = -1;
+    if( pid > 0 ) waitpid( pid, &status, 0 );
+
+    std::ifstream in( resultFile );
+    std::string result( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+    in.close();
+    remove( resultFile );
+
+    G4double rate = 0., nThreads = 0.;
+    if( pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        !ReadValue( result, "eventsPerSecond", rate ) || !ReadValue( result, "threads", nThreads ) ) {
+      G4cout << " Benchmark with " << threadCounts[ii] << " threads failed!" << G4endl;
+      return 1;
+    }
+    rates.push_back( rate );
+    threads.push_back( (G4int)nThreads );
+    results.push_back( result );
+  }
+
+  std::ofstream out( fileName.c_str() );
+  if( !out.is_open() ) {
+    G4cout << " Could not open " << fileName << G4endl;
+    return 1;
+  }
+  std::string command;
+  for( size_t ii=0; ii<commandLine.size(); ii++ )
+    command += ( ii ? " " : "" ) + commandLine[ii];
+  out << "{\n"
+      << "  \"geant4\": " << JsonString( G4Version ) << ",\n"
+      << "  \"commandLine\": " << JsonString( command ) << ",\n"
+      << "  \"warmUpEvents\": " << nWarmUp << ",\n"
+      << "  \"runs\": [\n";
+  for( size_t ii=0; ii<results.size(); ii++ ) {
+    //> scaling with respect to the first (single thread) run
+    G4double speedUp    = ( rates[0] > 0. ) ? rates[ii]/rates[0] : 0.;
+    G4double efficiency = speedUp * threads[0] / std::max( 1, threads[ii] );
+    out << "    " << results[ii].substr( 0, results[ii].rfind('}') )
+        << ", \"speedUp\": " << speedUp
+        << ", \"efficiency\": " << efficiency << " }"
+        << ( ii+1 < results.size() ? "," : "" ) << "\n";
+  }
+  out << "  ]\n}\n";
+  out.close();
+
+  G4cout << " ---> Benchmark results written to " << fileName << G4endl;
+  return 0;
+}
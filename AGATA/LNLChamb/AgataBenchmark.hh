@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////
+/// Throughput and scaling benchmark of AGATA plus ancillaries,
+/// run by the AGATA executable itself, i.e. with the production
+/// detector construction, physics list, generator and run/event
+/// actions as configured by the macro:
+///
+///   /Agata/benchmark/events   10000
+///   /Agata/benchmark/warmUp   200
+///   /Agata/benchmark/threads  8
+///   /Agata/benchmark/run      bench.json
+///
+/// Each thread count of the sweep (1, 2, 4, ... below the largest
+/// one, then the largest one) runs in a fresh process: the
+/// executable is started again with the same command line and
+/// G4FORCENUMBEROFTHREADS set, so that its startup time and peak
+/// RSS (VmHWM) belong to that configuration alone. The macro must
+/// then be given on the command line (a batch job), and the run
+/// command should follow /run/initialize with no /run/beamOn
+/// before it: the child repeats the macro up to the run command,
+/// where it times its runs and exits.
+/// The startup time goes from the loading of the program to the
+/// end of /run/initialize; the warm-up run (physics tables,
+/// worker geometry) is reported on its own. The seeds are those
+/// of the macro, the same in every child.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataBenchmark_h
+#define AgataBenchmark_h 1
+
+#include "globals.hh"
+
+#include <vector>
+#include <string>
+
+class G4GenericMessenger;
+
+class AgataBenchmark
+{
+  public:
+    static AgataBenchmark* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataBenchmark();
+
+  public:
+    ~AgataBenchmark();
+
+  private:
+    static AgataBenchmark* instance;
+
+  private:
+    G4int               nEvents;
+    G4int               nWarmUp;
+    G4int               maxThreads;
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> sweep (or, in a child, the timed runs of one thread count)
+    void  Run( G4String fileName );
+
+  private:
+    void  RunChild( G4String resultFile );
+    G4int RunSweep( G4String fileName );
+
+  public:
+    //> 1, 2, 4, ... below maxThreads, then maxThreads
+    static std::vector<G4int> ThreadCounts( G4int maxThreads );
+    //> value of "key": in a result object, false when missing
+    static G4bool             ReadValue   ( const std::string& result, const std::string& key,
+                                            G4double& value );
+
+  public:
+    inline void SetEvents    ( G4int num ) { nEvents    = num; };
+    inline void SetWarmUp    ( G4int num ) { nWarmUp    = num; };
+    inline void SetMaxThreads( G4int num ) { maxThreads = num; };
+};
+
+#endif
@@ -0,0 +1,393 @@
+//////////////////////////////////////////////////////////////////
+/// Approximate convex decomposition of the CAD meshes
+/// (see AgataConvexDecomposition.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataConvexDecomposition.hh"
+#include "AgataConvexPolyhedron.hh"
+#include "AgataTriangleMesh.hh"
+#include "AgataSurfaceSampler.hh"
+
+#include "G4TessellatedSolid.hh"
+#include "G4MultiUnion.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Material.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4Transform3D.hh"
+#include "G4GenericMessenger.hh"
+#include "G4UnitsTable.hh"
+#include "Randomize.hh"
+
+#include <set>
+#include <cmath>
+#include <chrono>
+#include <sstream>
+
+AgataConvexDecomposition* AgataConvexDecomposition::instance = NULL;
+
+AgataConvexDecomposition* AgataConvexDecomposition::GetInstance()
+{
+  if( !instance )
+    instance = new AgataConvexDecomposition();
+  return instance;
+}
+
+void AgataConvexDecomposition::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataConvexDecomposition::AgataConvexDecomposition()
+{
+  enabled   = false;
+  tolerance = 0.1*mm;
+  minSize   = 2.*mm;
+  maxPieces = 64;
+  nSamples  = 4000;
+  nCheckPoints = 1000;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/convex/",
+                                        "Convex decomposition of the tessellated solids" );
+  myMessenger->DeclareProperty( "enable", enabled,
+                                "Replaces the tessellated solids by unions of convex pieces" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "tolerance", "mm", tolerance,
+                                        "Accepted distance of a piece from the solid (sample estimate)" )
+    .SetParameterName( "distance", false ).SetRange( "distance>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "minSize", "mm", minSize, "Cells smaller than this are not split" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "maxPieces", maxPieces, "Solids needing more pieces are kept" )
+    .SetParameterName( "num", false ).SetRange( "num>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "samples", nSamples,
+                                "Random points per piece estimating its distance from the solid and its excess volume" )
+    .SetParameterName( "num", false ).SetRange( "num>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "checkPoints", nCheckPoints,
+                                "Surface points per volume for the overlap check of the replaced volumes" )
+    .SetParameterName( "num", false ).SetRange( "num>=0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "benchmark", &AgataConvexDecomposition::Benchmark,
+                              "Compares the decomposed solids with the original ones" )
+    .SetParameterName( "nPoints", true )
+    .SetDefaultValue( "100000" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataConvexDecomposition::~AgataConvexDecomposition()
+{
+  delete myMessenger;
+}
+
+void AgataConvexDecomposition::Apply( G4LogicalVolume* top )
+{
+  std::vector<G4LogicalVolume*> volumes( 1, top );
+  std::set<G4LogicalVolume*>    done;
+  std::set<G4LogicalVolume*>    replaced;
+  for( size_t ii=0; ii<volumes.size(); ii++ ) {
+    G4LogicalVolume* volume = volumes[ii];
+    if( !done.insert(volume).second ) continue;
+    for( size_t jj=0; jj<volume->GetNoDaughters(); jj++ )
+      volumes.push_back( volume->GetDaughter(jj)->GetLogicalVolume() );
+
+    G4TessellatedSolid* tess = dynamic_cast<G4TessellatedSolid*>( volume->GetSolid() );
+    if( !tess || tess->GetNumberOfFacets() == 0 ) continue;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    G4double excess  = 0.;
+    G4int    nPieces = 0;
+    G4VSolid* decomposed = Decompose( tess, excess, nPieces );
+    G4double seconds = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+    if( !decomposed ) {
+      G4cout << " ---> " << volume->GetName() << ": more than " << maxPieces
+             << " convex pieces needed, tessellated solid kept" << G4endl;
+      continue;
+    }
+    originals[volume] = tess;
+    replaced.insert(volume);
+    volume->SetSolid( decomposed );
+    G4cout << " ---> " << volume->GetName() << ": " << tess->GetNumberOfFacets() << " facets -> "
+           << nPieces << " convex pieces, excess volume (sampled) " << 100.*excess << "% ("
+           << seconds << " s)" << G4endl;
+    //> the excess is filled with the material of the volume
+    if( volume->GetMaterial() ) {
+      G4double mass = tess->GetCubicVolume() * volume->GetMaterial()->GetDensity();
+      G4cout << "      mass " << G4BestUnit( mass, "Mass" ) << " -> "
+             << G4BestUnit( mass*( 1. + excess ), "Mass" ) << " (+" << 100.*excess << "%)" << G4endl;
+    }
+  }
+  if( replaced.empty() || nCheckPoints <= 0 ) return;
+
+  //> the pieces stick out of the solid: each replaced volume against its
+  //> mother and its siblings, and its daughters against it
+  std::set<G4LogicalVolume*> mothers( replaced.begin(), replaced.end() );
+  for( std::set<G4LogicalVolume*>::iterator it=done.begin(); it!=done.end(); ++it ) {
+    for( size_t jj=0; jj<(*it)->GetNoDaughters(); jj++ ) {
+      if( replaced.count( (*it)->GetDaughter(jj)->GetLogicalVolume() ) )
+        mothers.insert(*it);
+    }
+  }
+  AgataSurfaceSampler* theSampler = AgataSurfaceSampler::GetInstance();
+  G4int nOverlaps = 0;
+  for( std::set<G4LogicalVolume*>::iterator it=mothers.begin(); it!=mothers.end(); ++it )
+    nOverlaps += theSampler->CheckDaughters( *it, nCheckPoints, 0., false );
+  G4cout << " ---> Overlap check of the " << replaced.size() << " decomposed volume(s): "
+         << nOverlaps << " overlap(s) found." << G4endl;
+}
+
+G4VSolid* AgataConvexDecomposition::Decompose( G4TessellatedSolid* solid, G4double& excess, G4int& nPieces )
+{
+  AgataTriangleMesh mesh(solid);
+  G4ThreeVector pMin, pMax;
+  mesh.GetBoundingBox( pMin, pMax );
+  std::vector<G4int> tris( mesh.GetNumberOfTriangles() );
+  for( size_t ii=0; ii<tris.size(); ii++ ) tris[ii] = ii;
+
+  CLHEP::MixMaxRng engine(20200713);
+  std::vector<AgataConvexPolyhedron*> pieces;
+  G4double excessVolume = 0.;
+  G4bool ok = Split( mesh, tris, solid, pMin, pMax, engine, pieces, excessVolume );
+  if( !ok || pieces.empty() ) {
+    for( size_t ii=0; ii<pieces.size(); ii++ ) delete pieces[ii];
+    return NULL;
+  }
+
+  nPieces = pieces.size();
+  excess  = excessVolume / solid->GetCubicVolume();
+  if( nPieces == 1 ) {
+    pieces[0]->SetName( solid->GetName() + "_convex" );
+    return pieces[0];
+  }
+  G4MultiUnion* multi = new G4MultiUnion( solid->GetName() + "_convex" );
+  for( size_t ii=0; ii<pieces.size(); ii++ )
+    multi->AddNode( *pieces[ii], G4Transform3D() );
+  multi->Voxelize();
+  return multi;
+}
+
+//////////////////////////////////////////////////////////////
+/// Part of a triangle inside an axis-aligned cell
+/// (Sutherland-Hodgman on the six planes)
+//////////////////////////////////////////////////////////////
+namespace {
+  void ClipPolygon( std::vector<G4ThreeVector>& polygon, const G4ThreeVector& cellMin,
+                    const G4ThreeVector& cellMax )
+  {
+    std::vector<G4ThreeVector> input;
+    for( G4int side=0; side<6 && !polygon.empty(); side++ ) {
+      G4int    axis  = side/2;
+      G4double sign  = ( side%2 ) ? -1. : 1.;  //> keep sign*(x - limit) >= 0
+      G4double limit = ( side%2 ) ? cellMax[axis] : cellMin[axis];
+      input.swap(polygon);
+      polygon.clear();
+      for( size_t ii=0; ii<input.size(); ii++ ) {
+        const G4ThreeVector& aa = input[ii];
+        const G4ThreeVector& bb = input[(ii+1)%input.size()];
+        G4double da = sign*( aa[axis] - limit );
+        G4double db = sign*( bb[axis] - limit );
+        if( da >= 0. ) polygon.push_back(aa);
+        if( ( da >= 0. ) != ( db >= 0. ) )
+          polygon.push_back( aa + ( bb - aa )*( da/( da - db ) ) );
+      }
+    }
+  }
+
+  //> a polygon lying in a side of the cell has no volume in it
+  //> (e.g. the face where the solid leaves the cell)
+  G4bool OnCellSide( const std::vector<G4ThreeVector>& polygon, const G4ThreeVector& cellMin,
+                     const G4ThreeVector& cellMax, G4double eps )
+  {
+    for( G4int side=0; side<6; side++ ) {
+      G4int    axis  = side/2;
+      G4double limit = ( side%2 ) ? cellMax[axis] : cellMin[axis];
+      G4bool   onSide = true;
+      for( size_t ii=0; ii<polygon.size() && onSide; ii++ )
+        onSide = std::fabs( polygon[ii][axis] - limit ) <= eps;
+      if( onSide ) return true;
+    }
+    return false;
+  }
+}
+
+//////////////////////////////////////////////////////////////
+/// Returns false when too many pieces are needed
+//////////////////////////////////////////////////////////////
+G4bool AgataConvexDecomposition::Split( const AgataTriangleMesh& mesh, const std::vector<G4int>& tris,
+                                        G4VSolid* solid, G4ThreeVector cellMin, G4ThreeVector cellMax,
+                                        CLHEP::HepRandomEngine& engine,
+                                        std::vector<AgataConvexPolyhedron*>& pieces, G4double& excess )
+{
+  //> the part of the solid in the cell: clipped facets and inner corners
+  std::vector<G4ThreeVector> points;
+  std::vector<G4int> inCell;
+  std::vector<G4ThreeVector> polygon;
+  G4ThreeVector centre = 0.5*( cellMin + cellMax );
+  G4double eps = 1.e-9*( cellMax - cellMin ).mag();
+  for( size_t ii=0; ii<tris.size(); ii++ ) {
+    polygon.clear();
+    for( G4int cc=0; cc<3; cc++ )
+      polygon.push_back( mesh.GetVertex( tris[ii], cc ) );
+    ClipPolygon( polygon, cellMin, cellMax );
+    if( polygon.empty() ) continue;
+    inCell.push_back( tris[ii] );
+    if( OnCellSide( polygon, cellMin, cellMax, eps ) ) continue;
+    points.insert( points.end(), polygon.begin(), polygon.end() );
+  }
+  for( G4int corner=0; corner<8; corner++ ) {
+    G4ThreeVector point( ( corner & 1 ) ? cellMax.x() : cellMin.x(),
+                         ( corner & 2 ) ? cellMax.y() : cellMin.y(),
+                         ( corner & 4 ) ? cellMax.z() : cellMin.z() );
+    //> a corner only touching the solid does not count
+    if( solid->Inside( point + 1.e-6*( centre - point ) ) == kInside )
+      points.push_back(point);
+  }
+
+  std::ostringstream name;
+  name << solid->GetName() << "_piece" << pieces.size();
+  AgataConvexPolyhedron* hull = AgataConvexPolyhedron::FromPoints( name.str(), points );
+  if( !hull ) return true;  //> nothing (or a flat sliver) in this cell
+
+  G4double outside  = 0.;
+  G4double distance = ExcessDistance( hull, solid, mesh, inCell, engine, outside );
+  G4ThreeVector hullMin, hullMax;
+  hull->BoundingLimits( hullMin, hullMax );
+  //> the part is in both the cell and its hull
+  for( G4int ax=0; ax<3; ax++ ) {
+    cellMin[ax] = std::max( cellMin[ax], hullMin[ax] );
+    cellMax[ax] = std::min( cellMax[ax], hullMax[ax] );
+  }
+  G4ThreeVector size = cellMax - cellMin;
+  G4int axis = ( size.x() > size.y() ) ? ( ( size.x() > size.z() ) ? 0 : 2 ) : ( ( size.y() > size.z() ) ? 1 : 2 );
+
+  if( distance <= tolerance || size[axis] < 2.*minSize ) {
+    excess += outside * hull->GetCubicVolume();
+    pieces.push_back(hull);
+    return (G4int)pieces.size() <= maxPieces;
+  }
+  delete hull;
+
+  G4double middle = 0.5*( cellMin[axis] + cellMax[axis] );
+  G4ThreeVector lowMax  = cellMax;
+  G4ThreeVector highMin = cellMin;
+  lowMax [axis] = middle;
+  highMin[axis] = middle;
+  if( !Split( mesh, inCell, solid, cellMin, lowMax, engine, pieces, excess ) ) return false;
+  return Split( mesh, inCell, solid, highMin, cellMax, engine, pieces, excess );
+}
+
+//////////////////////////////////////////////////////////////
+/// Sampled: the vertices of the hull are on the mesh or inside
+/// the solid, the excess is in between. The distance of a point
+/// is taken from the triangles in the cell, which can only
+/// overestimate it; the scan of a point stops as soon as it is
+/// closer than the largest distance found so far.
+//////////////////////////////////////////////////////////////
+G4double AgataConvexDecomposition::ExcessDistance( AgataConvexPolyhedron* hull, G4VSolid* solid,
+                                                   const AgataTriangleMesh& mesh,
+                                                   const std::vector<G4int>& tris,
+                                                   CLHEP::HepRandomEngine& engine, G4double& outside )
+{
+  G4ThreeVector pMin, pMax;
+  hull->BoundingLimits( pMin, pMax );
+  G4ThreeVector size = pMax - pMin;
+
+  G4double maxDistance = 0.;
+  G4int nIn = 0, nOut = 0, nTries = 0;
+  while( nIn < nSamples && nTries < 100*nSamples ) {
+    nTries++;
+    G4ThreeVector point( pMin.x() + engine.flat()*size.x(),
+                         pMin.y() + engine.flat()*size.y(),
+                         pMin.z() + engine.flat()*size.z() );
+    if( hull->Inside(point) == kOutside ) continue;
+    nIn++;
+    if( solid->Inside(point) != kOutside ) continue;
+    nOut++;
+
+    G4double distance = tris.empty() ? solid->DistanceToIn(point) : kInfinity;
+    for( size_t ii=0; ii<tris.size() && distance > maxDistance; ii++ )
+      distance = std::min( distance, mesh.GetTriangleDistance( tris[ii], point ) );
+    maxDistance = std::max( maxDistance, distance );
+  }
+  outside = nIn ? (G4double)nOut/nIn : 0.;
+  return maxDistance;
+}
+
+////////////////////////////////////////////////////////////
+/// Benchmark
+////////////////////////////////////////////////////////////
+void AgataConvexDecomposition::Benchmark( G4int nPoints )
+{
+  if( originals.empty() ) {
+    G4cout << " No decomposed solids (/Agata/geometry/convex/enable before /run/initialize)" << G4endl;
+    return;
+  }
+  std::map<G4LogicalVolume*, G4VSolid*>::iterator it;
+  for( it=originals.begin(); it!=originals.end(); ++it ) {
+    G4cout << " ---> " << it->first->GetName() << G4endl;
+    Compare( it->second, it->first->GetSolid(), nPoints );
+  }
+}
+
+void AgataConvexDecomposition::Compare( G4VSolid* original, G4VSolid* decomposed, G4int nPoints )
+{
+  G4ThreeVector pMin, pMax;
+  original->BoundingLimits( pMin, pMax );
+  G4ThreeVector centre = 0.5*( pMin + pMax );
+  G4ThreeVector size   = 1.2*( pMax - pMin );
+
+  CLHEP::MixMaxRng engine(20200713);
+  std::vector<G4ThreeVector> points(nPoints), directions(nPoints);
+  for( G4int ii=0; ii<nPoints; ii++ ) {
+    points[ii] = centre + G4ThreeVector( ( engine.flat() - 0.5 )*size.x(),
+                                         ( engine.flat() - 0.5 )*size.y(),
+                                         ( engine.flat() - 0.5 )*size.z() );
+    G4double cosTh = 2.*engine.flat() - 1.;
+    G4double phi   = twopi*engine.flat();
+    directions[ii] = G4ThreeVector( std::sqrt( 1. - cosTh*cosTh )*std::cos(phi),
+                                    std::sqrt( 1. - cosTh*cosTh )*std::sin(phi), cosTh );
+  }
+
+  G4VSolid* solids[2] = { original, decomposed };
+  std::vector<EInside> inside[2];
+  G4double timeInside[2], timeIn[2], timeOut[2];
+  for( G4int ss=0; ss<2; ss++ ) {
+    inside[ss].resize(nPoints);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( G4int ii=0; ii<nPoints; ii++ )
+      inside[ss][ii] = solids[ss]->Inside( points[ii] );
+    timeInside[ss] = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+
+    //> same ray sets for both solids: those of the original
+    G4double sum = 0.;
+    start = std::chrono::steady_clock::now();
+    for( G4int ii=0; ii<nPoints; ii++ ) {
+      if( inside[0][ii] == kOutside )
+        sum += solids[ss]->DistanceToIn( points[ii], directions[ii] ) < kInfinity;
+    }
+    timeIn[ss] = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+
+    start = std::chrono::steady_clock::now();
+    for( G4int ii=0; ii<nPoints; ii++ ) {
+      if( inside[0][ii] == kInside )
+        sum += solids[ss]->DistanceToOut( points[ii], directions[ii] );
+    }
+    timeOut[ss] = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+  }
+
+  G4int nIn = 0, nDiffer = 0;
+  for( G4int ii=0; ii<nPoints; ii++ ) {
+    if( inside[0][ii] == kInside ) nIn++;
+    if( ( inside[0][ii] == kOutside ) != ( inside[1][ii] == kOutside ) ) nDiffer++;
+  }
+  G4int nOut = nPoints - nIn;
+
+  G4cout << "      Inside:        " << 1.e9*timeInside[0]/nPoints << " ns -> "
+         << 1.e9*timeInside[1]/nPoints << " ns per call" << G4endl;
+  if( nOut > 0 )
+    G4cout << "      DistanceToIn:  " << 1.e9*timeIn[0]/nOut << " ns -> "
+           << 1.e9*timeIn[1]/nOut << " ns per call" << G4endl;
+  if( nIn > 0 )
+    G4cout << "      DistanceToOut: " << 1.e9*timeOut[0]/nIn << " ns -> "
+           << 1.e9*timeOut[1]/nIn << " ns per call" << G4endl;
+  G4cout << "      inside/outside differs for " << 100.*nDiffer/nPoints << "% of the points" << G4endl;
+}
@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////
+/// Import option replacing the concave CAD meshes by a G4MultiUnion
+/// of convex pieces (AgataConvexPolyhedron), which are much faster
+/// to navigate than the general tessellated solid.
+///
+/// The bounding box of the mesh is split recursively in two along
+/// its longest side. In each cell the piece is the convex hull of
+/// the part of the solid inside the cell (mesh clipped to the cell,
+/// plus the corners of the cell lying in the solid). The cell is
+/// accepted when the hull reaches no farther than "tolerance" from
+/// the solid, or when it is smaller than minSize. That distance,
+/// like the excess volume, is a sample estimate: the largest
+/// distance from the mesh of "samples" random points of the hull,
+/// so that a thin spike of the hull can be missed. The union of the
+/// pieces contains the solid. The excess volume and the resulting
+/// change of mass are printed, and the replaced volumes are checked
+/// for overlaps (AgataSurfaceSampler, checkPoints points per
+/// surface). Solids needing more than maxPieces pieces are left
+/// unchanged.
+///
+///   /Agata/geometry/convex/enable true   (before /run/initialize)
+///   /Agata/geometry/convex/tolerance 0.1 mm
+///   /Agata/geometry/convex/minSize 2 mm
+///   /Agata/geometry/convex/maxPieces 64
+///   /Agata/geometry/convex/samples 4000
+///   /Agata/geometry/convex/checkPoints 1000
+///   /Agata/geometry/convex/benchmark 100000
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataConvexDecomposition_h
+#define AgataConvexDecomposition_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+#include <map>
+
+class G4VSolid;
+class G4TessellatedSolid;
+class G4LogicalVolume;
+class G4GenericMessenger;
+class AgataTriangleMesh;
+class AgataConvexPolyhedron;
+namespace CLHEP { class HepRandomEngine; }
+
+class AgataConvexDecomposition
+{
+  public:
+    static AgataConvexDecomposition* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataConvexDecomposition();
+
+  public:
+    ~AgataConvexDecomposition();
+
+  private:
+    static AgataConvexDecomposition* instance;
+
+  private:
+    G4bool              enabled;
+    G4double            tolerance;   //> accepted distance of a piece from the solid
+    G4double            minSize;
+    G4int               maxPieces;
+    G4int               nSamples;    //> points per piece for the excess estimate
+    G4int               nCheckPoints; //> overlap check of the replaced volumes
+    G4GenericMessenger* myMessenger;
+
+  private:
+    //> replaced volumes and their original solid, for the benchmark
+    std::map<G4LogicalVolume*, G4VSolid*> originals;
+
+  public:
+    //> decomposes the tessellated solids of top and of its descendants
+    void      Apply    ( G4LogicalVolume* top );
+    //> NULL when the solid needs more than maxPieces pieces
+    G4VSolid* Decompose( G4TessellatedSolid* solid, G4double& excess, G4int& nPieces );
+
+  public:
+    //> timing of Inside/DistanceToIn/DistanceToOut, original against decomposed
+    void      Benchmark( G4int nPoints );
+
+  private:
+    G4bool    Split( const AgataTriangleMesh& mesh, const std::vector<G4int>& tris, G4VSolid* solid,
+                     G4ThreeVector cellMin, G4ThreeVector cellMax, CLHEP::HepRandomEngine& engine,
+                     std::vector<AgataConvexPolyhedron*>& pieces, G4double& excess );
+    //> largest distance from the mesh of the hull points outside the
+    //> solid; outside is the fraction of the hull volume outside it
+    G4double  ExcessDistance( AgataConvexPolyhedron* hull, G4VSolid* solid, const AgataTriangleMesh& mesh,
+                              const std::vector<G4int>& tris, CLHEP::HepRandomEngine& engine,
+                              G4double& outside );
+    void      Compare( G4VSolid* original, G4VSolid* decomposed, G4int nPoints );
+
+  public:
+    inline G4bool IsEnabled() { return enabled; };
+};
+
+#endif
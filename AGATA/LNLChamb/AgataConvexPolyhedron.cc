@@ -0,0 +1,514 @@
+//////////////////////////////////////////////////////////////////
+/// Plane-set convex polyhedron (see AgataConvexPolyhedron.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataConvexPolyhedron.hh"
+
+#include "G4BoundingEnvelope.hh"
+#include "G4VGraphicsScene.hh"
+#include "G4PolyhedronArbitrary.hh"
+#include "Randomize.hh"
+
+#include <set>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+  //> partial results kept by the plane loops
+  const G4int nLanes = 8;
+}
+
+AgataConvexPolyhedron::AgataConvexPolyhedron( const G4String& name )
+  : G4VSolid(name)
+{
+  nPlanes       = 0;
+  halfTolerance = 0.5*kCarTolerance;
+}
+
+AgataConvexPolyhedron::AgataConvexPolyhedron( const AgataConvexPolyhedron& rhs )
+  : G4VSolid(rhs)
+{
+  *this = rhs;
+}
+
+AgataConvexPolyhedron& AgataConvexPolyhedron::operator=( const AgataConvexPolyhedron& rhs )
+{
+  if( this == &rhs ) return *this;
+  G4VSolid::operator=(rhs);
+  nx             = rhs.nx;
+  ny             = rhs.ny;
+  nz             = rhs.nz;
+  dd             = rhs.dd;
+  nPlanes        = rhs.nPlanes;
+  vertices       = rhs.vertices;
+  triangles      = rhs.triangles;
+  cumulativeArea = rhs.cumulativeArea;
+  bMin           = rhs.bMin;
+  bMax           = rhs.bMax;
+  halfTolerance  = rhs.halfTolerance;
+  return *this;
+}
+
+AgataConvexPolyhedron::~AgataConvexPolyhedron()
+{}
+
+G4VSolid* AgataConvexPolyhedron::Clone() const
+{
+  return new AgataConvexPolyhedron(*this);
+}
+
+AgataConvexPolyhedron* AgataConvexPolyhedron::FromPoints( const G4String& name,
+                                                          const std::vector<G4ThreeVector>& points )
+{
+  AgataConvexPolyhedron* hull = new AgataConvexPolyhedron(name);
+  if( !hull->BuildHull(points) ) {
+    delete hull;
+    return NULL;
+  }
+  hull->BuildPlanes();
+  return hull;
+}
+
+//////////////////////////////////////////////////////////////
+/// Incremental convex hull: start from a tetrahedron of extreme
+/// points, then each point outside the current hull removes the
+/// faces it sees and is joined to their horizon
+//////////////////////////////////////////////////////////////
+namespace {
+  struct HullFace
+  {
+    G4int         v[3];
+    G4ThreeVector normal;
+    G4double      offset;
+    G4bool        alive;
+  };
+
+  HullFace MakeFace( const std::vector<G4ThreeVector>& pts, G4int a, G4int b, G4int c )
+  {
+    HullFace face;
+    face.v[0]   = a;
+    face.v[1]   = b;
+    face.v[2]   = c;
+    face.normal = ( pts[b] - pts[a] ).cross( pts[c] - pts[a] ).unit();
+    face.offset = face.normal.dot( pts[a] );
+    face.alive  = true;
+    return face;
+  }
+}
+
+G4bool AgataConvexPolyhedron::BuildHull( const std::vector<G4ThreeVector>& points )
+{
+  if( points.size() < 4 ) return false;
+
+  G4ThreeVector lo = points[0], hi = points[0];
+  for( size_t ii=1; ii<points.size(); ii++ ) {
+    for( G4int ax=0; ax<3; ax++ ) {
+      lo[ax] = std::min( lo[ax], points[ii][ax] );
+      hi[ax] = std::max( hi[ax], points[ii][ax] );
+    }
+  }
+  G4double scale = ( hi - lo ).mag();
+  G4double eps   = std::max( 1.e-9*scale, kCarTolerance );
+
+  //> welded copy of the points
+  std::vector<G4ThreeVector> pts;
+  std::set< std::vector<long long> > seen;
+  for( size_t ii=0; ii<points.size(); ii++ ) {
+    std::vector<long long> key(3);
+    for( G4int ax=0; ax<3; ax++ )
+      key[ax] = (long long)std::floor( ( points[ii][ax] - lo[ax] ) / eps + 0.5 );
+    if( seen.insert(key).second )
+      pts.push_back( points[ii] );
+  }
+  if( pts.size() < 4 ) return false;
+
+  //> initial tetrahedron
+  G4int i0 = 0, i1 = -1, i2 = -1, i3 = -1;
+  for( size_t ii=1; ii<pts.size(); ii++ )
+    if( pts[ii].x() < pts[i0].x() ) i0 = ii;
+  G4double best = 0.;
+  for( size_t ii=0; ii<pts.size(); ii++ ) {
+    G4double dist = ( pts[ii] - pts[i0] ).mag2();
+    if( dist > best ) { best = dist; i1 = ii; }
+  }
+  if( i1 < 0 || std::sqrt(best) < eps ) return false;
+  G4ThreeVector axis = ( pts[i1] - pts[i0] ).unit();
+  best = 0.;
+  for( size_t ii=0; ii<pts.size(); ii++ ) {
+    G4double dist = ( pts[ii] - pts[i0] ).cross(axis).mag();
+    if( dist > best ) { best = dist; i2 = ii; }
+  }
+  if( i2 < 0 || best < eps ) return false;
+  G4ThreeVector normal = ( pts[i1] - pts[i0] ).cross( pts[i2] - pts[i0] ).unit();
+  best = 0.;
+  for( size_t ii=0; ii<pts.size(); ii++ ) {
+    G4double dist = std::fabs( normal.dot( pts[ii] - pts[i0] ) );
+    if( dist > best ) { best = dist; i3 = ii; }
+  }
+  if( i3 < 0 || best < eps ) return false;
+
+  std::vector<HullFace> faces;
+  if( normal.dot( pts[i3] - pts[i0] ) > 0. )
+    std::swap( i1, i2 );
+  faces.push_back( MakeFace( pts, i0, i1, i2 ) );
+  faces.push_back( MakeFace( pts, i0, i3, i1 ) );
+  faces.push_back( MakeFace( pts, i1, i3, i2 ) );
+  faces.push_back( MakeFace( pts, i2, i3, i0 ) );
+
+  for( size_t pp=0; pp<pts.size(); pp++ ) {
+    G4int ip = pp;
+    if( ip == i0 || ip == i1 || ip == i2 || ip == i3 ) continue;
+
+    std::set< std::pair<G4int,G4int> > visibleEdges;
+    std::vector<size_t> visible;
+    for( size_t ff=0; ff<faces.size(); ff++ ) {
+      if( !faces[ff].alive ) continue;
+      if( faces[ff].normal.dot( pts[ip] ) - faces[ff].offset > eps ) {
+        visible.push_back(ff);
+        for( G4int ee=0; ee<3; ee++ )
+          visibleEdges.insert( std::make_pair( faces[ff].v[ee], faces[ff].v[(ee+1)%3] ) );
+      }
+    }
+    if( visible.empty() ) continue;
+
+    for( size_t ii=0; ii<visible.size(); ii++ ) {
+      faces[visible[ii]].alive = false;
+      HullFace face = faces[visible[ii]];  //> a copy: faces grows below
+      for( G4int ee=0; ee<3; ee++ ) {
+        G4int aa = face.v[ee], bb = face.v[(ee+1)%3];
+        //> horizon: the neighbour across the edge stays
+        if( visibleEdges.find( std::make_pair( bb, aa ) ) == visibleEdges.end() )
+          faces.push_back( MakeFace( pts, aa, bb, ip ) );
+      }
+    }
+  }
+
+  //> keep only the vertices used by the final faces
+  std::map<G4int,G4int> index;
+  vertices.clear();
+  triangles.clear();
+  for( size_t ff=0; ff<faces.size(); ff++ ) {
+    if( !faces[ff].alive ) continue;
+    for( G4int ee=0; ee<3; ee++ ) {
+      std::map<G4int,G4int>::iterator it = index.find( faces[ff].v[ee] );
+      if( it == index.end() ) {
+        it = index.insert( std::make_pair( faces[ff].v[ee], (G4int)vertices.size() ) ).first;
+        vertices.push_back( pts[ faces[ff].v[ee] ] );
+      }
+      triangles.push_back( it->second );
+    }
+  }
+  return triangles.size() >= 12;
+}
+
+//////////////////////////////////////////////////////////////
+/// Coplanar hull triangles give one plane
+//////////////////////////////////////////////////////////////
+void AgataConvexPolyhedron::BuildPlanes()
+{
+  nx.clear(); ny.clear(); nz.clear(); dd.clear();
+  cumulativeArea.clear();
+
+  bMin = bMax = vertices[0];
+  for( size_t ii=1; ii<vertices.size(); ii++ ) {
+    for( G4int ax=0; ax<3; ax++ ) {
+      bMin[ax] = std::min( bMin[ax], vertices[ii][ax] );
+      bMax[ax] = std::max( bMax[ax], vertices[ii][ax] );
+    }
+  }
+
+  G4double area = 0.;
+  for( size_t tt=0; tt<triangles.size()/3; tt++ ) {
+    const G4ThreeVector& a = vertices[triangles[3*tt]];
+    G4ThreeVector cross = ( vertices[triangles[3*tt+1]] - a ).cross( vertices[triangles[3*tt+2]] - a );
+    area += 0.5*cross.mag();
+    cumulativeArea.push_back(area);
+
+    G4ThreeVector normal = cross.unit();
+    G4double      offset = normal.dot(a);
+    G4bool known = false;
+    for( size_t pp=0; pp<dd.size() && !known; pp++ ) {
+      known = ( normal.x()*nx[pp] + normal.y()*ny[pp] + normal.z()*nz[pp] > 1. - 1.e-9 ) &&
+              ( std::fabs( offset - dd[pp] ) < halfTolerance );
+    }
+    if( known ) continue;
+    nx.push_back( normal.x() );
+    ny.push_back( normal.y() );
+    nz.push_back( normal.z() );
+    dd.push_back( offset );
+  }
+
+  //> padding: a null normal and d = kInfinity, far behind any point
+  nPlanes = dd.size();
+  while( dd.size() % nLanes ) {
+    nx.push_back( 0. );
+    ny.push_back( 0. );
+    nz.push_back( 0. );
+    dd.push_back( kInfinity );
+  }
+}
+
+G4double AgataConvexPolyhedron::MaxDistance( const G4ThreeVector& p ) const
+{
+  const G4double  px = p.x(), py = p.y(), pz = p.z();
+  const G4double *ax = nx.data(), *ay = ny.data(), *az = nz.data(), *ad = dd.data();
+  const G4int     nTotal = dd.size();
+  G4double best[nLanes];
+  for( G4int ll=0; ll<nLanes; ll++ ) best[ll] = -kInfinity;
+  for( G4int ii=0; ii<nTotal; ii+=nLanes ) {
+    for( G4int ll=0; ll<nLanes; ll++ ) {
+      G4double dist = ax[ii+ll]*px + ay[ii+ll]*py + az[ii+ll]*pz - ad[ii+ll];
+      best[ll] = std::max( best[ll], dist );
+    }
+  }
+  for( G4int ll=1; ll<nLanes; ll++ ) best[0] = std::max( best[0], best[ll] );
+  return best[0];
+}
+
+//////////////////////////////////////////////////////////////
+/// Only for the rare cases without a plane in front (null
+/// direction, point off the surface)
+//////////////////////////////////////////////////////////////
+G4int AgataConvexPolyhedron::NearestPlane( const G4ThreeVector& p ) const
+{
+  G4double best  = -kInfinity;
+  G4int    plane = 0;
+  for( G4int ii=0; ii<nPlanes; ii++ ) {
+    G4double dist = nx[ii]*p.x() + ny[ii]*p.y() + nz[ii]*p.z() - dd[ii];
+    if( dist > best ) {
+      best  = dist;
+      plane = ii;
+    }
+  }
+  return plane;
+}
+
+////////////////////////////////////////////////////////////
+/// Navigation
+////////////////////////////////////////////////////////////
+EInside AgataConvexPolyhedron::Inside( const G4ThreeVector& p ) const
+{
+  G4double dist = MaxDistance(p);
+  if( dist >  halfTolerance ) return kOutside;
+  if( dist < -halfTolerance ) return kInside;
+  return kSurface;
+}
+
+//////////////////////////////////////////////////////////////
+/// Called once per boundary, not per candidate volume: a plain
+/// scan of the planes
+//////////////////////////////////////////////////////////////
+G4ThreeVector AgataConvexPolyhedron::SurfaceNormal( const G4ThreeVector& p ) const
+{
+  G4ThreeVector sum;
+  G4int nSurface = 0;
+  for( G4int ii=0; ii<nPlanes; ii++ ) {
+    G4double dist = nx[ii]*p.x() + ny[ii]*p.y() + nz[ii]*p.z() - dd[ii];
+    if( std::fabs(dist) <= halfTolerance ) {
+      sum += G4ThreeVector( nx[ii], ny[ii], nz[ii] );
+      nSurface++;
+    }
+  }
+  if( nSurface == 1 ) return sum;
+  if( nSurface > 1  ) return sum.unit();
+
+  //> not on the surface: nearest plane
+  G4int plane = NearestPlane(p);
+  return G4ThreeVector( nx[plane], ny[plane], nz[plane] );
+}
+
+//////////////////////////////////////////////////////////////
+/// The distances along the ray are kept as fractions num/den,
+/// den > 0, compared by cross-multiplication: the division is
+/// done once, for the plane retained
+//////////////////////////////////////////////////////////////
+G4double AgataConvexPolyhedron::DistanceToIn( const G4ThreeVector& p, const G4ThreeVector& v ) const
+{
+  const G4double  px = p.x(), py = p.y(), pz = p.z();
+  const G4double  vx = v.x(), vy = v.y(), vz = v.z();
+  const G4double *ax = nx.data(), *ay = ny.data(), *az = nz.data(), *ad = dd.data();
+  const G4int     nTotal = dd.size();
+  G4double inNum[nLanes], inDen[nLanes], outNum[nLanes], outDen[nLanes], miss[nLanes];
+  for( G4int ll=0; ll<nLanes; ll++ ) {
+    inNum [ll] = 0.;
+    inDen [ll] = 1.;
+    outNum[ll] = kInfinity;
+    outDen[ll] = 1.;
+    miss  [ll] = 0.;
+  }
+  for( G4int ii=0; ii<nTotal; ii+=nLanes ) {
+    for( G4int ll=0; ll<nLanes; ll++ ) {
+      G4double dist = ax[ii+ll]*px + ay[ii+ll]*py + az[ii+ll]*pz - ad[ii+ll];
+      G4double cosa = ax[ii+ll]*vx + ay[ii+ll]*vy + az[ii+ll]*vz;
+      //> outside a plane and moving away, or parallel to it and on it:
+      //> such a ray only grazes the solid and, as for G4Box, does not
+      //> enter. A parallel ray behind a plane is not limited by it.
+      //> (& rather than &&: both sides are evaluated, no branch)
+      miss[ll] = ( ( cosa >= 0. ) & ( dist >= -halfTolerance ) ) ? 1. : miss[ll];
+      //> entering at dist/(-cosa), leaving at (-dist)/cosa
+      G4bool later   = ( cosa < 0. ) & (  dist*inDen [ll] > -cosa*inNum [ll] );
+      G4bool earlier = ( cosa > 0. ) & ( -dist*outDen[ll] <  cosa*outNum[ll] );
+      inNum [ll] = later   ?  dist : inNum [ll];
+      inDen [ll] = later   ? -cosa : inDen [ll];
+      outNum[ll] = earlier ? -dist : outNum[ll];
+      outDen[ll] = earlier ?  cosa : outDen[ll];
+    }
+    //> one branch per block: most of the rays missing the solid stop early
+    G4double missed = 0.;
+    for( G4int ll=0; ll<nLanes; ll++ ) missed += miss[ll];
+    if( missed > 0. ) return kInfinity;
+  }
+  G4double tFirst = 0., tLast = kInfinity;
+  for( G4int ll=0; ll<nLanes; ll++ ) {
+    tFirst = std::max( tFirst, inNum [ll]/inDen [ll] );
+    tLast  = std::min( tLast,  outNum[ll]/outDen[ll] );
+  }
+  if( tFirst >= tLast - halfTolerance ) return kInfinity;
+  return ( tFirst < halfTolerance ) ? 0. : tFirst;
+}
+
+G4double AgataConvexPolyhedron::DistanceToIn( const G4ThreeVector& p ) const
+{
+  G4double dist = MaxDistance(p);
+  return ( dist > 0. ) ? dist : 0.;
+}
+
+G4double AgataConvexPolyhedron::DistanceToOut( const G4ThreeVector& p, const G4ThreeVector& v,
+                                               const G4bool calcNorm, G4bool* validNorm,
+                                               G4ThreeVector* n ) const
+{
+  const G4double  px = p.x(), py = p.y(), pz = p.z();
+  const G4double  vx = v.x(), vy = v.y(), vz = v.z();
+  const G4double *ax = nx.data(), *ay = ny.data(), *az = nz.data(), *ad = dd.data();
+  const G4int     nTotal = dd.size();
+  //> as in DistanceToIn, fractions num/den; the plane index is kept
+  //> as a double, like the values it goes with, one counter per lane
+  G4double num[nLanes], den[nLanes], plane[nLanes], index[nLanes];
+  for( G4int ll=0; ll<nLanes; ll++ ) {
+    num  [ll] = kInfinity;
+    den  [ll] = 1.;
+    plane[ll] = -1.;
+    index[ll] = ll;
+  }
+  for( G4int ii=0; ii<nTotal; ii+=nLanes ) {
+    for( G4int ll=0; ll<nLanes; ll++ ) {
+      G4double cosa = ax[ii+ll]*vx + ay[ii+ll]*vy + az[ii+ll]*vz;
+      G4double dist = ax[ii+ll]*px + ay[ii+ll]*py + az[ii+ll]*pz - ad[ii+ll];
+      //> on (or beyond) a plane it moves towards, the ray leaves at once
+      G4double gap   = ( dist >= -halfTolerance ) ? 0. : -dist;
+      G4bool   ahead = ( cosa > 0. ) & ( gap*den[ll] < cosa*num[ll] );
+      num  [ll] = ahead ? gap       : num  [ll];
+      den  [ll] = ahead ? cosa      : den  [ll];
+      plane[ll] = ahead ? index[ll] : plane[ll];
+      index[ll] += nLanes;
+    }
+  }
+  //> on a tie, the first plane (a point on an edge leaves through either)
+  G4int lane = 0;
+  for( G4int ll=1; ll<nLanes; ll++ ) {
+    G4double diff  = num[ll]*den[lane] - num[lane]*den[ll];
+    G4bool   first = ( diff == 0. ) & ( plane[ll] >= 0. ) & ( plane[ll] < plane[lane] );
+    lane = ( ( diff < 0. ) | first ) ? ll : lane;
+  }
+  if( plane[lane] < 0. ) {
+    //> no plane in front: only for a null direction (a closed convex
+    //> solid always has one). The point is taken as leaving through the
+    //> nearest plane, without a valid normal.
+    if( calcNorm ) {
+      G4int nearest = NearestPlane(p);
+      *validNorm = false;
+      *n = G4ThreeVector( nx[nearest], ny[nearest], nz[nearest] );
+    }
+    return 0.;
+  }
+  if( calcNorm ) {
+    G4int exit = (G4int)plane[lane];
+    *validNorm = true;  //> convex
+    *n = G4ThreeVector( nx[exit], ny[exit], nz[exit] );
+  }
+  return num[lane]/den[lane];
+}
+
+G4double AgataConvexPolyhedron::DistanceToOut( const G4ThreeVector& p ) const
+{
+  G4double dist = -MaxDistance(p);
+  return ( dist > 0. ) ? dist : 0.;
+}
+
+////////////////////////////////////////////////////////////
+/// Extent, volume, surface
+////////////////////////////////////////////////////////////
+void AgataConvexPolyhedron::BoundingLimits( G4ThreeVector& pMin, G4ThreeVector& pMax ) const
+{
+  pMin = bMin;
+  pMax = bMax;
+}
+
+G4bool AgataConvexPolyhedron::CalculateExtent( const EAxis pAxis, const G4VoxelLimits& pVoxelLimit,
+                                               const G4AffineTransform& pTransform,
+                                               G4double& pMin, G4double& pMax ) const
+{
+  G4BoundingEnvelope bbox( bMin, bMax );
+  return bbox.CalculateExtent( pAxis, pVoxelLimit, pTransform, pMin, pMax );
+}
+
+G4double AgataConvexPolyhedron::GetCubicVolume()
+{
+  G4double volume = 0.;
+  for( size_t tt=0; tt<triangles.size()/3; tt++ ) {
+    volume += vertices[triangles[3*tt]].dot( vertices[triangles[3*tt+1]].cross( vertices[triangles[3*tt+2]] ) );
+  }
+  return volume/6.;
+}
+
+G4double AgataConvexPolyhedron::GetSurfaceArea()
+{
+  return cumulativeArea.empty() ? 0. : cumulativeArea.back();
+}
+
+G4ThreeVector AgataConvexPolyhedron::GetPointOnSurface() const
+{
+  G4double uu = G4UniformRand() * cumulativeArea.back();
+  size_t tt = std::lower_bound( cumulativeArea.begin(), cumulativeArea.end(), uu ) - cumulativeArea.begin();
+  if( tt >= cumulativeArea.size() ) tt = cumulativeArea.size() - 1;
+
+  G4double r1 = G4UniformRand();
+  G4double r2 = G4UniformRand();
+  if( r1 + r2 > 1. ) {
+    r1 = 1. - r1;
+    r2 = 1. - r2;
+  }
+  const G4ThreeVector& a = vertices[triangles[3*tt]];
+  return a + r1*( vertices[triangles[3*tt+1]] - a ) + r2*( vertices[triangles[3*tt+2]] - a );
+}
+
+std::ostream& AgataConvexPolyhedron::StreamInfo( std::ostream& os ) const
+{
+  os << "-----------------------------------------------------------\n"
+     << "    *** Dump for solid - " << GetName() << " ***\n"
+     << "    ===================================================\n"
+     << " Solid type: AgataConvexPolyhedron\n"
+     << " Parameters: \n"
+     << "   number of planes:   " << nPlanes << "\n"
+     << "   number of vertices: " << vertices.size() << "\n"
+     << "   bounding box:       " << bMin << " " << bMax << "\n"
+     << "-----------------------------------------------------------\n";
+  return os;
+}
+
+void AgataConvexPolyhedron::DescribeYourselfTo( G4VGraphicsScene& scene ) const
+{
+  scene.AddSolid(*this);
+}
+
+G4Polyhedron* AgataConvexPolyhedron::CreatePolyhedron() const
+{
+  G4PolyhedronArbitrary* polyhedron = new G4PolyhedronArbitrary( vertices.size(), triangles.size()/3 );
+  for( size_t ii=0; ii<vertices.size(); ii++ )
+    polyhedron->AddVertex( vertices[ii] );
+  for( size_t tt=0; tt<triangles.size()/3; tt++ )
+    polyhedron->AddFacet( triangles[3*tt]+1, triangles[3*tt+1]+1, triangles[3*tt+2]+1 );
+  polyhedron->SetReferences();
+  return polyhedron;
+}
@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////
+/// Convex polyhedron described by the set of its face planes,
+/// n.x <= d. Used for the pieces of the convex decomposition of
+/// the CAD meshes (AgataConvexDecomposition): all the queries are
+/// loops over the planes, without any search in the facets.
+/// The planes are kept as separate arrays (nx, ny, nz, d), padded
+/// to a multiple of eight with planes that never count, and the
+/// loops keep one partial result per lane of eight, updated without
+/// branches, so that the compiler can vectorise them.
+/// The hull triangles are kept for the surface area, the points on
+/// the surface and the visualisation.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataConvexPolyhedron_h
+#define AgataConvexPolyhedron_h 1
+
+#include "G4VSolid.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class AgataConvexPolyhedron : public G4VSolid
+{
+  public:
+    //> convex hull of the points, NULL if they are (almost) coplanar
+    static AgataConvexPolyhedron* FromPoints( const G4String& name,
+                                              const std::vector<G4ThreeVector>& points );
+
+  private:
+    AgataConvexPolyhedron( const G4String& name );
+
+  public:
+    AgataConvexPolyhedron( const AgataConvexPolyhedron& rhs );
+    AgataConvexPolyhedron& operator=( const AgataConvexPolyhedron& rhs );
+    ~AgataConvexPolyhedron();
+
+  private:
+    std::vector<G4double>      nx, ny, nz, dd;  //> outward normals and offsets, padded
+    G4int                      nPlanes;         //> without the padding
+    std::vector<G4ThreeVector> vertices;
+    std::vector<G4int>         triangles;       //> hull triangles, outward
+    std::vector<G4double>      cumulativeArea;
+    G4ThreeVector              bMin, bMax;
+    G4double                   halfTolerance;
+
+  private:
+    G4bool   BuildHull   ( const std::vector<G4ThreeVector>& points );
+    void     BuildPlanes ();
+    //> largest signed distance to the planes
+    G4double MaxDistance ( const G4ThreeVector& p ) const;
+    //> the plane giving it
+    G4int    NearestPlane( const G4ThreeVector& p ) const;
+
+  public:
+    EInside       Inside       ( const G4ThreeVector& p ) const;
+    G4ThreeVector SurfaceNormal( const G4ThreeVector& p ) const;
+    G4double      DistanceToIn ( const G4ThreeVector& p, const G4ThreeVector& v ) const;
+    G4double      DistanceToIn ( const G4ThreeVector& p ) const;
+    G4double      DistanceToOut( const G4ThreeVector& p, const G4ThreeVector& v,
+                                 const G4bool calcNorm = false,
+                                 G4bool* validNorm = 0, G4ThreeVector* n = 0 ) const;
+    G4double      DistanceToOut( const G4ThreeVector& p ) const;
+
+  public:
+    void          BoundingLimits ( G4ThreeVector& pMin, G4ThreeVector& pMax ) const;
+    G4bool        CalculateExtent( const EAxis pAxis, const G4VoxelLimits& pVoxelLimit,
+                                   const G4AffineTransform& pTransform,
+                                   G4double& pMin, G4double& pMax ) const;
+
+  public:
+    G4GeometryType GetEntityType    () const { return "AgataConvexPolyhedron"; };
+    G4VSolid*      Clone            () const;
+    std::ostream&  StreamInfo       ( std::ostream& os ) const;
+    G4double       GetCubicVolume   ();
+    G4double       GetSurfaceArea   ();
+    G4ThreeVector  GetPointOnSurface() const;
+    void           DescribeYourselfTo( G4VGraphicsScene& scene ) const;
+    G4Polyhedron*  CreatePolyhedron () const;
+
+  public:
+    inline G4int GetNumberOfPlanes  () const { return nPlanes;         };
+    inline G4int GetNumberOfVertices() const { return vertices.size(); };
+};
+
+#endif
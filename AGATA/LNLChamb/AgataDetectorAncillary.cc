@@ -8,6 +8,16 @@
 /////////////////////////////////////////////////////////////////
 
 #include "AgataDetectorAncillary.hh"
+#include "AgataListModeWriter.hh"
+#include "AgataHitArena.hh"
+#include "AgataSegmentLookup.hh"
+#include "AgataImportanceBiasing.hh"
+#include "AgataAncillaryTools.hh"
+#include "AgataHitDetector.hh"
+#include "G4Event.hh"
+#include "G4HCofThisEvent.hh"
+#include "G4THitsCollection.hh"
+#include "G4Threading.hh"
 #include <dlfcn.h>
 
 /// User ancillary class should be included here!
@@ -75,6 +85,7 @@ std::vector<void*> AgataDetectorAncillary::AddOns;
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 3000;
   // pointers to the ancillary detector classes
@@ -85,6 +96,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4Str
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 3000;
 
@@ -98,6 +110,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4
 #ifdef CLARA
 AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 1000;
 
@@ -109,6 +122,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4Str
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 1000;
 
@@ -121,6 +135,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4
 #ifdef POLAR
 AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 0;
   // pointers to the ancillary detector classes
@@ -131,6 +146,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path )
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 0;
 
@@ -143,6 +159,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path )
 #ifdef EUCLIDES
 AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 0;
 
@@ -154,6 +171,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path )
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
   minOffset = 0;
 
@@ -167,6 +185,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path )
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   numAnc = 1;
 #ifdef ANTIC
   minOffset = 1000;
@@ -314,6 +333,8 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4Str
       theSpider           = new AgataAncillarySpider(path,name);
       theAncillary.push_back((AgataAncillaryScheme*)    theSpider);
       theConstructed.push_back((AgataDetectorConstructed*)theSpider);
+      //> segments of the trapezoidal Si (GALILEO/Spider/spider_segments.gdml)
+      AgataSegmentLookup::RequestLookup( theSpider->GetAncOffset(), "spider_segments_", 0.5*mm );
       break;
     case 22:  // Lycca
       theLycca           = new AgataAncillaryLycca(path,name);
@@ -437,6 +458,7 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4int type, G4String path, G4Str
 
 AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4String name )
 {
+  AgataAncillaryTools::Create();
   /////////////////////////////////////////
   /// Decode the "type" string
   ///////////////////////////////////////
@@ -607,6 +629,8 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4
 	theSpider           = new AgataAncillarySpider(path,name);
 	theAncillary[ii]    = (AgataAncillaryScheme*)    theSpider;
 	theConstructed[ii]  = (AgataDetectorConstructed*)theSpider;
+	//> segments of the trapezoidal Si (GALILEO/Spider/spider_segments.gdml)
+	AgataSegmentLookup::RequestLookup( theSpider->GetAncOffset(), "spider_segments_", 0.5*mm );
 	break;
       case 22:  // Lycca
 	theLycca           = new AgataAncillaryLycca(path,name);
@@ -739,7 +763,10 @@ AgataDetectorAncillary::AgataDetectorAncillary( G4String type, G4String path, G4
 #endif
 
 AgataDetectorAncillary::~AgataDetectorAncillary()
-{}
+{
+  AgataSegmentLookup::Clear();
+  AgataAncillaryTools::Delete();
+}
 
 ////////////////////////////////////////////////////////////
 ///// The Placement() method calls (in the proper sequence)
@@ -762,6 +789,12 @@ void AgataDetectorAncillary::Placement()
   G4RunManager* runManager = G4RunManager::GetRunManager();
   AgataDetectorConstruction* theDetector  = (AgataDetectorConstruction*) runManager->GetUserDetectorConstruction();
   theDetector->CopyOffset( ancLut );
+
+  //> segment lookups requested by the ancillaries, numbered as they do
+  AgataSegmentLookup::BuildRequested( theDetector->HallPhys(),
+    [this]( G4int offset, G4int nDet, const G4ThreeVector& position ) {
+      return theConstructed[ancLut[offset/1000]]->GetSegmentNumber( offset, nDet, position );
+    } );
 }
 
 ///////////////////////////////////////////////////////////
@@ -815,6 +848,13 @@ void AgataDetectorAncillary::FillAncLut()
 G4int AgataDetectorAncillary::GetSegmentNumber( G4int offset, G4int nGe, G4ThreeVector position )
 {
   if(offset>=1000000) return 0;
+  //> precomputed lookup, if one was built for this detector; the
+  //> points it cannot decide are left to the ancillary
+  AgataSegmentLookup* theLookup = AgataSegmentLookup::Find( offset, nGe );
+  if( theLookup ) {
+    G4int segment = theLookup->GetSegment( position );
+    if( segment >= 0 ) return segment;
+  }
   return theConstructed[ancLut[offset/1000]]->GetSegmentNumber( offset, nGe, position );
 }
 
@@ -847,7 +887,129 @@ void AgataDetectorAncillary::WriteHeader(std::ofstream &outFileLMD, G4double uni
     }
     outFileLMD << G4endl;
     theConstructed[ii]->WriteHeader(outFileLMD,unitLength);
-  }  
+  }
+  //> the events will carry the weights of the hits (WriteEventWeights)
+  if( AgataImportanceBiasing::GetInstance()->IsBiasing() )
+    outFileLMD << "WEIGHTS -200" << G4endl;
+}
+
+//////////////////////////////////////////////////////////////
+/// Importance sampling: after the hits of an event, one line
+///   -200 detCode segment weight
+/// per ancillary hit, in the order of the hit collections (the
+/// order of the hit lines). To be called by the event action
+/// which writes the ASCII list-mode file; nothing is written
+/// when the biasing is off.
+//////////////////////////////////////////////////////////////
+void AgataDetectorAncillary::WriteEventWeights(std::ofstream &outFileLMD, const G4Event* evt)
+{
+  AgataImportanceBiasing* theBiasing = AgataImportanceBiasing::GetInstance();
+  if( !theBiasing->IsBiasing() ) return;
+
+  G4HCofThisEvent* HCE = evt->GetHCofThisEvent();
+  for( G4int ii=0; HCE && ii<HCE->GetNumberOfCollections(); ii++ ) {
+    G4THitsCollection<AgataHitDetector>* theHits =
+      dynamic_cast<G4THitsCollection<AgataHitDetector>*>( HCE->GetHC(ii) );
+    if( !theHits ) continue;
+    for( size_t jj=0; jj<theHits->GetSize(); jj++ ) {
+      AgataHitDetector* theHit = (*theHits)[jj];
+      if( theHit->GetDetNb() < minOffset + 1000 ) continue;
+      outFileLMD << " -200 " << theHit->GetDetNb() << " " << theHit->GetSegNb() << " "
+                 << theBiasing->GetWeight( theHit->GetTrackID(), theHit->GetTime() ) << G4endl;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////
+/// Same information as the ASCII header above, for the binary
+/// list-mode file: one descriptor per ancillary with its name
+/// and the offsets of its SensitiveDetector instances
+//////////////////////////////////////////////////////////////
+void AgataDetectorAncillary::WriteHeader(AgataListModeWriter* theWriter, G4double unitLength)
+{
+  G4int offset = 0, ii, jj;
+  std::vector<G4int> offsets;
+
+  offset = minOffset;
+  for( ii=0; ii<numAnc; ii++ ) {
+#ifdef FIXED_OFFSET
+    offset = theAncillary[ii]->GetAncOffset() - 1000;
+#endif
+    offsets.clear();
+    for( jj=0; jj<theAncillary[ii]->GetNumAncSd(); jj++ ) {
+      offset += 1000;
+      offsets.push_back(offset);
+    }
+    theWriter->AddAncillary( theAncillary[ii]->GetAncName(), offsets );
+  }
+  theWriter->CommitHeader( unitLength );
+}
+
+//////////////////////////////////////////////////////////////
+/// Hits of all the ancillaries live in the per-thread arena:
+/// a new generation starts with each event, the memory of the
+/// previous ones is reused once their G4Event is deleted
+//////////////////////////////////////////////////////////////
+void AgataDetectorAncillary::BeginOfEvent()
+{
+  AgataHitArena::GetInstance()->NewEvent();
+}
+
+//////////////////////////////////////////////////////////////
+/// Binary list-mode output (/Agata/file/binary/): opened by the
+/// master when the run starts, each tracking thread writes the
+/// ancillary hits of its events, and the file is closed by the
+/// master once the workers have flushed their blocks
+//////////////////////////////////////////////////////////////
+void AgataDetectorAncillary::BeginOfRun( G4double unitLength )
+{
+  AgataListModeWriter* theWriter = AgataListModeWriter::GetInstance();
+  if( !G4Threading::IsMasterThread() || !theWriter->IsEnabled() ) return;
+  if( theWriter->Open( theWriter->GetFileName() ) )
+    this->WriteHeader( theWriter, unitLength );
+}
+
+void AgataDetectorAncillary::EndOfEvent( const G4Event* evt )
+{
+  AgataListModeWriter* theWriter = AgataListModeWriter::GetInstance();
+  if( !theWriter->IsOpen() ) return;
+
+  std::vector<AgataLMHit> hits;
+  G4HCofThisEvent* HCE = evt->GetHCofThisEvent();
+  G4double unitLength  = theWriter->GetUnitLength();
+  AgataImportanceBiasing* theBiasing = AgataImportanceBiasing::GetInstance();
+  for( G4int ii=0; HCE && ii<HCE->GetNumberOfCollections(); ii++ ) {
+    G4THitsCollection<AgataHitDetector>* theHits =
+      dynamic_cast<G4THitsCollection<AgataHitDetector>*>( HCE->GetHC(ii) );
+    if( !theHits ) continue;
+    for( size_t jj=0; jj<theHits->GetSize(); jj++ ) {
+      AgataHitDetector* theHit = (*theHits)[jj];
+      //> only the ancillaries: the AGATA crystals are below the first offset
+      if( theHit->GetDetNb() < minOffset + 1000 ) continue;
+      AgataLMHit hit;
+      hit.detCode = theHit->GetDetNb();
+      hit.segment = theHit->GetSegNb();
+      hit.energy  = theHit->GetEdep()/keV;
+      hit.x       = theHit->GetPos().x()/unitLength;
+      hit.y       = theHit->GetPos().y()/unitLength;
+      hit.z       = theHit->GetPos().z()/unitLength;
+      hit.time    = theHit->GetTime()/ns;
+      hit.weight  = theBiasing->GetWeight( theHit->GetTrackID(), theHit->GetTime() );
+      hits.push_back(hit);
+    }
+  }
+  theWriter->WriteEvent( evt->GetEventID(), hits );
+}
+
+void AgataDetectorAncillary::EndOfRun()
+{
+  AgataHitArena::GetInstance()->PrintStatistics();
+
+  //> the master comes here after all the workers
+  AgataListModeWriter* theWriter = AgataListModeWriter::GetInstance();
+  theWriter->FlushThread();
+  if( G4Threading::IsMasterThread() )
+    theWriter->Close();
 }
 
 //////////////////////////////////////////////////////////////
@@ -0,0 +1,343 @@
+//////////////////////////////////////////////////////////////////
+/// Offline GDML validation with a cache of validated files
+/// (see AgataGdmlValidator.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataGdmlValidator.hh"
+#include "AgataTriangleMesh.hh"
+
+#include "G4GenericMessenger.hh"
+
+#include <xercesc/parsers/XercesDOMParser.hpp>
+#include <xercesc/sax/HandlerBase.hpp>
+#include <xercesc/sax/SAXParseException.hpp>
+#include <xercesc/util/XMLEntityResolver.hpp>
+#include <xercesc/util/XMLResourceIdentifier.hpp>
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLException.hpp>
+#include <xercesc/dom/DOMException.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+#include <xercesc/framework/LocalFileInputSource.hpp>
+#include <xercesc/framework/MemBufInputSource.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+
+XERCES_CPP_NAMESPACE_USE
+
+namespace {
+
+  G4String Transcode( const XMLCh* text )
+  {
+    if( !text ) return "";
+    char* chars = XMLString::transcode(text);
+    G4String result(chars);
+    XMLString::release(&chars);
+    return result;
+  }
+
+  //////////////////////////////////////////////////////////
+  /// Schemas by name from the local directory; remote
+  /// entities become empty documents; local files as usual
+  //////////////////////////////////////////////////////////
+  class OfflineResolver : public XMLEntityResolver
+  {
+    public:
+      OfflineResolver( const G4String& dir ) : schemaDir(dir) {};
+
+    private:
+      G4String schemaDir;
+
+    public:
+      InputSource* resolveEntity( XMLResourceIdentifier* resource )
+      {
+        G4String systemId = Transcode( resource->getSystemId() );
+        G4String base     = systemId.substr( systemId.rfind('/') + 1 );
+
+        if( base.size() > 4 && base.compare( base.size()-4, 4, ".xsd" ) == 0 ) {
+          XMLCh* path = XMLString::transcode( ( schemaDir + "/" + base ).c_str() );
+          InputSource* source = new LocalFileInputSource(path);
+          XMLString::release(&path);
+          return source;
+        }
+        if( systemId.find("://") != std::string::npos && systemId.compare(0,7,"file://") != 0 ) {
+          static const unsigned char empty[] = "";
+          return new MemBufInputSource( empty, 0, systemId.c_str() );
+        }
+        XMLCh* rel = XMLString::transcode( systemId.c_str() );
+        InputSource* source = new LocalFileInputSource( resource->getBaseURI(), rel );
+        XMLString::release(&rel);
+        return source;
+      }
+  };
+
+  class CountingHandler : public HandlerBase
+  {
+    public:
+      CountingHandler() : nErrors(0) {};
+      G4int nErrors;
+
+    private:
+      void Print( const char* kind, const SAXParseException& ex )
+      {
+        if( nErrors <= 10 )
+          G4cout << "      " << kind << " line " << ex.getLineNumber() << ": "
+                 << Transcode( ex.getMessage() ) << G4endl;
+      }
+
+    public:
+      void warning   ( const SAXParseException& ) {};
+      void error     ( const SAXParseException& ex ) { nErrors++; Print( "error", ex ); };
+      void fatalError( const SAXParseException& ex ) { nErrors++; Print( "fatal error", ex ); };
+  };
+}
+
+AgataGdmlValidator* AgataGdmlValidator::instance = NULL;
+
+AgataGdmlValidator* AgataGdmlValidator::GetInstance()
+{
+  if( !instance )
+    instance = new AgataGdmlValidator();
+  return instance;
+}
+
+void AgataGdmlValidator::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataGdmlValidator::AgataGdmlValidator()
+{
+  enabled = true;
+  const char* env = getenv("AGATA_GDML_SCHEMA");
+  schemaDir = env ? env : "";
+  schemaHash = 0;
+  xercesReady = false;
+  nValidated  = 0;
+
+  env = getenv("AGATA_GDML_CACHE");
+  if( env )
+    cacheFile = env;
+  else {
+    const char* home = getenv("HOME");
+    cacheFile = G4String( home ? home : "." ) + "/.agata_gdml_validated";
+  }
+  cacheLoaded = false;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/gdml/", "Offline validation of the GDML files" );
+  myMessenger->DeclareProperty( "validate", enabled,
+                                "Validates the GDML files before reading them (an invalid file is fatal)" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "schemaDir", &AgataGdmlValidator::SetSchemaDir,
+                              "Directory with the GDML schemas (gdml.xsd, ...)" )
+    .SetParameterName( "dir", false )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "cacheFile", &AgataGdmlValidator::SetCacheFile,
+                              "File keeping the hashes of the validated GDML files" )
+    .SetParameterName( "file", false )
+    .SetToBeBroadcasted( false );
+}
+
+AgataGdmlValidator::~AgataGdmlValidator()
+{
+  if( xercesReady ) XMLPlatformUtils::Terminate();
+  delete myMessenger;
+}
+
+uint64_t AgataGdmlValidator::HashFile( const G4String& fileName, uint64_t seed, G4bool& found )
+{
+  std::ifstream inFile( fileName.c_str(), std::ios::in | std::ios::binary );
+  std::ostringstream buffer;
+  found = inFile.is_open();
+  if( found ) buffer << inFile.rdbuf();
+  G4String text = buffer.str();
+  return AgataHashBytes( text.data(), text.size(), seed );
+}
+
+//////////////////////////////////////////////////////////////
+/// A document is valid or not with the entities it includes:
+/// their names and contents enter its key
+//////////////////////////////////////////////////////////////
+uint64_t AgataGdmlValidator::HashDocument( const G4String& fileName, uint64_t seed, G4bool& found )
+{
+  std::ifstream inFile( fileName.c_str(), std::ios::in | std::ios::binary );
+  std::ostringstream buffer;
+  found = inFile.is_open();
+  if( found ) buffer << inFile.rdbuf();
+  G4String text = buffer.str();
+  uint64_t hash = AgataHashBytes( text.data(), text.size(), seed );
+
+  G4String dir = "";
+  size_t slash = fileName.rfind('/');
+  if( slash != std::string::npos )
+    dir = fileName.substr( 0, slash+1 );
+  const G4String key = "SYSTEM \"";
+  size_t pos = 0;
+  while( ( pos = text.find( key, pos ) ) != std::string::npos ) {
+    pos += key.size();
+    size_t end = text.find( '"', pos );
+    if( end == std::string::npos ) break;
+    G4String name = text.substr( pos, end-pos );
+    if( !name.empty() && name[0] != '/' )
+      name = dir + name;
+    G4bool entityFound;
+    hash = AgataHashBytes( name.data(), name.size(), hash );
+    hash = HashFile( name, hash, entityFound );
+    pos = end;
+  }
+  return hash;
+}
+
+//////////////////////////////////////////////////////////////
+/// The bundled schemas sit in AGATA/GDMLSchema, next to the
+/// directories of the ancillaries
+//////////////////////////////////////////////////////////////
+G4String AgataGdmlValidator::FindSchemaDir( const G4String& fileName )
+{
+  if( !schemaDir.empty() ) return schemaDir;
+  size_t slash = fileName.rfind('/');
+  G4String dir = ( slash != std::string::npos ) ? fileName.substr( 0, slash ) : G4String(".");
+  G4String candidate = dir + "/../GDMLSchema";
+  if( access( ( candidate + "/gdml.xsd" ).c_str(), R_OK ) == 0 ) return candidate;
+  return "./GDMLSchema";
+}
+
+//////////////////////////////////////////////////////////////
+/// A file valid against some schemas may not be against others:
+/// the hash of all the .xsd of the directory enters the keys
+//////////////////////////////////////////////////////////////
+uint64_t AgataGdmlValidator::HashSchemas( const G4String& dir )
+{
+  std::vector<G4String> names;
+  DIR* theDir = opendir( dir.c_str() );
+  if( theDir ) {
+    struct dirent* entry;
+    while( ( entry = readdir(theDir) ) != NULL ) {
+      G4String name = entry->d_name;
+      if( name.size() > 4 && name.compare( name.size()-4, 4, ".xsd" ) == 0 )
+        names.push_back(name);
+    }
+    closedir(theDir);
+  }
+  std::sort( names.begin(), names.end() );
+
+  uint64_t hash = AgataHashBytes( "AgataGdmlValidator", 18 );
+  for( size_t ii=0; ii<names.size(); ii++ ) {
+    G4bool found;
+    hash = AgataHashBytes( names[ii].data(), names[ii].size(), hash );
+    hash = HashFile( dir + "/" + names[ii], hash, found );
+  }
+  return hash;
+}
+
+void AgataGdmlValidator::LoadCache()
+{
+  knownGood.clear();
+  cacheLoaded = true;
+  std::ifstream inFile( cacheFile.c_str() );
+  std::string line;
+  while( std::getline( inFile, line ) ) {
+    unsigned long long hash;
+    if( sscanf( line.c_str(), "%llx", &hash ) == 1 )
+      knownGood.insert(hash);
+  }
+}
+
+void AgataGdmlValidator::Record( uint64_t hash, const G4String& fileName )
+{
+  knownGood.insert(hash);
+  std::ofstream outFile( cacheFile.c_str(), std::ios::app );
+  if( !outFile.is_open() ) return;
+  char hex[17];
+  snprintf( hex, sizeof(hex), "%016llx", (unsigned long long)hash );
+  outFile << hex << " " << fileName << std::endl;
+}
+
+G4bool AgataGdmlValidator::Check( const std::vector<G4String>& fileNames )
+{
+  if( !enabled || fileNames.empty() ) return true;
+  if( !cacheLoaded ) LoadCache();
+
+  G4String dir = FindSchemaDir( fileNames[0] );
+  if( access( ( dir + "/gdml.xsd" ).c_str(), R_OK ) != 0 ) {
+    G4ExceptionDescription msg;
+    msg << "No gdml.xsd in " << dir << ": the GDML files are read WITHOUT validation."
+        << " Set /Agata/geometry/gdml/schemaDir or $AGATA_GDML_SCHEMA.";
+    G4Exception( "AgataGdmlValidator::Check()", "AgataGdml001", JustWarning, msg );
+    return true;
+  }
+  if( dir != usedSchemaDir ) {
+    usedSchemaDir = dir;
+    schemaHash    = HashSchemas(dir);
+  }
+
+  G4bool valid = true;
+  for( size_t ii=0; ii<fileNames.size(); ii++ ) {
+    const G4String& fileName = fileNames[ii];
+    //> entities (materials) are checked as part of the document including them
+    if( fileName.size() < 5 || fileName.compare( fileName.size()-5, 5, ".gdml" ) != 0 ) continue;
+
+    G4bool found;
+    uint64_t hash = HashDocument( fileName, schemaHash, found );
+    if( !found ) {
+      G4cout << " Could not read " << fileName << " for validation" << G4endl;
+      valid = false;
+      continue;
+    }
+    if( knownGood.find(hash) != knownGood.end() ) continue;
+    if( Validate(fileName) )
+      Record( hash, fileName );
+    else
+      valid = false;
+  }
+  return valid;
+}
+
+G4bool AgataGdmlValidator::Validate( G4String fileName )
+{
+  if( !xercesReady ) {
+    XMLPlatformUtils::Initialize();
+    xercesReady = true;
+  }
+  nValidated++;
+
+  G4String         dir    = usedSchemaDir.empty() ? FindSchemaDir(fileName) : usedSchemaDir;
+  XercesDOMParser* parser = new XercesDOMParser;
+  OfflineResolver  resolver(dir);
+  CountingHandler  handler;
+
+  parser->setValidationScheme( XercesDOMParser::Val_Always );
+  parser->setDoNamespaces(true);
+  parser->setDoSchema(true);
+  parser->setValidationSchemaFullChecking(true);
+  parser->setDisableDefaultEntityResolution(true);
+  parser->setXMLEntityResolver(&resolver);
+  parser->setErrorHandler(&handler);
+  parser->setExternalNoNamespaceSchemaLocation( ( dir + "/gdml.xsd" ).c_str() );
+
+  G4cout << " ---> Validating " << fileName << " against " << dir << "/gdml.xsd" << G4endl;
+  try {
+    parser->parse( fileName.c_str() );
+  }
+  catch( const XMLException& ex ) {
+    G4cout << "      " << Transcode( ex.getMessage() ) << G4endl;
+    handler.nErrors++;
+  }
+  catch( const DOMException& ex ) {
+    G4cout << "      " << Transcode( ex.getMessage() ) << G4endl;
+    handler.nErrors++;
+  }
+  delete parser;
+
+  if( handler.nErrors > 0 )
+    G4cout << " ---> " << fileName << ": " << handler.nErrors << " validation errors" << G4endl;
+  return handler.nErrors == 0;
+}
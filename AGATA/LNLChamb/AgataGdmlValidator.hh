@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////
+/// Offline validation of the GDML files against the bundled
+/// schemas (AGATA/GDMLSchema). The schema locations written in the
+/// documents (absolute paths of the exporting machine, CERN URLs)
+/// are ignored: every .xsd is taken by name from the local schema
+/// directory, and any other remote resource resolves to an empty
+/// document, so the network is never used.
+/// Only the files the parser will read are checked, i.e. those
+/// kept by AgataGeometryMask::Filter(). Files which pass are
+/// recorded in a cache file by the hash of their content, of the
+/// entities they include (e.g. LNLReactChamber_materials.xml) and
+/// of the schemas; the next time they are not validated again.
+/// The parser is then always called with validation off.
+///
+///   /Agata/geometry/gdml/validate  <flag>  (default true)
+///   /Agata/geometry/gdml/schemaDir <dir>   (default $AGATA_GDML_SCHEMA, else
+///                                           ../GDMLSchema next to the checked
+///                                           files, i.e. AGATA/GDMLSchema,
+///                                           else ./GDMLSchema)
+///   /Agata/geometry/gdml/cacheFile <file>  (default $AGATA_GDML_CACHE or ~/.agata_gdml_validated)
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataGdmlValidator_h
+#define AgataGdmlValidator_h 1
+
+#include "globals.hh"
+
+#include <set>
+#include <vector>
+#include <stdint.h>
+
+class G4GenericMessenger;
+
+class AgataGdmlValidator
+{
+  public:
+    static AgataGdmlValidator* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataGdmlValidator();
+
+  public:
+    ~AgataGdmlValidator();
+
+  private:
+    static AgataGdmlValidator* instance;
+
+  private:
+    G4bool              enabled;
+    G4String            schemaDir;     //> empty: the default one
+    G4String            cacheFile;
+    std::set<uint64_t>  knownGood;
+    G4bool              cacheLoaded;
+    uint64_t            schemaHash;    //> of the schemas of usedSchemaDir
+    G4String            usedSchemaDir;
+    G4bool              xercesReady;   //> initialised once, terminated at deletion
+    G4int               nValidated;
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> validates the GDML documents among fileNames (the includes are
+    //> not followed), unless already known good; returns false if any
+    //> of them is invalid
+    G4bool   Check     ( const std::vector<G4String>& fileNames );
+    //> validation only, no cache
+    G4bool   Validate  ( G4String fileName );
+
+  private:
+    uint64_t HashFile  ( const G4String& fileName, uint64_t seed, G4bool& found );
+    //> the document and the SYSTEM entities it includes
+    uint64_t HashDocument( const G4String& fileName, uint64_t seed, G4bool& found );
+    G4String FindSchemaDir( const G4String& fileName );
+    uint64_t HashSchemas( const G4String& dir );
+    void     LoadCache ();
+    void     Record    ( uint64_t hash, const G4String& fileName );
+
+  public:
+    inline void SetSchemaDir( G4String dir )  { schemaDir = dir; };
+    inline G4bool IsEnabled()                 { return enabled; };
+    inline G4int  GetNumberOfValidations()    { return nValidated; };
+    inline void SetCacheFile( G4String file ) { cacheFile = file; cacheLoaded = false; };
+};
+
+#endif
@@ -0,0 +1,492 @@
+//////////////////////////////////////////////////////////////////
+/// Masking profiles for the GDML geometries
+/// (see AgataGeometryMask.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataGeometryMask.hh"
+#include "AgataSurfaceSampler.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Box.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4DisplacedSolid.hh"
+#include "G4NistManager.hh"
+#include "G4GenericMessenger.hh"
+
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <set>
+
+AgataGeometryMask* AgataGeometryMask::instance = NULL;
+
+AgataGeometryMask* AgataGeometryMask::GetInstance()
+{
+  if( !instance )
+    instance = new AgataGeometryMask();
+  return instance;
+}
+
+void AgataGeometryMask::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataGeometryMask::AgataGeometryMask()
+{
+  nSkippedFiles   = 0;
+  skippedBytes    = 0.;
+  skippedFacets   = 0;
+  readBytes       = 0.;
+  nRemovedVolumes = 0;
+  removedFacets   = 0;
+  filteredFd      = -1;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/mask/",
+                                        "Masking of parts of the GDML geometries" );
+  myMessenger->DeclareMethod( "load", &AgataGeometryMask::LoadProfile,
+                              "Reads a masking profile (lines of: skip|vacuum|bbox pattern)" )
+    .SetParameterName( "fileName", false )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "add", &AgataGeometryMask::AddRule,
+                              "Adds one rule: skip|vacuum|bbox pattern" )
+    .SetParameterName( "rule", false )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "clear", &AgataGeometryMask::Clear, "Removes all the rules" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataGeometryMask::~AgataGeometryMask()
+{
+  Release();
+  delete myMessenger;
+}
+
+void AgataGeometryMask::LoadProfile( G4String fileName )
+{
+  std::ifstream inFile( fileName.c_str() );
+  if( !inFile.is_open() ) {
+    G4cout << " Could not open masking profile " << fileName << G4endl;
+    return;
+  }
+  std::string line;
+  while( std::getline( inFile, line ) ) {
+    size_t hash = line.find('#');
+    if( hash != std::string::npos ) line.erase(hash);
+    if( line.find_first_not_of(" \t\r") == std::string::npos ) continue;
+    AddRule(line);
+  }
+}
+
+void AgataGeometryMask::AddRule( G4String command )
+{
+  std::istringstream words(command);
+  std::string action, pattern;
+  words >> action >> pattern;
+
+  Rule rule;
+  rule.pattern = pattern;
+  if     ( action == "skip"   ) rule.action = kSkip;
+  else if( action == "vacuum" ) rule.action = kVacuum;
+  else if( action == "bbox"   ) rule.action = kBoundingBox;
+  else {
+    G4cout << " Unknown masking action \"" << action << "\" (skip, vacuum or bbox)" << G4endl;
+    return;
+  }
+  if( pattern.empty() ) {
+    G4cout << " Masking rule \"" << command << "\" has no pattern" << G4endl;
+    return;
+  }
+  rules.push_back(rule);
+  Release();
+  G4cout << " ---> Geometry mask: " << action << " " << pattern << G4endl;
+}
+
+void AgataGeometryMask::Clear()
+{
+  rules.clear();
+  Release();
+}
+
+//////////////////////////////////////////////////////////////
+/// The first matching rule wins
+//////////////////////////////////////////////////////////////
+AgataGeometryMask::MaskAction AgataGeometryMask::GetAction( const G4String& name ) const
+{
+  for( size_t ii=0; ii<rules.size(); ii++ ) {
+    if( fnmatch( rules[ii].pattern.c_str(), name.c_str(), 0 ) == 0 )
+      return rules[ii].action;
+  }
+  return kKeep;
+}
+
+////////////////////////////////////////////////////////////
+/// Before parsing: drop the skipped sub-files. Only the
+/// assembly is read; the sizes of the sub-files come from stat()
+////////////////////////////////////////////////////////////
+namespace {
+  G4double FileSize( const G4String& fileName )
+  {
+    struct stat info;
+    return ( stat( fileName.c_str(), &info ) == 0 ) ? (G4double)info.st_size : 0.;
+  }
+
+  //> facets are counted from the tags, without parsing
+  G4int FileFacets( const G4String& fileName )
+  {
+    std::ifstream inFile( fileName.c_str() );
+    G4int nFacets = 0;
+    std::string line;
+    while( std::getline( inFile, line ) ) {
+      if( line.find( "<triangular"   ) != std::string::npos ) nFacets++;
+      if( line.find( "<quadrangular" ) != std::string::npos ) nFacets++;
+    }
+    return nFacets;
+  }
+
+  //> next key at or after pos outside of the XML comments (e.g. the
+  //> Prisma parts commented out in the LNL assembly)
+  size_t FindOutsideComments( const G4String& text, const G4String& key, size_t pos )
+  {
+    while( true ) {
+      size_t found = text.find( key, pos );
+      if( found == std::string::npos ) return found;
+      size_t open = text.find( "<!--", pos );
+      if( open == std::string::npos || open > found ) return found;
+      size_t close = text.find( "-->", open+4 );
+      if( close == std::string::npos ) return std::string::npos;
+      pos = close + 3;
+    }
+  }
+}
+
+std::vector<G4String> AgataGeometryMask::FindIncludes( G4String fileName, const G4String& text )
+{
+  std::vector<G4String> includes;
+  G4String dir = "";
+  size_t slash = fileName.rfind('/');
+  if( slash != std::string::npos )
+    dir = fileName.substr( 0, slash+1 );
+
+  //> SYSTEM "..." entities (expanded first), <file name="..."/> inside physvols
+  const char* keys[2] = { "SYSTEM \"", "<file name=\"" };
+  for( G4int kk=0; kk<2; kk++ ) {
+    G4String key = keys[kk];
+    size_t pos = 0;
+    while( ( pos = FindOutsideComments( text, key, pos ) ) != std::string::npos ) {
+      pos += key.size();
+      size_t end = text.find( '"', pos );
+      if( end == std::string::npos ) break;
+      G4String name = text.substr( pos, end-pos );
+      if( !name.empty() && name[0] != '/' )
+        name = dir + name;
+      includes.push_back(name);
+      pos = end;
+    }
+  }
+  return includes;
+}
+
+G4String AgataGeometryMask::Filter( G4String fileName )
+{
+  //> same file, same rules: already done
+  if( fileName == lastInput ) return lastOutput;
+  Release();
+  lastInput  = fileName;
+  lastOutput = fileName;
+  keptFiles.clear();
+
+  nSkippedFiles = 0;
+  skippedBytes  = 0.;
+  skippedFacets = 0;
+  readBytes     = 0.;
+  if( rules.empty() ) return fileName;
+
+  std::ifstream inFile( fileName.c_str() );
+  if( !inFile.is_open() ) return fileName;
+  std::ostringstream buffer;
+  buffer << inFile.rdbuf();
+  G4String text = buffer.str();
+  G4String filtered;
+
+  G4String dir = "";
+  size_t slash = fileName.rfind('/');
+  if( slash != std::string::npos )
+    dir = fileName.substr( 0, slash+1 );
+
+  size_t pos = 0, start;
+  while( ( start = FindOutsideComments( text, "<physvol", pos ) ) != std::string::npos ) {
+    size_t end = text.find( "</physvol>", start );
+    if( end == std::string::npos ) break;
+    end += 10;
+    G4String block = text.substr( start, end-start );
+
+    //> the sub-file name, without path and extension
+    std::vector<G4String> files = FindIncludes( fileName, block );
+    G4bool skip = false;
+    if( !files.empty() ) {
+      G4String base = files[0];
+      size_t bs = base.rfind('/');
+      if( bs != std::string::npos ) base = base.substr(bs+1);
+      size_t dot = base.rfind(".gdml");
+      if( dot != std::string::npos ) base = base.substr(0,dot);
+
+      if( GetAction(base) == kSkip ) {
+        skip = true;
+        nSkippedFiles++;
+        skippedBytes  += FileSize( files[0] );
+        skippedFacets += FileFacets( files[0] );
+        G4cout << " ---> Geometry mask: " << base << " will not be read" << G4endl;
+      }
+      else
+        readBytes += FileSize( files[0] );
+    }
+
+    filtered += text.substr( pos, start-pos );
+    if( !skip ) filtered += block;
+    pos = end;
+  }
+  filtered += text.substr(pos);
+
+  keptFiles.assign( 1, fileName );
+  std::vector<G4String> includes = FindIncludes( fileName, filtered );
+  keptFiles.insert( keptFiles.end(), includes.begin(), includes.end() );
+  if( nSkippedFiles == 0 ) return fileName;
+
+  //> the copy is not next to the original: relative references must become absolute
+  const char* keys[2] = { "SYSTEM \"", "<file name=\"" };
+  for( G4int kk=0; kk<2; kk++ ) {
+    G4String key = keys[kk];
+    pos = 0;
+    while( ( pos = filtered.find( key, pos ) ) != std::string::npos ) {
+      pos += key.size();
+      if( filtered[pos] != '/' ) {
+        G4String rel = filtered.substr( pos, filtered.find('"',pos)-pos );
+        if( rel.compare(0,2,"./") == 0 ) rel = rel.substr(2);
+        filtered.replace( pos, filtered.find('"',pos)-pos, dir + rel );
+      }
+    }
+  }
+
+  //> on Linux the filtered assembly only exists in memory (an anonymous
+  //> file) which the parser opens through /proc: nothing is left on disk.
+  //> Elsewhere it is a temporary file, removed by Release()
+  G4int fd = -1;
+  G4String copyName;
+#if defined(__linux__) && defined(SYS_memfd_create)
+  fd = syscall( SYS_memfd_create, "AgataMasked", 0 );
+  std::ostringstream procName;
+  procName << "/proc/self/fd/" << fd;
+  copyName = procName.str();
+#else
+  const char* tmpDir = getenv("TMPDIR");
+  std::string pattern = std::string( tmpDir ? tmpDir : "/tmp" ) + "/AgataMaskedXXXXXX";
+  std::vector<char> name( pattern.begin(), pattern.end() );
+  name.push_back('\0');
+  fd = mkstemp( &name[0] );
+  copyName = G4String( &name[0] );
+#endif
+  if( fd < 0 ) {
+    G4cout << " Could not create the masked copy of " << fileName << ", reading it as it is" << G4endl;
+    return fileName;
+  }
+  size_t written = 0;
+  while( written < filtered.size() ) {
+    ssize_t nn = write( fd, filtered.data() + written, filtered.size() - written );
+    if( nn <= 0 ) break;
+    written += nn;
+  }
+  filteredFd = fd;
+#if !( defined(__linux__) && defined(SYS_memfd_create) )
+  filteredCopy = copyName;
+#endif
+  if( written < filtered.size() ) {
+    Release();
+    lastInput  = fileName;
+    lastOutput = fileName;
+    G4cout << " Could not write the masked copy of " << fileName << ", reading it as it is" << G4endl;
+    return fileName;
+  }
+  lastOutput = copyName;
+  return lastOutput;
+}
+
+const std::vector<G4String>& AgataGeometryMask::GetKeptFiles()
+{
+  //> without rules Filter() did not read the assembly: everything it includes
+  if( keptFiles.empty() && !lastInput.empty() ) {
+    std::ifstream inFile( lastInput.c_str() );
+    std::ostringstream buffer;
+    if( inFile.is_open() ) buffer << inFile.rdbuf();
+    keptFiles.assign( 1, lastInput );
+    std::vector<G4String> includes = FindIncludes( lastInput, buffer.str() );
+    keptFiles.insert( keptFiles.end(), includes.begin(), includes.end() );
+  }
+  return keptFiles;
+}
+
+void AgataGeometryMask::Release()
+{
+  if( filteredFd >= 0 ) close( filteredFd );
+  filteredFd = -1;
+  if( !filteredCopy.empty() ) remove( filteredCopy.c_str() );
+  filteredCopy = "";
+  lastInput  = "";
+  lastOutput = "";
+  keptFiles.clear();
+}
+
+////////////////////////////////////////////////////////////
+/// After parsing: skip (volumes), vacuum and bounding box
+////////////////////////////////////////////////////////////
+void AgataGeometryMask::Apply( G4LogicalVolume* top )
+{
+  nRemovedVolumes = 0;
+  removedFacets   = 0;
+  if( rules.empty() ) return;
+  ApplyTo(top);
+}
+
+void AgataGeometryMask::ApplyTo( G4LogicalVolume* lv )
+{
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = lv->GetDaughter(ii);
+    G4LogicalVolume*   dLog     = daughter->GetLogicalVolume();
+    MaskAction action = GetAction( dLog->GetName() );
+    if( action == kKeep )
+      action = GetAction( daughter->GetName() );
+
+    if( action == kSkip ) {
+      //> not a sub-file (those never reach here): the placement goes
+      G4cout << " ---> Geometry mask: " << daughter->GetName() << " removed (read, not placed)" << G4endl;
+      lv->RemoveDaughter(daughter);
+      DeleteTree( std::vector<G4VPhysicalVolume*>( 1, daughter ) );
+      ii--;
+    }
+    else if( action == kVacuum ) {
+      dLog->SetMaterial( G4NistManager::Instance()->FindOrBuildMaterial("G4_Galactic") );
+      DeleteDaughters(dLog);
+      G4cout << " ---> Geometry mask: " << dLog->GetName() << " filled with vacuum" << G4endl;
+    }
+    else if( action == kBoundingBox ) {
+      G4VSolid* solid = dLog->GetSolid();
+      G4ThreeVector pMin, pMax;
+      solid->BoundingLimits( pMin, pMax );
+      G4ThreeVector half   = 0.5 * ( pMax - pMin );
+      G4ThreeVector centre = 0.5 * ( pMax + pMin );
+      G4String name = solid->GetName() + "_bbox";
+      G4Box* box = new G4Box( name, half.x(), half.y(), half.z() );
+      dLog->SetSolid( new G4DisplacedSolid( name, box, NULL, centre ) );
+      DeleteSolid(solid);
+      DeleteDaughters(dLog);
+      G4cout << " ---> Geometry mask: " << dLog->GetName() << " replaced by its bounding box" << G4endl;
+    }
+    else
+      ApplyTo(dLog);
+  }
+}
+
+void AgataGeometryMask::DeleteDaughters( G4LogicalVolume* lv )
+{
+  std::vector<G4VPhysicalVolume*> daughters;
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ )
+    daughters.push_back( lv->GetDaughter(ii) );
+  lv->ClearDaughters();
+  DeleteTree(daughters);
+}
+
+//////////////////////////////////////////////////////////////
+/// The placements (already out of their mother) go, and with
+/// them the volumes below which are placed nowhere else, and
+/// their solids when no other volume uses them. The volumes and
+/// solids leave their stores when deleted.
+/// The constituents of Boolean solids are left to G4SolidStore.
+//////////////////////////////////////////////////////////////
+void AgataGeometryMask::DeleteTree( const std::vector<G4VPhysicalVolume*>& placements )
+{
+  //> the volumes below the placements
+  std::set<G4LogicalVolume*> below;
+  std::vector<G4LogicalVolume*> toVisit;
+  for( size_t ii=0; ii<placements.size(); ii++ )
+    toVisit.push_back( placements[ii]->GetLogicalVolume() );
+  while( !toVisit.empty() ) {
+    G4LogicalVolume* lv = toVisit.back();
+    toVisit.pop_back();
+    if( !below.insert(lv).second ) continue;
+    for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ )
+      toVisit.push_back( lv->GetDaughter(ii)->GetLogicalVolume() );
+  }
+
+  //> those still placed in a volume outside, and everything below them, stay
+  G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+  std::set<G4LogicalVolume*> kept;
+  for( size_t ii=0; ii<theStore->size(); ii++ ) {
+    G4LogicalVolume* lv = (*theStore)[ii];
+    if( below.count(lv) ) continue;
+    for( size_t jj=0; jj<lv->GetNoDaughters(); jj++ )
+      toVisit.push_back( lv->GetDaughter(jj)->GetLogicalVolume() );
+  }
+  while( !toVisit.empty() ) {
+    G4LogicalVolume* lv = toVisit.back();
+    toVisit.pop_back();
+    if( !below.count(lv) || !kept.insert(lv).second ) continue;
+    for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ )
+      toVisit.push_back( lv->GetDaughter(ii)->GetLogicalVolume() );
+  }
+
+  //> ~G4VPhysicalVolume and ~G4LogicalVolume deregister them
+  std::vector<G4LogicalVolume*> volumes;
+  for( std::set<G4LogicalVolume*>::iterator it=below.begin(); it!=below.end(); ++it ) {
+    if( kept.count(*it) ) continue;
+    volumes.push_back(*it);
+    for( size_t ii=0; ii<(*it)->GetNoDaughters(); ii++ )
+      delete (*it)->GetDaughter(ii);
+    (*it)->ClearDaughters();
+  }
+  for( size_t ii=0; ii<placements.size(); ii++ )
+    delete placements[ii];
+  std::set<G4VSolid*> solids;
+  for( size_t ii=0; ii<volumes.size(); ii++ ) {
+    solids.insert( volumes[ii]->GetSolid() );
+    delete volumes[ii];
+  }
+  for( std::set<G4VSolid*>::iterator it=solids.begin(); it!=solids.end(); ++it )
+    DeleteSolid(*it);
+  nRemovedVolumes += volumes.size();
+}
+
+void AgataGeometryMask::DeleteSolid( G4VSolid* solid )
+{
+  G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+  for( size_t ii=0; ii<theStore->size(); ii++ )
+    if( (*theStore)[ii]->GetSolid() == solid ) return;
+
+  G4TessellatedSolid* tess = dynamic_cast<G4TessellatedSolid*>(solid);
+  if( tess ) removedFacets += tess->GetNumberOfFacets();
+  AgataSurfaceSampler::Forget(solid);
+  delete solid;
+}
+
+void AgataGeometryMask::Report( G4double parseSeconds )
+{
+  if( nSkippedFiles > 0 ) {
+    G4cout << " ---> Geometry mask: " << nSkippedFiles << " files ("
+           << skippedBytes/1048576. << " MB, " << skippedFacets << " facets) not read";
+    if( readBytes > 0. )
+      G4cout << ", about " << parseSeconds * skippedBytes / readBytes << " s of parsing saved";
+    G4cout << G4endl;
+  }
+  if( nRemovedVolumes > 0 || removedFacets > 0 )
+    G4cout << " ---> Geometry mask: " << nRemovedVolumes << " volumes and " << removedFacets
+           << " facets removed after parsing" << G4endl;
+}
@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////
+/// Masking profiles for the GDML geometries: parts matched by name
+/// (shell wildcards) can be
+///   skip    - never read: the <physvol><file .../></physvol> is
+///             removed from an in-memory copy of the assembly; the
+///             other volumes are read, and their placement removed
+///   vacuum  - read, but filled with G4_Galactic (daughters dropped)
+///   bbox    - read, but replaced by its bounding box
+/// Patterns are matched against sub-file names (without .gdml),
+/// logical and physical volume names. A profile is a text file
+/// with one "action pattern" per line (# for comments), e.g.
+///   skip   feedtrough_*
+///   skip   React_Chamb_Bdump_compact_Aluminium
+///   bbox   heavy_*
+/// The volumes, solids and facets masked after parsing are deleted
+/// (unless used elsewhere in the geometry) and counted with the
+/// facets of the skipped files in the report.
+/// Commands: /Agata/geometry/mask/load <file>
+///           /Agata/geometry/mask/add  <action> <pattern>
+///           /Agata/geometry/mask/clear
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataGeometryMask_h
+#define AgataGeometryMask_h 1
+
+#include "globals.hh"
+
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4VSolid;
+class G4GenericMessenger;
+
+class AgataGeometryMask
+{
+  public:
+    static AgataGeometryMask* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataGeometryMask();
+
+  public:
+    ~AgataGeometryMask();
+
+  private:
+    static AgataGeometryMask* instance;
+
+  public:
+    enum MaskAction { kKeep, kSkip, kVacuum, kBoundingBox };
+
+  private:
+    struct Rule
+    {
+      MaskAction action;
+      G4String   pattern;
+    };
+
+  private:
+    std::vector<Rule>   rules;
+    G4GenericMessenger* myMessenger;
+
+  private:
+    //> what the last Filter() call left out
+    G4int               nSkippedFiles;
+    G4double            skippedBytes;
+    G4int               skippedFacets;
+    G4double            readBytes;
+    //> what the last Apply() call removed
+    G4int               nRemovedVolumes;
+    G4int               removedFacets;
+    //> the last Filter() call, repeated calls return the same file
+    G4String            lastInput;
+    G4String            lastOutput;
+    G4int               filteredFd;   //> filtered assembly
+    G4String            filteredCopy; //> its file on disk (not on Linux)
+    std::vector<G4String> keptFiles;
+
+  public:
+    void       LoadProfile( G4String fileName );
+    void       AddRule    ( G4String command );
+    void       Clear      ();
+    MaskAction GetAction  ( const G4String& name ) const;
+    inline G4bool IsEmpty () const { return rules.empty(); };
+
+  public:
+    //> returns the file to be given to the parser: fileName itself,
+    //> or an in-memory filtered copy without the skipped sub-files
+    G4String   Filter     ( G4String fileName );
+    //> the files the parser will read after Filter(), in order:
+    //> fileName, its entities and the sub-files which are not skipped
+    const std::vector<G4String>& GetKeptFiles();
+    //> after parsing: drops the filtered copy
+    void       Release    ();
+    //> vacuum / bbox rules, to be applied to the parsed tree
+    void       Apply      ( G4LogicalVolume* top );
+    //> logs what was saved, given how long the parsing took
+    void       Report     ( G4double parseSeconds );
+
+  public:
+    inline G4int GetNumberOfSkippedFiles() const { return nSkippedFiles; };
+    inline G4int GetSkippedFacets       () const { return skippedFacets; };
+    inline G4int GetRemovedFacets       () const { return removedFacets; };
+
+  public:
+    //> files referenced by a GDML document (resolved relative to it),
+    //> outside of the XML comments
+    static std::vector<G4String> FindIncludes( G4String fileName, const G4String& text );
+
+  private:
+    void       ApplyTo    ( G4LogicalVolume* lv );
+    void       DeleteDaughters( G4LogicalVolume* lv );
+    void       DeleteTree ( const std::vector<G4VPhysicalVolume*>& placements );
+    void       DeleteSolid( G4VSolid* solid );
+};
+
+#endif
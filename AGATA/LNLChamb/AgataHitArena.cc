@@ -0,0 +1,242 @@
+//////////////////////////////////////////////////////////////////
+/// Event-scoped arena for the ancillary hits (see AgataHitArena.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataHitArena.hh"
+
+#include "G4Threading.hh"
+#include "G4AutoLock.hh"
+
+#include <cstdlib>
+#include <algorithm>
+#include <stdint.h>
+
+namespace {
+  G4Mutex arenaPrintMutex = G4MUTEX_INITIALIZER;
+
+  //> deletes the arena of a thread when the thread ends
+  struct AgataHitArenaCleanup
+  {
+    ~AgataHitArenaCleanup() { AgataHitArena::DeleteInstance(); };
+  };
+  thread_local AgataHitArenaCleanup arenaCleanup;
+}
+
+G4ThreadLocal AgataHitArena* AgataHitArena::instance = NULL;
+std::mutex AgataHitArena::arenaMutex;
+
+AgataHitArena* AgataHitArena::GetInstance()
+{
+  if( !instance ) {
+    instance = new AgataHitArena();
+    (void)&arenaCleanup;  //> registers the cleanup for this thread
+  }
+  return instance;
+}
+
+void AgataHitArena::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataHitArena::AgataHitArena()
+{
+  chunkSize    = 1 << 20;
+  used         = 0;
+  nAllocEvent  = 0;
+  nBytesEvent  = 0;
+  nHeapEvent   = 0;
+  nAllocTotal  = 0;
+  nHeapTotal   = 0;
+  nEvents      = 0;
+  peakBytes    = 0;
+  current      = NULL;
+  NewGeneration();
+}
+
+//////////////////////////////////////////////////////////////
+/// Generations still referenced (kept events) outlive the
+/// arena: they free their chunks themselves when released
+//////////////////////////////////////////////////////////////
+AgataHitArena::~AgataHitArena()
+{
+  Generation* last = current;
+  {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    last->owner = NULL;
+    for( size_t ii=0; ii<retained.size(); ii++ )
+      retained[ii]->owner = NULL;
+    retained.clear();
+    for( size_t ii=0; ii<freeChunks.size(); ii++ )
+      free( freeChunks[ii].memory );
+    freeChunks.clear();
+    for( size_t ii=0; ii<spare.size(); ii++ )
+      delete spare[ii];
+    spare.clear();
+  }
+  Release(last);
+}
+
+void AgataHitArena::NewChunk( size_t minSize )
+{
+  Chunk chunk;
+  chunk.memory = NULL;
+  {
+    //> first try the chunks released by the previous events
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    for( size_t ii=0; ii<freeChunks.size(); ii++ ) {
+      if( freeChunks[ii].size >= minSize ) {
+        chunk = freeChunks[ii];
+        freeChunks[ii] = freeChunks.back();
+        freeChunks.pop_back();
+        break;
+      }
+    }
+  }
+  if( !chunk.memory ) {
+    chunk.size   = ( minSize > chunkSize ) ? minSize : chunkSize;
+    chunk.memory = (char*)malloc( chunk.size );
+    if( !chunk.memory ) {
+      G4Exception( "AgataHitArena::NewChunk()", "AgataHitArena001", FatalException,
+                   "Out of memory while allocating a hit arena chunk" );
+    }
+    nHeapEvent++;
+    nHeapTotal++;
+  }
+  current->chunks.push_back(chunk);
+  used = 0;
+}
+
+//////////////////////////////////////////////////////////////
+/// Each object is preceded by the pointer to its generation;
+/// the address itself is aligned (not the offset in the chunk),
+/// so that any power of two can be used
+//////////////////////////////////////////////////////////////
+void* AgataHitArena::Allocate( size_t size, size_t align )
+{
+  if( align == 0 || ( align & ( align - 1 ) ) ) {
+    G4Exception( "AgataHitArena::Allocate()", "AgataHitArena002", FatalException,
+                 "The alignment must be a power of two" );
+  }
+  if( align < alignof(Generation*) ) align = alignof(Generation*);
+
+  uintptr_t base = 0, addr = 0;
+  if( !current->chunks.empty() ) {
+    base = (uintptr_t)current->chunks.back().memory;
+    addr = ( base + used + sizeof(Generation*) + align - 1 ) & ~( (uintptr_t)align - 1 );
+  }
+  if( current->chunks.empty() || addr + size > base + current->chunks.back().size ) {
+    NewChunk( sizeof(Generation*) + size + align - 1 );
+    base = (uintptr_t)current->chunks.back().memory;
+    addr = ( base + sizeof(Generation*) + align - 1 ) & ~( (uintptr_t)align - 1 );
+  }
+  *( (Generation**)addr - 1 ) = current;
+  used = addr + size - base;
+  current->live++;
+
+  nAllocEvent++;
+  nAllocTotal++;
+  nBytesEvent += size;
+  return (void*)addr;
+}
+
+void AgataHitArena::Deallocate( void* ptr )
+{
+  if( ptr ) Release( *( (Generation**)ptr - 1 ) );
+}
+
+//////////////////////////////////////////////////////////////
+/// The last reference to a generation gives its chunks back
+/// (to the arena if it still exists, to the heap otherwise).
+/// The owner is read under the mutex: the arena cannot be
+/// deleted in between.
+//////////////////////////////////////////////////////////////
+void AgataHitArena::Release( Generation* generation )
+{
+  if( --generation->live > 0 ) return;
+  {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    AgataHitArena* owner = generation->owner;
+    if( owner ) {
+      owner->Recycle(generation);
+      return;
+    }
+  }
+  for( size_t ii=0; ii<generation->chunks.size(); ii++ )
+    free( generation->chunks[ii].memory );
+  delete generation;
+}
+
+//> called with the mutex held
+void AgataHitArena::Recycle( Generation* generation )
+{
+  freeChunks.insert( freeChunks.end(), generation->chunks.begin(), generation->chunks.end() );
+  generation->chunks.clear();
+  std::vector<Generation*>::iterator it = std::find( retained.begin(), retained.end(), generation );
+  if( it != retained.end() ) {
+    *it = retained.back();
+    retained.pop_back();
+  }
+  spare.push_back(generation);
+}
+
+//////////////////////////////////////////////////////////////
+/// Generations are reused as their chunks: no heap allocation
+/// per event once enough of them have been released
+//////////////////////////////////////////////////////////////
+void AgataHitArena::NewGeneration()
+{
+  Generation* generation = NULL;
+  {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    if( !spare.empty() ) {
+      generation = spare.back();
+      spare.pop_back();
+    }
+    if( current ) retained.push_back(current);
+  }
+  if( !generation ) {
+    generation = new Generation;
+    nHeapEvent++;
+    nHeapTotal++;
+  }
+  generation->owner = this;
+  generation->live  = 1;
+  current = generation;
+  used    = 0;
+}
+
+//////////////////////////////////////////////////////////////
+/// To be called at the beginning of each event. The objects of
+/// the previous event stay valid until they are deleted; after
+/// the first few events the chunks are all reused and no heap
+/// allocation is needed any more.
+//////////////////////////////////////////////////////////////
+void AgataHitArena::NewEvent()
+{
+  if( (size_t)nBytesEvent > peakBytes ) peakBytes = nBytesEvent;
+
+  nAllocEvent  = 0;
+  nBytesEvent  = 0;
+  nHeapEvent   = 0;
+  nEvents++;
+
+  Generation* previous = current;
+  NewGeneration();
+  Release(previous);
+}
+
+void AgataHitArena::PrintStatistics()
+{
+  size_t nRetained;
+  {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    nRetained = retained.size();
+  }
+  G4AutoLock lock(&arenaPrintMutex);
+  G4cout << " ---> Hit arena (thread " << G4Threading::G4GetThreadId() << "): "
+         << nAllocTotal << " allocations in " << nEvents << " events, "
+         << nHeapTotal << " heap allocations, peak " << peakBytes/1024 << " kB per event, "
+         << nRetained << " kept events still using it." << G4endl;
+}
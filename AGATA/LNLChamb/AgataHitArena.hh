@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////
+/// Event-scoped arena for hits and hit collections of the
+/// ancillary detectors. Memory is taken from large chunks with a
+/// bump pointer; there is one arena per thread, so allocating
+/// needs no locking.
+///
+/// The objects of one event form a generation: NewEvent() closes
+/// the current one, and its chunks are reused as soon as all its
+/// objects have been deleted, i.e. when the G4Event owning the
+/// hit collections is deleted. Events kept by the run manager
+/// (/vis/scene/endOfEventAction accumulate, KeepTheCurrentEvent,
+/// SetNumberOfEventsToBeKept) keep their memory until then, also
+/// when they are deleted by the master thread.
+///
+/// A hit class opts in by inheriting from AgataArenaObject, as
+/// AgataAncillaryHit and its collection do (AgataAncillaryHit.hh).
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataHitArena_h
+#define AgataHitArena_h 1
+
+#include "globals.hh"
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+
+class AgataHitArena
+{
+  public:
+    static AgataHitArena* GetInstance();
+    //> the instance of the calling thread only
+    static void DeleteInstance();
+
+  private:
+    AgataHitArena();
+
+  public:
+    ~AgataHitArena();
+
+  private:
+    static G4ThreadLocal AgataHitArena* instance;
+
+  private:
+    struct Chunk
+    {
+      char*  memory;
+      size_t size;
+    };
+
+    //> the chunks of one event; live counts its objects, plus one
+    //> while it is the current generation
+    struct Generation
+    {
+      std::atomic<AgataHitArena*> owner;   //> NULL once the arena is gone
+      std::vector<Chunk>          chunks;
+      std::atomic<long>           live;
+    };
+
+  private:
+    //> generations can be released by another thread, also while
+    //> their arena is deleted: the members below and the owners of
+    //> the generations are only changed under one (static) mutex
+    static std::mutex        arenaMutex;
+
+  private:
+    Generation*              current;
+    size_t                   used;         //> bytes used in the last chunk of current
+    size_t                   chunkSize;
+    std::vector<Chunk>       freeChunks;   //> released by the earlier events
+    std::vector<Generation*> spare;        //> released generations, reused by NewEvent
+    std::vector<Generation*> retained;     //> closed generations still in use
+
+  private:
+    //> counters (per thread)
+    G4long             nAllocEvent;   //> allocations served in this event
+    G4long             nBytesEvent;
+    G4long             nHeapEvent;    //> chunks and generations taken from the heap in this event
+    G4long             nAllocTotal;
+    G4long             nHeapTotal;
+    G4long             nEvents;
+    size_t             peakBytes;
+
+  public:
+    //> align must be a power of two (any value, also above max_align_t)
+    void*  Allocate( size_t size, size_t align = alignof(std::max_align_t) );
+    //> returns an object to the generation it was allocated in (any thread)
+    static void Deallocate( void* ptr );
+    //> closes the generation of the previous event
+    void   NewEvent();
+
+  private:
+    void   NewChunk( size_t minSize );
+    void   NewGeneration();
+    static void Release( Generation* generation );
+    void   Recycle( Generation* generation );
+
+  public:
+    void   PrintStatistics();
+
+  public:
+    inline G4long GetAllocationsThisEvent() { return nAllocEvent; };
+    inline G4long GetHeapAllocationsThisEvent() { return nHeapEvent; };
+    inline G4long GetTotalAllocations()     { return nAllocTotal; };
+    inline G4long GetTotalHeapAllocations() { return nHeapTotal;  };
+    inline size_t GetPeakBytes()            { return peakBytes;   };
+    inline void   SetChunkSize( size_t size ) { chunkSize = size; };
+};
+
+//////////////////////////////////////////////////////////////////
+/// Mix-in routing new/delete of a class to the arena of the
+/// calling thread.
+/////////////////////////////////////////////////////////////////
+template <class T>
+class AgataArenaObject
+{
+  public:
+    inline void* operator new( size_t size )
+    { return AgataHitArena::GetInstance()->Allocate( size, alignof(T) ); };
+    inline void  operator delete( void* ptr )
+    { AgataHitArena::Deallocate(ptr); };
+};
+
+//////////////////////////////////////////////////////////////////
+/// STL allocator on the arena, e.g. for the hit vectors of a
+/// collection: std::vector<AgataAncillaryHit*, AgataArenaAllocator<AgataAncillaryHit*> >
+/////////////////////////////////////////////////////////////////
+template <class T>
+class AgataArenaAllocator
+{
+  public:
+    typedef T value_type;
+
+    AgataArenaAllocator() {};
+    template <class U> AgataArenaAllocator( const AgataArenaAllocator<U>& ) {};
+
+    inline T*   allocate  ( size_t n )
+    { return static_cast<T*>( AgataHitArena::GetInstance()->Allocate( n*sizeof(T), alignof(T) ) ); };
+    inline void deallocate( T* ptr, size_t ) { AgataHitArena::Deallocate(ptr); };
+};
+
+template <class T, class U>
+inline bool operator==( const AgataArenaAllocator<T>&, const AgataArenaAllocator<U>& ) { return true; }
+template <class T, class U>
+inline bool operator!=( const AgataArenaAllocator<T>&, const AgataArenaAllocator<U>& ) { return false; }
+
+#endif
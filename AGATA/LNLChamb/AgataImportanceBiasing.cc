@@ -0,0 +1,347 @@
+//////////////////////////////////////////////////////////////////
+/// Geometry importance sampling (see AgataImportanceBiasing.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataImportanceBiasing.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4TransportationManager.hh"
+#include "G4Navigator.hh"
+#include "G4GDMLParser.hh"
+#include "G4IStore.hh"
+#include "G4GeometrySampler.hh"
+#include "G4ImportanceBiasing.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4Track.hh"
+#include "G4EventManager.hh"
+#include "G4Event.hh"
+#include "G4RunManager.hh"
+#include "G4VModularPhysicsList.hh"
+#include "G4ApplicationState.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Threading.hh"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <fnmatch.h>
+
+//////////////////////////////////////////////////////////////
+/// Stock physics constructor: the store has to be complete before
+/// the workers start, hence it is filled here by the master, and
+/// the sampler needs the world, which exists only from now on
+//////////////////////////////////////////////////////////////
+namespace {
+  class AgataImportancePhysics : public G4ImportanceBiasing
+  {
+    public:
+      AgataImportancePhysics( G4GeometrySampler* sampler ) : G4ImportanceBiasing( sampler ), theSampler(sampler) {};
+
+    private:
+      G4GeometrySampler* theSampler;
+
+    public:
+      void ConstructProcess()
+      {
+        if( G4Threading::IsMasterThread() ) {
+          AgataImportanceBiasing::GetInstance()->FillStore();
+          theSampler->SetWorld( G4TransportationManager::GetTransportationManager()
+                                ->GetNavigatorForTracking()->GetWorldVolume() );
+        }
+        G4ImportanceBiasing::ConstructProcess();
+        //> the MT master does not track
+        if( !G4Threading::IsMultithreadedApplication() || !G4Threading::IsMasterThread() )
+          AgataImportanceBiasing::GetInstance()->Attach();
+      };
+  };
+}
+
+////////////////////////////////////////////////////////////
+/// Weight record
+////////////////////////////////////////////////////////////
+AgataWeightSteppingAction::AgataWeightSteppingAction( G4UserSteppingAction* chained )
+{
+  userAction = chained;
+  eventID    = -1;
+}
+
+//> deleted by the run manager, in place of the user action
+AgataWeightSteppingAction::~AgataWeightSteppingAction()
+{
+  delete userAction;
+  AgataImportanceBiasing::Detach( this );
+}
+
+//////////////////////////////////////////////////////////////
+/// The weight of a step is the one of its pre-step point (the
+/// splitting happens at the post-step point). Tracks which never
+/// had a weight different from 1 are not recorded at all; the
+/// others get their steps of weight 1 (up to the pre-step time of
+/// the first one recorded) as a first entry. The history is that
+/// of the current event: it is cleared when the first track of a
+/// new event starts.
+//////////////////////////////////////////////////////////////
+void AgataWeightSteppingAction::UserSteppingAction( const G4Step* aStep )
+{
+  const G4Track* track = aStep->GetTrack();
+  if( track->GetCurrentStepNumber() == 1 ) {
+    const G4Event* event = G4EventManager::GetEventManager()->GetConstCurrentEvent();
+    G4int currentID = event ? event->GetEventID() : -1;
+    if( currentID != eventID ) {
+      history.clear();
+      eventID = currentID;
+    }
+  }
+
+  G4double weight = aStep->GetPreStepPoint()->GetWeight();
+  G4int    trackID = track->GetTrackID();
+  G4double time   = aStep->GetPostStepPoint()->GetGlobalTime();
+  if( weight != 1. || history.count(trackID) ) {
+    std::vector< std::pair<G4double,G4double> >& steps = history[trackID];
+    if( steps.empty() && track->GetCurrentStepNumber() > 1 )
+      steps.push_back( std::make_pair( aStep->GetPreStepPoint()->GetGlobalTime(), 1. ) );
+    if( !steps.empty() && steps.back().second == weight )
+      steps.back().first = time;
+    else
+      steps.push_back( std::make_pair( time, weight ) );
+  }
+  if( userAction ) userAction->UserSteppingAction( aStep );
+}
+
+G4double AgataWeightSteppingAction::GetWeight( G4int trackID, G4double time ) const
+{
+  std::unordered_map< G4int, std::vector< std::pair<G4double,G4double> > >::const_iterator it = history.find( trackID );
+  if( it == history.end() ) return 1.;
+  const std::vector< std::pair<G4double,G4double> >& steps = it->second;
+  //> the first group of steps ending at or after time
+  for( size_t ii=0; ii<steps.size(); ii++ ) {
+    if( steps[ii].first >= time ) return steps[ii].second;
+  }
+  return steps.back().second;
+}
+
+AgataImportanceBiasing* AgataImportanceBiasing::instance = NULL;
+G4ThreadLocal AgataWeightSteppingAction* AgataImportanceBiasing::threadAction = NULL;
+
+AgataImportanceBiasing* AgataImportanceBiasing::GetInstance()
+{
+  if( !instance )
+    instance = new AgataImportanceBiasing();
+  return instance;
+}
+
+void AgataImportanceBiasing::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataImportanceBiasing::AgataImportanceBiasing()
+{
+  particleName = "gamma";
+  theSampler   = NULL;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/biasing/", "Geometry importance sampling" );
+  myMessenger->DeclareMethod( "load", &AgataImportanceBiasing::LoadConfig,
+                              "Reads the importances (lines of: pattern importance)" )
+    .SetParameterName( "fileName", false );
+  myMessenger->DeclareMethod( "importance", &AgataImportanceBiasing::AddRule,
+                              "Sets the importance of the volumes matching a pattern" )
+    .SetParameterName( "rule", false );
+  myMessenger->DeclareProperty( "particle", particleName, "Particle to be biased" )
+    .SetParameterName( "name", false );
+  myMessenger->DeclareMethod( "enable", &AgataImportanceBiasing::Enable,
+                              "Adds the importance processes to the physics list (before /run/initialize)" )
+    .SetStates( G4State_PreInit )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "clear", &AgataImportanceBiasing::Clear,
+                              "Forgets the importances (the GDML ones too)" );
+}
+
+AgataImportanceBiasing::~AgataImportanceBiasing()
+{
+  delete myMessenger;
+  delete theSampler;
+}
+
+void AgataImportanceBiasing::LoadConfig( G4String fileName )
+{
+  std::ifstream inFile( fileName.c_str() );
+  if( !inFile.is_open() ) {
+    G4cout << " Could not open importance file " << fileName << G4endl;
+    return;
+  }
+  std::string line;
+  while( std::getline( inFile, line ) ) {
+    size_t hash = line.find('#');
+    if( hash != std::string::npos ) line.erase(hash);
+    if( line.find_first_not_of(" \t\r") == std::string::npos ) continue;
+    AddRule(line);
+  }
+}
+
+void AgataImportanceBiasing::AddRule( G4String command )
+{
+  std::istringstream words(command);
+  Rule rule;
+  rule.importance = -1.;
+  words >> rule.pattern >> rule.importance;
+  if( rule.pattern.empty() || rule.importance < 0. ) {
+    G4cout << " Invalid importance \"" << command << "\" (pattern importance>=0)" << G4endl;
+    return;
+  }
+  rules.push_back(rule);
+  G4cout << " ---> Importance " << rule.importance << " for " << rule.pattern << G4endl;
+}
+
+void AgataImportanceBiasing::Clear()
+{
+  rules.clear();
+  fromGdml.clear();
+}
+
+void AgataImportanceBiasing::ReadAuxiliary( G4GDMLParser& parser, size_t firstVolume )
+{
+  G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+  for( size_t ii=firstVolume; ii<theStore->size(); ii++ ) {
+    G4GDMLAuxListType auxList = parser.GetVolumeAuxiliaryInformation( (*theStore)[ii] );
+    for( size_t jj=0; jj<auxList.size(); jj++ ) {
+      if( auxList[jj].type != "Importance" ) continue;
+      G4double importance = atof( auxList[jj].value.c_str() );
+      if( importance < 0. ) {
+        G4cout << " Negative importance ignored for " << (*theStore)[ii]->GetName() << G4endl;
+        continue;
+      }
+      fromGdml[ (*theStore)[ii] ] = importance;
+    }
+  }
+}
+
+void AgataImportanceBiasing::AddReplacement( const G4LogicalVolume* original, const G4LogicalVolume* replacement )
+{
+  replaced.insert( std::make_pair( replacement, original ) );
+}
+
+//////////////////////////////////////////////////////////////
+/// The first matching rule wins, then the GDML value
+//////////////////////////////////////////////////////////////
+G4double AgataImportanceBiasing::GetOwnImportance( const G4LogicalVolume* volume ) const
+{
+  for( size_t ii=0; ii<rules.size(); ii++ ) {
+    if( fnmatch( rules[ii].pattern.c_str(), volume->GetName().c_str(), 0 ) == 0 )
+      return rules[ii].importance;
+  }
+  std::map<const G4LogicalVolume*, G4double>::const_iterator it = fromGdml.find( volume );
+  if( it != fromGdml.end() )
+    return it->second;
+  return -1.;
+}
+
+//////////////////////////////////////////////////////////////
+/// A replacement without a value of its own takes the largest
+/// importance of the volumes it replaced
+//////////////////////////////////////////////////////////////
+G4double AgataImportanceBiasing::GetImportance( const G4LogicalVolume* volume, G4double inherited ) const
+{
+  G4double importance = GetOwnImportance( volume );
+  if( importance >= 0. ) return importance;
+
+  typedef std::multimap<const G4LogicalVolume*, const G4LogicalVolume*>::const_iterator ReplacedIt;
+  std::pair<ReplacedIt, ReplacedIt> range = replaced.equal_range( volume );
+  for( ReplacedIt it=range.first; it!=range.second; ++it )
+    importance = std::max( importance, GetImportance( it->second, -1. ) );
+  return ( importance >= 0. ) ? importance : inherited;
+}
+
+//////////////////////////////////////////////////////////////
+/// G4ImportanceProcess needs every cell of the world in the
+/// store. A physical volume is a single cell wherever its mother
+/// is placed: the first placement found sets its importance
+//////////////////////////////////////////////////////////////
+void AgataImportanceBiasing::FillStore()
+{
+  G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()
+    ->GetNavigatorForTracking()->GetWorldVolume();
+  if( !world ) {
+    G4cout << " Geometry has not been constructed yet, cannot fill the importance store!" << G4endl;
+    return;
+  }
+
+  G4IStore* theStore = G4IStore::GetInstance();
+  theStore->Clear();
+  std::set<const G4VPhysicalVolume*> done;
+  G4int nBiased = 0;
+  G4double worldImportance = GetImportance( world->GetLogicalVolume(), 1. );
+  theStore->AddImportanceGeometryCell( worldImportance, *world );
+  done.insert( world );
+  FillDaughters( world->GetLogicalVolume(), worldImportance, done, nBiased );
+
+  G4cout << " ---> Importance store: " << done.size() << " volumes, "
+         << nBiased << " with importance different from 1, biasing " << particleName << G4endl;
+}
+
+void AgataImportanceBiasing::FillDaughters( G4LogicalVolume* mother, G4double motherImportance,
+                                            std::set<const G4VPhysicalVolume*>& done, G4int& nBiased )
+{
+  G4IStore* theStore = G4IStore::GetInstance();
+  for( size_t ii=0; ii<mother->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = mother->GetDaughter(ii);
+    if( !done.insert( daughter ).second ) continue;
+
+    G4double importance = GetImportance( daughter->GetLogicalVolume(), motherImportance );
+    if( importance != 1. ) nBiased++;
+    for( G4int rep=0; rep<daughter->GetMultiplicity(); rep++ )
+      theStore->AddImportanceGeometryCell( importance, *daughter, rep );
+    FillDaughters( daughter->GetLogicalVolume(), importance, done, nBiased );
+  }
+}
+
+G4VPhysicsConstructor* AgataImportanceBiasing::CreatePhysics()
+{
+  if( !theSampler )
+    theSampler = new G4GeometrySampler( NULL, particleName );
+  theSampler->SetParallel( false );
+  return new AgataImportancePhysics( theSampler );
+}
+
+//////////////////////////////////////////////////////////////
+/// Through the run manager: the physics list it was given is the
+/// one built by the application
+//////////////////////////////////////////////////////////////
+void AgataImportanceBiasing::Enable()
+{
+  if( theSampler ) return;
+  G4VModularPhysicsList* physicsList = dynamic_cast<G4VModularPhysicsList*>(
+    const_cast<G4VUserPhysicsList*>( G4RunManager::GetRunManager()->GetUserPhysicsList() ) );
+  if( !physicsList ) {
+    G4Exception( "AgataImportanceBiasing::Enable()", "AgataBiasing001", JustWarning,
+                 "The physics list is not modular: it must register AgataImportanceBiasing::CreatePhysics()" );
+    return;
+  }
+  physicsList->RegisterPhysics( CreatePhysics() );
+  G4cout << " ---> Importance sampling of " << particleName << " added to the physics list" << G4endl;
+}
+
+//> the run manager of the thread owns the weight record from now on
+void AgataImportanceBiasing::Attach()
+{
+  if( !theSampler || threadAction ) return;
+  G4RunManager* runManager = G4RunManager::GetRunManager();
+  threadAction = new AgataWeightSteppingAction( const_cast<G4UserSteppingAction*>( runManager->GetUserSteppingAction() ) );
+  runManager->SetUserAction( threadAction );
+}
+
+void AgataImportanceBiasing::Detach( const AgataWeightSteppingAction* action )
+{
+  if( threadAction == action ) threadAction = NULL;
+}
+
+G4double AgataImportanceBiasing::GetWeight( G4int trackID, G4double time ) const
+{
+  if( !threadAction ) return 1.;
+  return threadAction->GetWeight( trackID, time );
+}
@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////
+/// Geometry importance sampling (splitting and Russian roulette at
+/// volume boundaries, G4ImportanceProcess) for the transport of
+/// the photons through the shielding of the chambers.
+/// Importances are given per logical volume:
+///  - in the GDML files, as <auxiliary auxtype="Importance" auxvalue="4"/>
+///    inside the <volume>;
+///  - in a side configuration, one "pattern importance" per line
+///    (shell wildcards on the volume names, # for comments), e.g.
+///      heavy_*          4
+///      bd_*_chamb_*     2
+///    these take precedence over the GDML values.
+/// Volumes without a value inherit the importance of their mother
+/// (the world has 1); a volume which replaced others (see
+/// AgataMeshMerger) takes the largest of their importances.
+/// The processes are those of the stock G4ImportanceBiasing and
+/// G4GeometrySampler: the constructor returned by CreatePhysics()
+/// only fills the store, on the master at /run/initialize (after
+/// the geometry), before the sampler is configured. The particle
+/// is fixed when CreatePhysics() is called. /Agata/biasing/enable
+/// registers it in the physics list given to the run manager
+/// (before /run/initialize); a physics list which is not a
+/// G4VModularPhysicsList must register CreatePhysics() itself.
+///
+/// Hits keep the weight of their track (AgataLMHit::weight, and the
+/// -200 lines of the ASCII file): when its processes are built,
+/// each tracking thread chains a stepping action recording, for
+/// the current event, the weights of the tracks which had one
+/// different from 1, and GetWeight() gives the weight a track had
+/// at a given (post-step) time.
+///
+/// Commands: /Agata/biasing/load <file>
+///           /Agata/biasing/importance <pattern> <value>
+///           /Agata/biasing/particle gamma
+///           /Agata/biasing/enable
+///           /Agata/biasing/clear
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataImportanceBiasing_h
+#define AgataImportanceBiasing_h 1
+
+#include "globals.hh"
+#include "G4UserSteppingAction.hh"
+
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4VPhysicsConstructor;
+class G4GDMLParser;
+class G4GenericMessenger;
+class G4GeometrySampler;
+
+//////////////////////////////////////////////////////////////
+/// Per-thread record of the track weights of the current event
+//////////////////////////////////////////////////////////////
+class AgataWeightSteppingAction : public G4UserSteppingAction
+{
+  public:
+    AgataWeightSteppingAction( G4UserSteppingAction* chained );
+    ~AgataWeightSteppingAction();
+
+  private:
+    G4UserSteppingAction* userAction;   //> the action we replaced (owned)
+    G4int                 eventID;      //> of the history
+    //> per track: (time of the last step, weight during those steps)
+    std::unordered_map< G4int, std::vector< std::pair<G4double,G4double> > > history;
+
+  public:
+    void     UserSteppingAction( const G4Step* aStep );
+
+  public:
+    G4double GetWeight( G4int trackID, G4double time ) const;
+};
+
+class AgataImportanceBiasing
+{
+  public:
+    static AgataImportanceBiasing* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataImportanceBiasing();
+
+  public:
+    ~AgataImportanceBiasing();
+
+  private:
+    static AgataImportanceBiasing* instance;
+    static G4ThreadLocal AgataWeightSteppingAction* threadAction;
+
+  private:
+    struct Rule
+    {
+      G4String pattern;
+      G4double importance;
+    };
+
+  private:
+    std::vector<Rule>                          rules;
+    std::map<const G4LogicalVolume*, G4double> fromGdml;
+    std::multimap<const G4LogicalVolume*, const G4LogicalVolume*> replaced;
+    G4GeometrySampler*                         theSampler;   //> NULL until CreatePhysics()
+    G4String                                   particleName;
+    G4GenericMessenger*                        myMessenger;
+
+  public:
+    void     LoadConfig ( G4String fileName );
+    void     AddRule    ( G4String command );
+    void     Clear      ();
+
+  public:
+    //> "Importance" auxiliaries of the volumes in the logical volume
+    //> store from index firstVolume on (those created by parser.Read)
+    void     ReadAuxiliary( G4GDMLParser& parser, size_t firstVolume );
+    //> replacement takes the place of original in the geometry
+    void     AddReplacement( const G4LogicalVolume* original, const G4LogicalVolume* replacement );
+
+  public:
+    //> importance of a volume, inherited when none is given
+    G4double GetImportance( const G4LogicalVolume* volume, G4double inherited ) const;
+    //> one cell per physical volume (and replica) of the world
+    void     FillStore    ();
+    //> to be registered in the physics list (gamma by default)
+    G4VPhysicsConstructor* CreatePhysics();
+    //> /Agata/biasing/enable: CreatePhysics() in the user physics list
+    void     Enable();
+
+  public:
+    //> when the processes of a tracking thread are built: chains
+    //> the weight record of that thread
+    void     Attach();
+    //> the run manager deleted the weight record of the calling thread
+    static void Detach( const AgataWeightSteppingAction* action );
+    //> weight of a track at the end of the step taken at time
+    G4double GetWeight( G4int trackID, G4double time ) const;
+
+  private:
+    //> importance given to the volume itself, -1 if none
+    G4double GetOwnImportance( const G4LogicalVolume* volume ) const;
+
+  private:
+    void     FillDaughters( G4LogicalVolume* mother, G4double motherImportance,
+                            std::set<const G4VPhysicalVolume*>& done, G4int& nBiased );
+
+  public:
+    inline G4bool   HasImportances()  const { return !rules.empty() || !fromGdml.empty(); };
+    inline G4String GetParticleName() const { return particleName; };
+    inline G4bool   IsBiasing()       const { return theSampler != NULL; };
+};
+
+#endif
@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////
+/// Binary list-mode (BLM) format shared by AgataListModeWriter
+/// and AgataListModeReader.
+///
+/// File layout (little endian, as written by the host):
+///   AgataLMFileHeader
+///   numAnc times: AgataLMAncHeader, name bytes, numSd offsets (G4int)
+///   blocks: AgataLMBlockHeader followed by compSize bytes
+///
+/// A block, once inflated, is a sequence of events:
+///   AgataLMEventHeader followed by nHits AgataLMHit
+///
+/// An inflated block never exceeds AgataLM::maxBlockSize: the
+/// reader rejects larger sizes as corrupted headers.
+/// The format only depends on zlib and <stdint.h>, so that the
+/// reader can be built without Geant4.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataListModeFormat_h
+#define AgataListModeFormat_h 1
+
+#include <stdint.h>
+
+namespace AgataLM {
+  const uint32_t magic   = 0x4d4c4741; // "AGLM"
+  const uint32_t version = 1;
+  //> default size of an uncompressed event block (bytes)
+  const uint32_t defaultBlockSize = 1 << 20;
+  //> largest uncompressed event block (bytes)
+  const uint32_t maxBlockSize     = 1 << 28;
+}
+
+struct AgataLMFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  double   unitLength;  //> length unit used for the hit positions
+  uint32_t numAnc;      //> number of ancillary descriptors following
+  uint32_t blockSize;   //> nominal uncompressed block size
+};
+
+struct AgataLMAncHeader
+{
+  uint32_t nameLength;  //> number of bytes of the (unterminated) name
+  int32_t  numSd;       //> number of sensitive detector offsets
+};
+
+struct AgataLMBlockHeader
+{
+  uint32_t rawSize;     //> size of the inflated block
+  uint32_t compSize;    //> size on disk; 0 means stored uncompressed
+  uint32_t nEvents;
+};
+
+struct AgataLMEventHeader
+{
+  int32_t  eventId;
+  uint32_t nHits;
+};
+
+struct AgataLMHit
+{
+  int32_t  detCode;     //> offset + detector number, as in the ASCII LMD
+  int32_t  segment;
+  float    energy;
+  float    x, y, z;
+  float    time;
+  float    weight;      //> statistical weight of the track (1 unless biased)
+};
+
+#endif
@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////
+/// Reader for the binary list-mode format (AgataListModeFormat.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataListModeReader.hh"
+
+#include "zlib.h"
+#include <cstring>
+#include <iostream>
+
+AgataListModeReader::AgataListModeReader()
+{
+  unitLength = 1.;
+  version    = 0;
+  blockPos   = 0;
+}
+
+AgataListModeReader::~AgataListModeReader()
+{
+  Close();
+}
+
+bool AgataListModeReader::Open( const std::string& fileName )
+{
+  Close();
+  inFile.open( fileName.c_str(), std::ios::in | std::ios::binary );
+  if( !inFile.is_open() ) {
+    std::cerr << " Could not open binary list-mode file " << fileName << std::endl;
+    return false;
+  }
+
+  AgataLMFileHeader fh;
+  if( !inFile.read( (char*)&fh, sizeof(fh) ) || fh.magic != AgataLM::magic ) {
+    std::cerr << " " << fileName << " is not a binary list-mode file" << std::endl;
+    Close();
+    return false;
+  }
+  if( fh.version != AgataLM::version ) {
+    std::cerr << " " << fileName << " has format version " << fh.version
+              << ", this reader only knows version " << AgataLM::version << std::endl;
+    Close();
+    return false;
+  }
+  version    = fh.version;
+  unitLength = fh.unitLength;
+
+  ancillaries.resize(fh.numAnc);
+  for( uint32_t ii=0; ii<fh.numAnc; ii++ ) {
+    AgataLMAncHeader ah;
+    if( !inFile.read( (char*)&ah, sizeof(ah) ) || ah.numSd < 0 ) {
+      std::cerr << " Corrupted header in " << fileName << std::endl;
+      Close();
+      return false;
+    }
+    ancillaries[ii].name.resize(ah.nameLength);
+    if( ah.nameLength )
+      inFile.read( &ancillaries[ii].name[0], ah.nameLength );
+    ancillaries[ii].offsets.resize(ah.numSd);
+    if( ah.numSd > 0 )
+      inFile.read( (char*)&ancillaries[ii].offsets[0], ah.numSd*sizeof(int32_t) );
+  }
+  if( !inFile ) {
+    std::cerr << " Truncated header in " << fileName << std::endl;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void AgataListModeReader::Close()
+{
+  if( inFile.is_open() ) inFile.close();
+  ancillaries.clear();
+  block.clear();
+  blockPos = 0;
+}
+
+bool AgataListModeReader::ReadBlock()
+{
+  AgataLMBlockHeader bh;
+  if( !inFile.read( (char*)&bh, sizeof(bh) ) ) return false;
+  //> sizes out of the format limits: do not allocate them
+  if( bh.rawSize > AgataLM::maxBlockSize || bh.compSize > compressBound(AgataLM::maxBlockSize) ) {
+    std::cerr << " Corrupted block header in binary list-mode file" << std::endl;
+    return false;
+  }
+
+  block.resize(bh.rawSize);
+  blockPos = 0;
+  //> an empty block has no payload
+  if( bh.rawSize == 0 ) return bh.compSize == 0;
+  if( bh.compSize == 0 ) {
+    return (bool)inFile.read( &block[0], bh.rawSize );
+  }
+
+  compressed.resize(bh.compSize);
+  if( !inFile.read( &compressed[0], bh.compSize ) ) return false;
+  uLongf rawSize = bh.rawSize;
+  if( uncompress( (Bytef*)&block[0], &rawSize, (const Bytef*)&compressed[0], bh.compSize ) != Z_OK
+      || rawSize != bh.rawSize ) {
+    std::cerr << " Corrupted block in binary list-mode file" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AgataListModeReader::NextEvent( int32_t& eventId, std::vector<AgataLMHit>& hits )
+{
+  while( blockPos >= block.size() ) {
+    if( !ReadBlock() ) return false;
+  }
+
+  AgataLMEventHeader eh;
+  if( blockPos + sizeof(eh) > block.size() ) return false;
+  memcpy( &eh, &block[blockPos], sizeof(eh) );
+  blockPos += sizeof(eh);
+
+  //> nHits is checked against the block, not multiplied blindly
+  if( eh.nHits > ( block.size() - blockPos ) / sizeof(AgataLMHit) ) return false;
+  size_t nBytes = eh.nHits*sizeof(AgataLMHit);
+  hits.resize(eh.nHits);
+  if( eh.nHits )
+    memcpy( &hits[0], &block[blockPos], nBytes );
+  blockPos += nBytes;
+
+  eventId = eh.eventId;
+  return true;
+}
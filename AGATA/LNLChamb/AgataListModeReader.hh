@@ -0,0 +1,58 @@
+//////////////////////////////////////////////////////////////////
+/// Reader for the binary list-mode files produced by
+/// AgataListModeWriter. Only depends on zlib and on the format
+/// definitions, so that it can be linked in offline analysis code.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataListModeReader_h
+#define AgataListModeReader_h 1
+
+#include "AgataListModeFormat.hh"
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+class AgataListModeReader
+{
+  public:
+    AgataListModeReader();
+    ~AgataListModeReader();
+
+  public:
+    struct Ancillary
+    {
+      std::string          name;
+      std::vector<int32_t> offsets;
+    };
+
+  private:
+    std::ifstream          inFile;
+    std::vector<Ancillary> ancillaries;
+    double                 unitLength;
+    uint32_t               version;
+
+  private:
+    std::vector<char>      block;       //> current inflated block
+    std::vector<char>      compressed;
+    size_t                 blockPos;
+
+  public:
+    //> opens the file and decodes the header
+    bool Open( const std::string& fileName );
+    void Close();
+
+  public:
+    //> returns false at the end of the file (or on a corrupted block)
+    bool NextEvent( int32_t& eventId, std::vector<AgataLMHit>& hits );
+
+  private:
+    bool ReadBlock();
+
+  public:
+    inline const std::vector<Ancillary>& GetAncillaries() const { return ancillaries; };
+    inline double   GetUnitLength() const { return unitLength; };
+    inline uint32_t GetVersion()    const { return version;    };
+};
+
+#endif
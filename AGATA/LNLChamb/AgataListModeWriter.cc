@@ -0,0 +1,297 @@
+//////////////////////////////////////////////////////////////////
+/// Asynchronous binary list-mode writer (see AgataListModeFormat.hh
+/// for the layout of the file).
+/// The tracking threads never touch the output stream: they only
+/// append events to a thread-local block. Full blocks are queued and
+/// deflated/written by a single background thread.
+/////////////////////////////////////////////////////////////////
+
+#include "AgataListModeWriter.hh"
+
+#include "G4GenericMessenger.hh"
+
+#include "zlib.h"
+#include <cstring>
+
+AgataListModeWriter* AgataListModeWriter::instance = NULL;
+G4ThreadLocal AgataListModeWriter::ThreadBuffers* AgataListModeWriter::threadBuffers = NULL;
+
+AgataListModeWriter* AgataListModeWriter::GetInstance()
+{
+  static std::mutex instanceMutex;
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  if( !instance )
+    instance = new AgataListModeWriter();
+  return instance;
+}
+
+void AgataListModeWriter::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataListModeWriter::AgataListModeWriter()
+{
+  running          = false;
+  headerCommitted  = false;
+  headerWritten    = false;
+  unitLength       = 1.;
+  blockSize        = AgataLM::defaultBlockSize;
+  compressionLevel = 1;  //> fastest: we want to keep up with the event loop
+  rawBytes         = 0;
+  diskBytes        = 0;
+  nBlocks          = 0;
+  enabled          = false;
+  fileName         = "GammaEvents.blm";
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/file/binary/", "Binary list-mode output" );
+  myMessenger->DeclareProperty( "enable", enabled, "Writes the ancillary hits to a binary list-mode file" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" );
+  myMessenger->DeclareProperty( "name", fileName, "Name of the binary list-mode file" );
+  myMessenger->DeclareProperty( "compression", compressionLevel, "zlib level of the event blocks (0-9)" )
+    .SetParameterName( "level", false ).SetRange( "level>=0 && level<=9" );
+}
+
+AgataListModeWriter::~AgataListModeWriter()
+{
+  Close();
+  delete myMessenger;
+  for( size_t ii=0; ii<allBuffers.size(); ii++ )
+    delete allBuffers[ii];
+  allBuffers.clear();
+  //> the other threads are gone by now
+  threadBuffers = NULL;
+}
+
+G4bool AgataListModeWriter::Open( G4String name )
+{
+  if( running ) Close();
+
+  outFile.open( name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+  if( !outFile.is_open() ) {
+    G4cout << " Could not open binary list-mode file " << name << G4endl;
+    return false;
+  }
+  G4cout << " ----> Binary list-mode data will be written to " << name << G4endl;
+
+  headerWritten = false;
+  rawBytes = diskBytes = nBlocks = 0;
+  running = true;
+  //> a header committed before Open()
+  if( headerCommitted ) {
+    std::lock_guard<std::mutex> lock(theMutex);
+    WriteFileHeader();
+  }
+  writerThread = std::thread( &AgataListModeWriter::WriterLoop, this );
+  return true;
+}
+
+void AgataListModeWriter::Close()
+{
+  if( !running ) return;
+
+  //> an empty run still gets a valid header
+  CommitHeader( unitLength );
+
+  //> at this point the tracking threads are done: queue whatever is left
+  {
+    std::unique_lock<std::mutex> lock(theMutex);
+    for( size_t ii=0; ii<allBuffers.size(); ii++ ) {
+      ThreadBuffers* tb = allBuffers[ii];
+      G4int cur = tb->current;
+      doneCondition.wait( lock, [tb,cur]{ return !tb->inFlight[cur]; } );
+      if( tb->nEvents[cur] > 0 ) {
+        tb->inFlight[cur] = true;
+        Pending pp = { tb, cur };
+        queue.push_back(pp);
+      }
+    }
+    running = false;
+  }
+  queueCondition.notify_one();
+  writerThread.join();
+  outFile.close();
+  descriptors.clear();
+  headerCommitted = false;
+
+  G4cout << " ----> Binary list-mode file closed: " << nBlocks << " blocks, "
+         << rawBytes << " bytes of event data written as " << diskBytes << " bytes." << G4endl;
+}
+
+////////////////////////////////////////////////////////////
+/// Header
+////////////////////////////////////////////////////////////
+void AgataListModeWriter::AddAncillary( G4String name, const std::vector<G4int>& offsets )
+{
+  Descriptor desc;
+  desc.name    = name;
+  desc.offsets = offsets;
+  descriptors.push_back(desc);
+}
+
+void AgataListModeWriter::CommitHeader( G4double unit )
+{
+  std::lock_guard<std::mutex> lock(theMutex);
+  if( headerWritten ) return;
+  unitLength      = unit;
+  headerCommitted = true;
+  if( running ) WriteFileHeader();
+}
+
+//> called with theMutex held
+void AgataListModeWriter::WriteFileHeader()
+{
+  AgataLMFileHeader fh;
+  fh.magic      = AgataLM::magic;
+  fh.version    = AgataLM::version;
+  fh.unitLength = unitLength;
+  fh.numAnc     = descriptors.size();
+  fh.blockSize  = blockSize;
+  outFile.write( (const char*)&fh, sizeof(fh) );
+
+  for( size_t ii=0; ii<descriptors.size(); ii++ ) {
+    AgataLMAncHeader ah;
+    ah.nameLength = descriptors[ii].name.size();
+    ah.numSd      = descriptors[ii].offsets.size();
+    outFile.write( (const char*)&ah, sizeof(ah) );
+    outFile.write( descriptors[ii].name.data(), ah.nameLength );
+    for( size_t jj=0; jj<descriptors[ii].offsets.size(); jj++ ) {
+      int32_t offs = descriptors[ii].offsets[jj];
+      outFile.write( (const char*)&offs, sizeof(offs) );
+    }
+  }
+  headerWritten = true;
+  queueCondition.notify_one();
+}
+
+////////////////////////////////////////////////////////////
+/// Event data (tracking threads)
+////////////////////////////////////////////////////////////
+AgataListModeWriter::ThreadBuffers* AgataListModeWriter::GetThreadBuffers()
+{
+  if( !threadBuffers ) {
+    threadBuffers = new ThreadBuffers;
+    for( G4int ii=0; ii<2; ii++ ) {
+      threadBuffers->block[ii].reserve( blockSize + blockSize/8 );
+      threadBuffers->nEvents [ii] = 0;
+      threadBuffers->inFlight[ii] = false;
+    }
+    threadBuffers->current = 0;
+    std::lock_guard<std::mutex> lock(theMutex);
+    allBuffers.push_back(threadBuffers);
+  }
+  return threadBuffers;
+}
+
+void AgataListModeWriter::WriteEvent( G4int eventId, const std::vector<AgataLMHit>& hits )
+{
+  if( !running ) return;
+
+  AgataLMEventHeader eh;
+  eh.eventId = eventId;
+  eh.nHits   = hits.size();
+  size_t eventSize = sizeof(eh) + hits.size()*sizeof(AgataLMHit);
+  if( eventSize > AgataLM::maxBlockSize ) {
+    G4Exception( "AgataListModeWriter::WriteEvent()", "AgataListMode001", JustWarning,
+                 "Event larger than the largest block of the format, not written" );
+    return;
+  }
+
+  //> blocks stay within the format limit, whatever the events
+  ThreadBuffers* tb = GetThreadBuffers();
+  if( tb->block[tb->current].size() + eventSize > AgataLM::maxBlockSize )
+    Submit(tb);
+  std::vector<char>& block = tb->block[tb->current];
+
+  size_t pos = block.size();
+  block.resize( pos + eventSize );
+  memcpy( &block[pos], &eh, sizeof(eh) );
+  if( !hits.empty() )
+    memcpy( &block[pos+sizeof(eh)], &hits[0], hits.size()*sizeof(AgataLMHit) );
+  tb->nEvents[tb->current]++;
+
+  if( block.size() >= blockSize )
+    Submit(tb);
+}
+
+void AgataListModeWriter::FlushThread()
+{
+  if( !running || !threadBuffers ) return;
+  if( threadBuffers->nEvents[threadBuffers->current] > 0 )
+    Submit(threadBuffers);
+}
+
+//////////////////////////////////////////////////////////////
+/// Queues the active block and switches to the other one. We
+/// only have to wait if the other block is still being written,
+/// i.e. if the disk cannot keep up at all.
+//////////////////////////////////////////////////////////////
+void AgataListModeWriter::Submit( ThreadBuffers* tb )
+{
+  {
+    std::unique_lock<std::mutex> lock(theMutex);
+    G4int cur = tb->current;
+    tb->inFlight[cur] = true;
+    Pending pp = { tb, cur };
+    queue.push_back(pp);
+    tb->current = 1 - cur;
+    G4int next = tb->current;
+    queueCondition.notify_one();
+    doneCondition.wait( lock, [tb,next]{ return !tb->inFlight[next]; } );
+  }
+}
+
+////////////////////////////////////////////////////////////
+/// Background thread
+////////////////////////////////////////////////////////////
+void AgataListModeWriter::WriterLoop()
+{
+  std::unique_lock<std::mutex> lock(theMutex);
+  while( true ) {
+    //> blocks cannot go to disk before the header
+    queueCondition.wait( lock, [this]{ return ( headerWritten && !queue.empty() ) || !running; } );
+    if( queue.empty() && !running ) break;
+
+    Pending pp = queue.front();
+    queue.pop_front();
+    lock.unlock();
+
+    WriteBlock( pp.buffers->block[pp.index], pp.buffers->nEvents[pp.index] );
+    pp.buffers->block  [pp.index].clear();
+    pp.buffers->nEvents[pp.index] = 0;
+
+    lock.lock();
+    pp.buffers->inFlight[pp.index] = false;
+    doneCondition.notify_all();
+  }
+}
+
+void AgataListModeWriter::WriteBlock( std::vector<char>& block, uint32_t nEvents )
+{
+  if( block.empty() ) return;
+
+  std::vector<Bytef> compressed( compressBound(block.size()) );
+  uLongf compSize = compressed.size();
+  G4int status = compress2( &compressed[0], &compSize, (const Bytef*)&block[0],
+                            block.size(), compressionLevel );
+
+  AgataLMBlockHeader bh;
+  bh.rawSize = block.size();
+  bh.nEvents = nEvents;
+  if( status == Z_OK && compSize < block.size() ) {
+    bh.compSize = compSize;
+    outFile.write( (const char*)&bh, sizeof(bh) );
+    outFile.write( (const char*)&compressed[0], compSize );
+  }
+  else {
+    //> incompressible (or zlib failure): store as it is
+    bh.compSize = 0;
+    outFile.write( (const char*)&bh, sizeof(bh) );
+    outFile.write( &block[0], block.size() );
+  }
+  rawBytes  += bh.rawSize;
+  diskBytes += sizeof(bh) + ( bh.compSize ? bh.compSize : bh.rawSize );
+  nBlocks++;
+}
@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////
+/// Asynchronous binary list-mode writer.
+/// Each (worker) thread fills its own pair of event blocks; when
+/// the active block is full it is handed to a background thread
+/// which compresses it and appends it to the output file, while the
+/// event loop goes on with the second block.
+///
+/// AgataDetectorAncillary opens the file at the beginning of the
+/// run, writes the ancillary hits of each event and closes it at
+/// the end of the run:
+///   /Agata/file/binary/enable true
+///   /Agata/file/binary/name GammaEvents.blm
+///   /Agata/file/binary/compression 1
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataListModeWriter_h
+#define AgataListModeWriter_h 1
+
+#include "globals.hh"
+#include "AgataListModeFormat.hh"
+
+class G4GenericMessenger;
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+class AgataListModeWriter
+{
+  public:
+    static AgataListModeWriter* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataListModeWriter();
+
+  public:
+    ~AgataListModeWriter();
+
+  private:
+    struct ThreadBuffers
+    {
+      std::vector<char> block[2];
+      uint32_t          nEvents[2];
+      G4bool            inFlight[2];
+      G4int             current;
+    };
+
+    struct Descriptor
+    {
+      G4String           name;
+      std::vector<G4int> offsets;
+    };
+
+    struct Pending
+    {
+      ThreadBuffers* buffers;
+      G4int          index;
+    };
+
+  private:
+    static AgataListModeWriter* instance;
+    static G4ThreadLocal ThreadBuffers* threadBuffers;
+
+  private:
+    std::ofstream             outFile;
+    std::vector<Descriptor>   descriptors;
+    std::vector<ThreadBuffers*> allBuffers;
+    std::deque<Pending>       queue;
+    std::thread               writerThread;
+    std::mutex                theMutex;
+    std::condition_variable   queueCondition;  //> signalled when a block is queued
+    std::condition_variable   doneCondition;   //> signalled when a block is written
+    std::atomic<bool>         running;        //> set by the master, read by the tracking threads
+    G4bool                    headerCommitted;
+    G4bool                    headerWritten;
+    G4double                  unitLength;
+    uint32_t                  blockSize;
+    G4int                     compressionLevel;
+
+  private:
+    G4bool                    enabled;
+    G4String                  fileName;
+    G4GenericMessenger*       myMessenger;
+
+  private:
+    //> statistics
+    uint64_t                  rawBytes;
+    uint64_t                  diskBytes;
+    uint64_t                  nBlocks;
+
+  public:
+    //> to be called (on the master) before the run starts
+    G4bool Open( G4String name );
+    void   Close();
+    G4bool IsOpen() { return running.load(); };
+
+  public:
+    //> header: one entry per ancillary, filled by AgataDetectorAncillary::WriteHeader;
+    //> it can be given before Open() and is kept until Close()
+    void   AddAncillary  ( G4String name, const std::vector<G4int>& offsets );
+    void   CommitHeader  ( G4double unit );
+
+  private:
+    void   WriteFileHeader();
+
+  public:
+    //> event data, called from the thread doing the tracking
+    void   WriteEvent    ( G4int eventId, const std::vector<AgataLMHit>& hits );
+    //> hands the partially filled block of the calling thread to the writer
+    void   FlushThread   ();
+
+  private:
+    ThreadBuffers* GetThreadBuffers();
+    void   Submit        ( ThreadBuffers* tb );
+    void   WriterLoop    ();
+    void   WriteBlock    ( std::vector<char>& block, uint32_t nEvents );
+
+  public:
+    void   SetBlockSize       ( uint32_t size ) { blockSize = std::min( size, AgataLM::maxBlockSize ); };
+    void   SetCompressionLevel( G4int level )   { compressionLevel = level; };
+    inline G4bool          IsEnabled    () { return enabled;    };
+    inline const G4String& GetFileName  () { return fileName;   };
+    inline G4double        GetUnitLength() { return unitLength; };
+};
+
+#endif
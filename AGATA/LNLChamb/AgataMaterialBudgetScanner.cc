@@ -0,0 +1,258 @@
+//////////////////////////////////////////////////////////////////
+/// Ray-casting material budget scanner
+/// (see AgataMaterialBudgetScanner.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataMaterialBudgetScanner.hh"
+
+#include "G4Navigator.hh"
+#include "G4TransportationManager.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Material.hh"
+#include "G4VPVParameterisation.hh"
+#include "G4TouchableHistory.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Threading.hh"
+#include "G4UnitsTable.hh"
+#ifdef G4MULTITHREADED
+#include "G4WorkerThread.hh"
+#endif
+
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+
+AgataMaterialBudgetScanner* AgataMaterialBudgetScanner::instance = NULL;
+
+AgataMaterialBudgetScanner* AgataMaterialBudgetScanner::GetInstance()
+{
+  if( !instance )
+    instance = new AgataMaterialBudgetScanner();
+  return instance;
+}
+
+void AgataMaterialBudgetScanner::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataMaterialBudgetScanner::AgataMaterialBudgetScanner()
+{
+  nTheta   = 180;
+  nPhi     = 360;
+#ifdef G4MULTITHREADED
+  nThreads = G4Threading::G4GetNumberOfCores();
+#else
+  nThreads = 1;
+#endif
+  thetaMin = 0.;
+  thetaMax = 180.*deg;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/budget/",
+                                        "Material budget (X0, lambda) of the loaded geometry" );
+  myMessenger->DeclareProperty( "nTheta", nTheta, "Number of theta bins" )
+    .SetParameterName( "nTheta", false ).SetRange( "nTheta>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "nPhi", nPhi, "Number of phi bins" )
+    .SetParameterName( "nPhi", false ).SetRange( "nPhi>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "thetaMin", "deg", thetaMin, "Lower edge of the theta range" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "thetaMax", "deg", thetaMax, "Upper edge of the theta range" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "origin", "mm", origin, "Origin of the rays (target position)" )
+    .SetToBeBroadcasted( false );
+#ifdef G4MULTITHREADED
+  myMessenger->DeclareProperty( "threads", nThreads, "Number of threads used for the scan" )
+    .SetParameterName( "num", false ).SetRange( "num>0" ).SetToBeBroadcasted( false );
+#endif
+  myMessenger->DeclareMethod( "scan", &AgataMaterialBudgetScanner::Scan,
+                              "Scans the geometry and writes the map to the given file" )
+    .SetParameterName( "fileName", true )
+    .SetDefaultValue( "materialBudget.dat" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataMaterialBudgetScanner::~AgataMaterialBudgetScanner()
+{
+  delete myMessenger;
+}
+
+void AgataMaterialBudgetScanner::Scan( G4String fileName )
+{
+  G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()
+    ->GetNavigatorForTracking()->GetWorldVolume();
+  if( !world ) {
+    G4cout << " Geometry has not been constructed yet, cannot scan the material budget!" << G4endl;
+    return;
+  }
+  ScanWorld( world, fileName );
+}
+
+void AgataMaterialBudgetScanner::ScanWorld( G4VPhysicalVolume* world, G4String fileName )
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  //> each thread takes a contiguous band of theta rows
+  G4int nThr = std::max( 1, std::min( nThreads, nTheta ) );
+  std::vector<ThreadResult>  results(nThr);
+  G4int rowsPerThread = ( nTheta + nThr - 1 ) / nThr;
+#ifdef G4MULTITHREADED
+  std::vector<std::thread>   threads;
+  for( G4int ii=0; ii<nThr; ii++ ) {
+    G4int first = ii * rowsPerThread;
+    G4int last  = std::min( nTheta, first + rowsPerThread );
+    threads.push_back( std::thread( &AgataMaterialBudgetScanner::ScanRows, this,
+                                    world, first, last, &results[ii] ) );
+  }
+  for( size_t ii=0; ii<threads.size(); ii++ )
+    threads[ii].join();
+#else
+  //> the parameterised volumes have a single copy, updated while
+  //> navigating: the scan stays in this thread
+  ScanRows( world, 0, nTheta, &results[0] );
+#endif
+
+  G4double elapsed = std::chrono::duration<G4double>( std::chrono::steady_clock::now() - start ).count();
+
+  //> map file
+  std::ofstream outFile( fileName.c_str() );
+  outFile << "# material budget from " << origin/mm << " mm" << std::endl;
+  outFile << "# theta(deg) phi(deg) X/X0 X/lambda length(mm)" << std::endl;
+  G4double dTheta = ( thetaMax - thetaMin ) / nTheta;
+  G4double dPhi   = 360.*deg / nPhi;
+  for( G4int ii=0; ii<nThr; ii++ ) {
+    G4int first = ii * rowsPerThread;
+    for( size_t jj=0; jj<results[ii].map.size(); jj++ ) {
+      G4int it = first + jj / nPhi;
+      G4int ip = jj % nPhi;
+      const Budget& bb = results[ii].map[jj];
+      outFile << ( thetaMin + ( it + 0.5 )*dTheta )/deg << " " << ( ( ip + 0.5 )*dPhi )/deg << " "
+              << bb.x0 << " " << bb.lambda << " " << bb.length/mm << std::endl;
+    }
+  }
+  outFile.close();
+
+  //> merge and print the contributions, averaged over the solid angle
+  std::map<G4LogicalVolume*,Budget> volumes;
+  std::map<G4Material*,Budget>      materials;
+  std::set<G4LogicalVolume*>        parameterised;
+  G4double solidAngle = 0.;
+  for( G4int ii=0; ii<nThr; ii++ ) {
+    solidAngle += results[ii].solidAngle;
+    parameterised.insert( results[ii].parameterised.begin(), results[ii].parameterised.end() );
+    std::map<G4LogicalVolume*,Budget>::iterator itv;
+    for( itv=results[ii].volumes.begin(); itv!=results[ii].volumes.end(); ++itv ) {
+      Budget& bb = volumes[itv->first];
+      bb.x0 += itv->second.x0; bb.lambda += itv->second.lambda; bb.length += itv->second.length;
+    }
+    std::map<G4Material*,Budget>::iterator itm;
+    for( itm=results[ii].materials.begin(); itm!=results[ii].materials.end(); ++itm ) {
+      Budget& bb = materials[itm->first];
+      bb.x0 += itm->second.x0; bb.lambda += itm->second.lambda; bb.length += itm->second.length;
+    }
+  }
+
+  G4cout << " ---> Material budget: " << nTheta*nPhi << " rays in " << elapsed << " s ("
+         << nThr << " threads), map written to " << fileName << G4endl;
+  G4cout << " ---> Average contribution per volume (X/X0, X/lambda):" << G4endl;
+  std::vector< std::pair<G4double,G4LogicalVolume*> > sorted;
+  std::map<G4LogicalVolume*,Budget>::iterator itv;
+  for( itv=volumes.begin(); itv!=volumes.end(); ++itv )
+    sorted.push_back( std::make_pair( itv->second.x0, itv->first ) );
+  std::sort( sorted.rbegin(), sorted.rend() );
+  for( size_t ii=0; ii<sorted.size(); ii++ ) {
+    G4LogicalVolume* lv = sorted[ii].second;
+    const Budget&    bb = volumes[lv];
+    G4String matName = parameterised.count(lv) ? G4String("parameterised")
+                     : ( lv->GetMaterial() ? lv->GetMaterial()->GetName() : G4String("no material") );
+    G4cout << "      " << lv->GetName() << " (" << matName
+           << "): " << bb.x0/solidAngle << " " << bb.lambda/solidAngle << G4endl;
+  }
+  G4cout << " ---> Average path length per material:" << G4endl;
+  std::map<G4Material*,Budget>::iterator itm;
+  for( itm=materials.begin(); itm!=materials.end(); ++itm ) {
+    G4cout << "      " << itm->first->GetName() << ": "
+           << G4BestUnit( itm->second.length/solidAngle, "Length" ) << G4endl;
+  }
+}
+
+//////////////////////////////////////////////////////////////
+/// One navigator per thread; the geometry itself is shared and
+/// only read. On MT builds the thread needs its own copy of the
+/// split (replica/parameterised) data, as a G4 worker would.
+/// The material of a parameterised volume is not taken from its
+/// logical volume, which holds whatever the last navigation left.
+//////////////////////////////////////////////////////////////
+void AgataMaterialBudgetScanner::ScanRows( G4VPhysicalVolume* world, G4int firstRow,
+                                           G4int lastRow, ThreadResult* result )
+{
+#ifdef G4MULTITHREADED
+  G4WorkerThread::BuildGeometryAndPhysicsVector();
+#endif
+  G4Navigator* navigator = new G4Navigator();
+  navigator->SetWorldVolume(world);
+
+  G4double dTheta = ( thetaMax - thetaMin ) / nTheta;
+  G4double dPhi   = 360.*deg / nPhi;
+  const G4int maxSteps = 100000;
+
+  result->map.resize( ( lastRow - firstRow ) * nPhi );
+  result->solidAngle = 0.;
+
+  for( G4int it=firstRow; it<lastRow; it++ ) {
+    G4double theta = thetaMin + ( it + 0.5 )*dTheta;
+    G4double weight = ( std::cos( theta - 0.5*dTheta ) - std::cos( theta + 0.5*dTheta ) ) * dPhi;
+    for( G4int ip=0; ip<nPhi; ip++ ) {
+      G4double phi = ( ip + 0.5 )*dPhi;
+      G4ThreeVector dir;
+      dir.setRThetaPhi( 1., theta, phi );
+      Budget& total = result->map[ ( it - firstRow )*nPhi + ip ];
+      total.x0 = total.lambda = total.length = 0.;
+
+      G4ThreeVector point = origin;
+      G4VPhysicalVolume* pv = navigator->LocateGlobalPointAndSetup( point, &dir, false, false );
+      for( G4int ns=0; pv && ns<maxSteps; ns++ ) {
+        G4double safety = 0.;
+        G4double step = navigator->ComputeStep( point, dir, kInfinity, safety );
+        if( step >= kInfinity ) break;
+
+        G4LogicalVolume* lv  = pv->GetLogicalVolume();
+        G4Material*      mat = lv->GetMaterial();
+        G4VPVParameterisation* param = pv->IsParameterised() ? pv->GetParameterisation() : NULL;
+        if( param ) {
+          //> the copy number comes from the history of this navigator, the
+          //> material from the parameterisation, given the parent touchable
+          //> (nested parameterisations depend on the copy number of the mother)
+          G4TouchableHistory* touch = navigator->CreateTouchableHistory();
+          G4int copyNo = touch->GetReplicaNumber(0);
+          touch->MoveUpHistory(1);
+          G4Material* pmat = param->ComputeMaterial( copyNo, pv, touch );
+          if( pmat ) mat = pmat;
+          delete touch;
+          result->parameterised.insert(lv);
+        }
+        if( mat && step > 0. ) {
+          G4double x0     = step / mat->GetRadlen();
+          G4double lambda = step / mat->GetNuclearInterLength();
+          total.x0     += x0;
+          total.lambda += lambda;
+          total.length += step;
+          Budget& bv = result->volumes[lv];
+          bv.x0 += weight*x0; bv.lambda += weight*lambda; bv.length += weight*step;
+          Budget& bm = result->materials[mat];
+          bm.x0 += weight*x0; bm.lambda += weight*lambda; bm.length += weight*step;
+        }
+        point += step * dir;
+        navigator->SetGeometricallyLimitedStep();
+        pv = navigator->LocateGlobalPointAndSetup( point, &dir, true, false );
+      }
+      result->solidAngle += weight;
+    }
+  }
+  delete navigator;
+#ifdef G4MULTITHREADED
+  G4WorkerThread::DestroyGeometryAndPhysicsVector();
+#endif
+}
@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////
+/// Material budget of the loaded geometry seen from the target:
+/// straight rays are cast through the volume tree with a private
+/// G4Navigator per thread (no tracking, no physics) over a
+/// theta/phi grid, accumulating the thickness in radiation lengths
+/// and in nuclear interaction lengths, and the path length in each
+/// material. Writes a map file (one line per direction) and prints
+/// the solid-angle averaged contribution of each logical volume.
+/// The material of parameterised volumes (e.g. the voxelised
+/// chamber) is computed from the touchable, as the tracking does.
+/// Only MT builds split the scan over several threads: sequential
+/// builds have no per-thread copy of the parameterised volumes.
+///
+///   /Agata/geometry/budget/nTheta 180
+///   /Agata/geometry/budget/nPhi   360
+///   /Agata/geometry/budget/scan   budget.dat
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataMaterialBudgetScanner_h
+#define AgataMaterialBudgetScanner_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+#include <map>
+#include <set>
+
+class G4VPhysicalVolume;
+class G4LogicalVolume;
+class G4Material;
+class G4GenericMessenger;
+
+class AgataMaterialBudgetScanner
+{
+  public:
+    static AgataMaterialBudgetScanner* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataMaterialBudgetScanner();
+
+  public:
+    ~AgataMaterialBudgetScanner();
+
+  private:
+    static AgataMaterialBudgetScanner* instance;
+
+  private:
+    struct Budget
+    {
+      G4double x0;       //> thickness in radiation lengths
+      G4double lambda;   //> thickness in interaction lengths
+      G4double length;
+    };
+
+    struct ThreadResult
+    {
+      std::vector<Budget>                    map;     //> per direction
+      std::map<G4LogicalVolume*,Budget>      volumes; //> weighted by solid angle
+      std::map<G4Material*,Budget>           materials;
+      std::set<G4LogicalVolume*>             parameterised;
+      G4double                               solidAngle;
+    };
+
+  private:
+    G4int               nTheta;
+    G4int               nPhi;
+    G4int               nThreads;
+    G4double            thetaMin;
+    G4double            thetaMax;
+    G4ThreeVector       origin;
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> the world of the tracking, from the macro command
+    void Scan     ( G4String fileName );
+    //> any (closed) world, e.g. that of a single piece
+    void ScanWorld( G4VPhysicalVolume* world, G4String fileName );
+
+  private:
+    void ScanRows( G4VPhysicalVolume* world, G4int firstRow, G4int lastRow, ThreadResult* result );
+
+  public:
+    inline void SetGrid  ( G4int nt, G4int np ) { nTheta = nt; nPhi = np; };
+    inline void SetOrigin( G4ThreeVector pos )  { origin = pos; };
+};
+
+#endif
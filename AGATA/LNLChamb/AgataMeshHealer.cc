@@ -0,0 +1,496 @@
+//////////////////////////////////////////////////////////////////
+/// Healing of the CAD meshes
+/// (see AgataMeshHealer.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataMeshHealer.hh"
+#include "AgataTriangleMesh.hh"
+#include "AgataSurfaceSampler.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4GDMLParser.hh"
+#include "G4GenericMessenger.hh"
+
+#include <map>
+#include <set>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+
+AgataMeshHealer* AgataMeshHealer::instance = NULL;
+
+AgataMeshHealer* AgataMeshHealer::GetInstance()
+{
+  if( !instance )
+    instance = new AgataMeshHealer();
+  return instance;
+}
+
+void AgataMeshHealer::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataMeshHealer::AgataMeshHealer()
+{
+  enabled    = false;
+  tolerance  = 1.e-3*mm;
+  maxHole    = 16;
+  outputFile = "";
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/heal/", "Repair of the CAD meshes" );
+  myMessenger->DeclareProperty( "enable", enabled,
+                                "Repairs the tessellated solids when the GDML files are read" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "tolerance", "mm", tolerance,
+                                        "Distance under which vertices are merged" )
+    .SetParameterName( "tolerance", false ).SetRange( "tolerance>0" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "maxHole", maxHole, "Longest open loop (edges) which is closed" )
+    .SetParameterName( "num", false ).SetRange( "num>2" ).SetToBeBroadcasted( false );
+  myMessenger->DeclareProperty( "output", outputFile, "Writes the healed geometry to this GDML file" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataMeshHealer::~AgataMeshHealer()
+{
+  delete myMessenger;
+}
+
+void AgataMeshHealer::Apply( G4LogicalVolume* top )
+{
+  std::vector<G4LogicalVolume*> volumes( 1, top );
+  std::set<G4LogicalVolume*>    done;
+  std::map<G4VSolid*,G4VSolid*> healed;  //> solids shared by several volumes are healed once
+  G4int nMeshes = 0;
+  for( size_t ii=0; ii<volumes.size(); ii++ ) {
+    G4LogicalVolume* volume = volumes[ii];
+    if( !done.insert(volume).second ) continue;
+    for( size_t jj=0; jj<volume->GetNoDaughters(); jj++ )
+      volumes.push_back( volume->GetDaughter(jj)->GetLogicalVolume() );
+
+    G4TessellatedSolid* tess = dynamic_cast<G4TessellatedSolid*>( volume->GetSolid() );
+    if( !tess || tess->GetNumberOfFacets() == 0 ) continue;
+    std::map<G4VSolid*,G4VSolid*>::iterator it = healed.find(tess);
+    if( it != healed.end() ) {
+      volume->SetSolid( it->second );
+      continue;
+    }
+    nMeshes++;
+
+    AgataTriangleMesh mesh(tess);
+    AgataMeshRepairs  repairs = Heal(mesh);
+    healed[tess] = tess;
+    if( !repairs.Changed() && repairs.nOpenEdges == 0 ) continue;
+
+    std::ostringstream report;
+    if( repairs.nWelded     ) report << ", " << repairs.nWelded     << " vertices welded";
+    if( repairs.nDegenerate ) report << ", " << repairs.nDegenerate << " flat facets removed";
+    if( repairs.nDuplicate  ) report << ", " << repairs.nDuplicate  << " duplicated facets removed";
+    if( repairs.nTJunctions ) report << ", " << repairs.nTJunctions << " T-junctions split";
+    if( repairs.nFlipped    ) report << ", " << repairs.nFlipped    << " facets flipped";
+    if( repairs.nHoles      ) report << ", " << repairs.nHoles      << " holes closed";
+    if( repairs.nOpenEdges  ) report << ", " << repairs.nOpenEdges  << " open edges left";
+    G4cout << " ---> " << tess->GetName() << report.str().substr(1) << G4endl;
+
+    if( repairs.Changed() ) {
+      G4TessellatedSolid* solid = mesh.BuildSolid( tess->GetName() );
+      healed[tess] = solid;
+      volume->SetSolid( solid );
+    }
+  }
+
+  //> the parser has built (and voxelised) the original solids: they go
+  //> away, unless a volume outside top still uses them, so that the
+  //> store only holds the healed solid of each name
+  std::set<G4VSolid*> stillUsed;
+  G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+  for( size_t ii=0; ii<theStore->size(); ii++ )
+    stillUsed.insert( (*theStore)[ii]->GetSolid() );
+  G4int nHealed = 0;
+  for( std::map<G4VSolid*,G4VSolid*>::iterator it=healed.begin(); it!=healed.end(); ++it ) {
+    if( it->first == it->second ) continue;
+    nHealed++;
+    if( stillUsed.count( it->first ) ) continue;
+    AgataSurfaceSampler::Forget( it->first );
+    delete it->first;
+  }
+  G4cout << " ---> " << top->GetName() << ": " << nHealed << " of " << nMeshes
+         << " meshes repaired" << G4endl;
+
+  if( outputFile != "" ) {
+    //> G4GDMLParser refuses to overwrite a file
+    remove( outputFile.c_str() );
+    G4GDMLParser writer;
+    writer.Write( outputFile, top, false );
+    G4cout << " ---> Healed geometry written to " << outputFile << G4endl;
+  }
+}
+
+AgataMeshRepairs AgataMeshHealer::Heal( AgataTriangleMesh& mesh )
+{
+  AgataMeshRepairs repairs;
+  repairs.nWelded     = Weld(mesh);
+  repairs.nDegenerate = RemoveFlat(mesh);
+  repairs.nDuplicate  = RemoveDuplicates(mesh);
+  repairs.nTJunctions = SplitTJunctions(mesh);
+  repairs.nFlipped    = Orient(mesh);
+  repairs.nHoles      = CloseHoles( mesh, repairs.nOpenEdges );
+  return repairs;
+}
+
+namespace {
+  typedef std::pair<G4int,G4int> Edge;
+
+  inline Edge MakeEdge( G4int a, G4int b )
+  {
+    return ( a < b ) ? Edge(a,b) : Edge(b,a);
+  }
+
+  //> number of facets using each edge, whatever the direction
+  std::map<Edge,G4int> CountEdges( const AgataTriangleMesh& mesh )
+  {
+    std::map<Edge,G4int> uses;
+    for( size_t ii=0; ii<mesh.triangles.size(); ii++ )
+      uses[ MakeEdge( mesh.triangles[ii], mesh.triangles[ii - ii%3 + (ii+1)%3] ) ]++;
+    return uses;
+  }
+
+  void Flip( AgataTriangleMesh& mesh, G4int tri )
+  {
+    std::swap( mesh.triangles[3*tri+1], mesh.triangles[3*tri+2] );
+  }
+
+  //> facet tri goes from a to b
+  G4bool HasDirected( const AgataTriangleMesh& mesh, G4int tri, G4int a, G4int b )
+  {
+    for( G4int cc=0; cc<3; cc++ )
+      if( mesh.triangles[3*tri+cc] == a && mesh.triangles[3*tri+(cc+1)%3] == b )
+        return true;
+    return false;
+  }
+
+  struct XLess
+  {
+    const AgataTriangleMesh* mesh;
+    bool operator()( G4int a, G4int b ) const { return mesh->vertices[a].x() < mesh->vertices[b].x(); }
+    bool operator()( G4int a, G4double x ) const { return mesh->vertices[a].x() < x; }
+  };
+}
+
+//////////////////////////////////////////////////////////////
+/// Vertices closer than tolerance are merged, comparing each
+/// one with the kept vertices of the 27 neighbouring cells of
+/// a grid of size tolerance
+//////////////////////////////////////////////////////////////
+G4int AgataMeshHealer::Weld( AgataTriangleMesh& mesh )
+{
+  std::map< std::vector<long long>, std::vector<G4int> > grid;
+  std::vector<G4int> weldId( mesh.vertices.size() );
+  G4int nWelded = 0;
+  for( size_t vv=0; vv<mesh.vertices.size(); vv++ ) {
+    const G4ThreeVector& vertex = mesh.vertices[vv];
+    std::vector<long long> cell(3);
+    for( G4int ax=0; ax<3; ax++ )
+      cell[ax] = (long long)std::floor( vertex[ax] / tolerance );
+
+    G4int found = -1;
+    for( G4int nn=0; nn<27 && found<0; nn++ ) {
+      std::vector<long long> near(cell);
+      near[0] += nn%3 - 1;
+      near[1] += (nn/3)%3 - 1;
+      near[2] += nn/9 - 1;
+      std::map< std::vector<long long>, std::vector<G4int> >::iterator it = grid.find(near);
+      if( it == grid.end() ) continue;
+      for( size_t kk=0; kk<it->second.size() && found<0; kk++ )
+        if( ( mesh.vertices[it->second[kk]] - vertex ).mag() <= tolerance )
+          found = it->second[kk];
+    }
+    if( found < 0 ) {
+      grid[cell].push_back(vv);
+      weldId[vv] = vv;
+    }
+    else {
+      weldId[vv] = found;
+      nWelded++;
+    }
+  }
+  for( size_t ii=0; ii<mesh.triangles.size(); ii++ )
+    mesh.triangles[ii] = weldId[ mesh.triangles[ii] ];
+  return nWelded;
+}
+
+//////////////////////////////////////////////////////////////
+/// Facets with two identical corners or thinner than tolerance
+//////////////////////////////////////////////////////////////
+G4int AgataMeshHealer::RemoveFlat( AgataTriangleMesh& mesh )
+{
+  std::vector<G4int> kept;
+  kept.reserve( mesh.triangles.size() );
+  G4int nRemoved = 0;
+  for( G4int tt=0; tt<mesh.GetNumberOfTriangles(); tt++ ) {
+    G4double longest = 0.;
+    for( G4int cc=0; cc<3; cc++ )
+      longest = std::max( longest, ( mesh.GetVertex(tt,(cc+1)%3) - mesh.GetVertex(tt,cc) ).mag() );
+    if( longest == 0. || mesh.GetTriangleNormal(tt).mag() / longest < tolerance ) {
+      nRemoved++;
+      continue;
+    }
+    kept.insert( kept.end(), mesh.triangles.begin() + 3*tt, mesh.triangles.begin() + 3*tt + 3 );
+  }
+  mesh.triangles.swap(kept);
+  return nRemoved;
+}
+
+//////////////////////////////////////////////////////////////
+/// Facets on the same three vertices: one is kept when they have
+/// the same orientation, none when both orientations are present
+//////////////////////////////////////////////////////////////
+G4int AgataMeshHealer::RemoveDuplicates( AgataTriangleMesh& mesh )
+{
+  std::map< std::vector<G4int>, std::vector<G4int> > byCorners;
+  for( G4int tt=0; tt<mesh.GetNumberOfTriangles(); tt++ ) {
+    std::vector<G4int> key( mesh.triangles.begin() + 3*tt, mesh.triangles.begin() + 3*tt + 3 );
+    std::sort( key.begin(), key.end() );
+    byCorners[key].push_back(tt);
+  }
+
+  std::vector<G4bool> remove( mesh.GetNumberOfTriangles(), false );
+  G4int nRemoved = 0;
+  std::map< std::vector<G4int>, std::vector<G4int> >::iterator it;
+  for( it=byCorners.begin(); it!=byCorners.end(); ++it ) {
+    std::vector<G4int>& group = it->second;
+    if( group.size() < 2 ) continue;
+    //> same orientation as the first facet of the group
+    G4int a = mesh.triangles[3*group[0]], b = mesh.triangles[3*group[0]+1];
+    G4bool opposite = false;
+    for( size_t ii=1; ii<group.size(); ii++ )
+      opposite = opposite || !HasDirected( mesh, group[ii], a, b );
+    for( size_t ii=( opposite ? 0 : 1 ); ii<group.size(); ii++ ) {
+      remove[group[ii]] = true;
+      nRemoved++;
+    }
+  }
+  if( nRemoved == 0 ) return 0;
+
+  std::vector<G4int> kept;
+  kept.reserve( mesh.triangles.size() );
+  for( G4int tt=0; tt<mesh.GetNumberOfTriangles(); tt++ )
+    if( !remove[tt] )
+      kept.insert( kept.end(), mesh.triangles.begin() + 3*tt, mesh.triangles.begin() + 3*tt + 3 );
+  mesh.triangles.swap(kept);
+  return nRemoved;
+}
+
+//////////////////////////////////////////////////////////////
+/// A vertex lying inside an edge used by one facet only splits
+/// that facet; repeated until no such vertex is left
+//////////////////////////////////////////////////////////////
+G4int AgataMeshHealer::SplitTJunctions( AgataTriangleMesh& mesh )
+{
+  //> vertices still in use, sorted in x to look for the ones along an edge
+  std::vector<G4bool> used( mesh.vertices.size(), false );
+  for( size_t ii=0; ii<mesh.triangles.size(); ii++ ) used[mesh.triangles[ii]] = true;
+  std::vector<G4int> byX;
+  for( size_t vv=0; vv<used.size(); vv++ )
+    if( used[vv] ) byX.push_back(vv);
+  XLess xLess;
+  xLess.mesh = &mesh;
+  std::sort( byX.begin(), byX.end(), xLess );
+
+  G4int nSplit = 0;
+  for( G4int pass=0; pass<100; pass++ ) {
+    std::map<Edge,G4int> uses = CountEdges(mesh);
+    G4int nTri   = mesh.GetNumberOfTriangles();
+    G4int before = nSplit;
+    for( G4int tt=0; tt<nTri; tt++ ) {
+      for( G4int cc=0; cc<3; cc++ ) {
+        G4int a = mesh.triangles[3*tt+cc];
+        G4int b = mesh.triangles[3*tt+(cc+1)%3];
+        G4int c = mesh.triangles[3*tt+(cc+2)%3];
+        if( uses[MakeEdge(a,b)] != 1 ) continue;
+
+        //> vertex on the edge nearest to a
+        const G4ThreeVector& pa = mesh.vertices[a];
+        G4ThreeVector dir   = mesh.vertices[b] - pa;
+        G4double      len   = dir.mag();
+        dir /= len;
+        G4int    split = -1;
+        G4double along = len;
+        std::vector<G4int>::iterator first =
+          std::lower_bound( byX.begin(), byX.end(), std::min( pa.x(), mesh.vertices[b].x() ) - tolerance, xLess );
+        G4double xMax = std::max( pa.x(), mesh.vertices[b].x() ) + tolerance;
+        for( std::vector<G4int>::iterator it=first; it!=byX.end() && mesh.vertices[*it].x()<=xMax; ++it ) {
+          G4ThreeVector rel = mesh.vertices[*it] - pa;
+          G4double      t   = rel.dot(dir);
+          if( t <= tolerance || t >= along - tolerance ) continue;
+          if( ( rel - t*dir ).mag() > tolerance ) continue;
+          split = *it;
+          along = t;
+        }
+        if( split < 0 ) continue;
+
+        mesh.triangles[3*tt+(cc+1)%3] = split;
+        mesh.AddTriangle( split, b, c );
+        nSplit++;
+        break;
+      }
+    }
+    if( nSplit == before ) break;
+  }
+  return nSplit;
+}
+
+//////////////////////////////////////////////////////////////
+/// Consistent windings over each connected shell, through the
+/// edges shared by two facets. Each shell is then turned by its
+/// nesting: contained in an even number of other shells it bounds
+/// matter (positive volume), in an odd number it bounds a cavity
+/// (negative volume). Returns the facets flipped.
+//////////////////////////////////////////////////////////////
+namespace {
+  //> solid angle of the triangle seen from point (Van Oosterom and Strackee)
+  G4double SolidAngle( const AgataTriangleMesh& mesh, G4int tri, const G4ThreeVector& point )
+  {
+    G4ThreeVector a = mesh.GetVertex(tri,0) - point;
+    G4ThreeVector b = mesh.GetVertex(tri,1) - point;
+    G4ThreeVector c = mesh.GetVertex(tri,2) - point;
+    G4double la = a.mag(), lb = b.mag(), lc = c.mag();
+    G4double numerator   = a.dot( b.cross(c) );
+    G4double denominator = la*lb*lc + a.dot(b)*lc + a.dot(c)*lb + b.dot(c)*la;
+    return 2.*std::atan2( numerator, denominator );
+  }
+
+  //> winding number of a shell around point: +-1 inside, 0 outside
+  G4bool Contains( const AgataTriangleMesh& mesh, const std::vector<G4int>& shell, const G4ThreeVector& point )
+  {
+    G4double angle = 0.;
+    for( size_t ii=0; ii<shell.size(); ii++ )
+      angle += SolidAngle( mesh, shell[ii], point );
+    return std::fabs( angle ) > twopi;
+  }
+}
+
+G4int AgataMeshHealer::Orient( AgataTriangleMesh& mesh )
+{
+  G4int nTri = mesh.GetNumberOfTriangles();
+  std::map< Edge, std::vector<G4int> > edgeFacets;
+  for( G4int tt=0; tt<nTri; tt++ )
+    for( G4int cc=0; cc<3; cc++ )
+      edgeFacets[ MakeEdge( mesh.triangles[3*tt+cc], mesh.triangles[3*tt+(cc+1)%3] ) ].push_back(tt);
+
+  std::vector<G4bool> visited( nTri, false );
+  std::vector<G4bool> flipped( nTri, false );
+  std::vector< std::vector<G4int> > shells;
+  for( G4int seed=0; seed<nTri; seed++ ) {
+    if( visited[seed] ) continue;
+    std::vector<G4int> shell( 1, seed );
+    visited[seed] = true;
+    for( size_t ii=0; ii<shell.size(); ii++ ) {
+      G4int tt = shell[ii];
+      for( G4int cc=0; cc<3; cc++ ) {
+        G4int a = mesh.triangles[3*tt+cc];
+        G4int b = mesh.triangles[3*tt+(cc+1)%3];
+        const std::vector<G4int>& facets = edgeFacets[ MakeEdge(a,b) ];
+        if( facets.size() != 2 ) continue;  //> open or non-manifold edge
+        G4int other = ( facets[0] == tt ) ? facets[1] : facets[0];
+        if( visited[other] ) continue;
+        //> the neighbour must go along the shared edge from b to a
+        if( HasDirected( mesh, other, a, b ) ) {
+          Flip( mesh, other );
+          flipped[other] = !flipped[other];
+        }
+        visited[other] = true;
+        shell.push_back(other);
+      }
+    }
+    shells.push_back(shell);
+  }
+
+  for( size_t ss=0; ss<shells.size(); ss++ ) {
+    const std::vector<G4int>& shell = shells[ss];
+    //> the shells do not cross: any point of this one tells the nesting
+    G4ThreeVector point = ( mesh.GetVertex(shell[0],0) + mesh.GetVertex(shell[0],1) + mesh.GetVertex(shell[0],2) )/3.;
+    G4int depth = 0;
+    for( size_t oo=0; oo<shells.size(); oo++ )
+      if( oo != ss && Contains( mesh, shells[oo], point ) ) depth++;
+
+    G4double volume = 0.;
+    for( size_t ii=0; ii<shell.size(); ii++ )
+      volume += mesh.GetVertex(shell[ii],0).dot( mesh.GetVertex(shell[ii],1).cross( mesh.GetVertex(shell[ii],2) ) );
+    if( ( volume < 0. ) != ( depth%2 == 1 ) ) {
+      for( size_t ii=0; ii<shell.size(); ii++ ) {
+        Flip( mesh, shell[ii] );
+        flipped[shell[ii]] = !flipped[shell[ii]];
+      }
+    }
+  }
+  return std::count( flipped.begin(), flipped.end(), true );
+}
+
+//////////////////////////////////////////////////////////////
+/// The open edges are chained into loops following the facet
+/// windings; loops of at most maxHole edges are filled
+//////////////////////////////////////////////////////////////
+G4int AgataMeshHealer::CloseHoles( AgataTriangleMesh& mesh, G4int& nOpenEdges )
+{
+  std::map<Edge,G4int> uses = CountEdges(mesh);
+  std::map< G4int, std::vector<G4int> > next;  //> open edges, as a -> b in their facet
+  nOpenEdges = 0;
+  for( size_t ii=0; ii<mesh.triangles.size(); ii++ ) {
+    G4int a = mesh.triangles[ii];
+    G4int b = mesh.triangles[ii - ii%3 + (ii+1)%3];
+    if( uses[MakeEdge(a,b)] != 1 ) continue;
+    next[a].push_back(b);
+    nOpenEdges++;
+  }
+
+  G4int nHoles = 0;
+  std::map< G4int, std::vector<G4int> >::iterator start;
+  for( start=next.begin(); start!=next.end(); ++start ) {
+    while( !start->second.empty() ) {
+      std::vector<G4int> loop( 1, start->first );
+      G4bool closed = false;
+      while( (G4int)loop.size() <= maxHole ) {
+        std::vector<G4int>& out = next[loop.back()];
+        if( out.empty() ) break;
+        G4int vertex = out.back();
+        out.pop_back();
+        if( vertex == loop[0] ) {
+          closed = true;
+          break;
+        }
+        loop.push_back(vertex);
+      }
+      if( !closed ) {
+        //> the edges walked may close a shorter loop from another vertex:
+        //> all but the first one (which does not close from here) go back
+        for( size_t ii=2; ii<loop.size(); ii++ )
+          next[loop[ii-1]].push_back( loop[ii] );
+        continue;
+      }
+      if( loop.size() < 3 ) continue;
+
+      //> the filling facets go along the loop edges backwards
+      G4int nLoop = loop.size();
+      if( nLoop == 3 )
+        mesh.AddTriangle( loop[2], loop[1], loop[0] );
+      else {
+        G4ThreeVector centre;
+        for( G4int ii=0; ii<nLoop; ii++ ) centre += mesh.vertices[loop[ii]];
+        G4int middle = mesh.AddVertex( centre/nLoop );
+        for( G4int ii=0; ii<nLoop; ii++ )
+          mesh.AddTriangle( loop[(ii+1)%nLoop], loop[ii], middle );
+      }
+      nOpenEdges -= nLoop;
+      nHoles++;
+    }
+  }
+  return nHoles;
+}
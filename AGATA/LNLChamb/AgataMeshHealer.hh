@@ -0,0 +1,100 @@
+//////////////////////////////////////////////////////////////////
+/// Import option repairing the CAD meshes once the GDML files are
+/// read and masked (G4GDMLParser has already built the solids: the
+/// repaired ones are rebuilt and the originals deleted). The Fastrad
+/// translations contain cracks, T-junctions, duplicated facets and
+/// inconsistent windings, giving stuck and killed tracks in
+/// G4TessellatedSolid. Each tessellated solid is
+///  - welded: vertices closer than tolerance are merged;
+///  - cleaned: zero-area facets (height below tolerance) and
+///    duplicated facets are removed; coincident facets of opposite
+///    orientation (zero-thickness walls) are removed both;
+///  - stitched: a vertex lying inside an open edge (T-junction)
+///    splits the facet of that edge;
+///  - oriented: the windings are made consistent across the edges
+///    shared by two facets, and each connected shell is turned by
+///    its nesting: outwards (positive volume) when it is inside an
+///    even number of other shells, inwards (a cavity) when odd;
+///  - closed: the remaining open loops of at most maxHole edges are
+///    filled by a fan around their centre.
+/// Solids needing repairs are rebuilt with their name unchanged, and
+/// the original is removed from the G4SolidStore and deleted (unless
+/// a volume outside the healed tree uses it); the repairs are printed
+/// per solid. The healed geometry can be written back as GDML.
+///
+///   /Agata/geometry/heal/enable true   (before /run/initialize)
+///   /Agata/geometry/heal/tolerance 1 um
+///   /Agata/geometry/heal/maxHole 16
+///   /Agata/geometry/heal/output healed.gdml
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataMeshHealer_h
+#define AgataMeshHealer_h 1
+
+#include "globals.hh"
+
+class G4LogicalVolume;
+class G4GenericMessenger;
+class AgataTriangleMesh;
+
+//////////////////////////////////////////////////////////////////
+/// Repairs done on one mesh
+/////////////////////////////////////////////////////////////////
+struct AgataMeshRepairs
+{
+  G4int nWelded;      //> vertices merged into another one
+  G4int nDegenerate;  //> zero-area facets removed
+  G4int nDuplicate;   //> duplicated facets removed
+  G4int nTJunctions;  //> facets split at a T-junction
+  G4int nFlipped;     //> facets turned over
+  G4int nHoles;       //> open loops closed
+  G4int nOpenEdges;   //> open edges left
+
+  AgataMeshRepairs() : nWelded(0), nDegenerate(0), nDuplicate(0), nTJunctions(0),
+                       nFlipped(0), nHoles(0), nOpenEdges(0) {};
+  inline G4bool Changed() const
+  { return nWelded || nDegenerate || nDuplicate || nTJunctions || nFlipped || nHoles; };
+};
+
+class AgataMeshHealer
+{
+  public:
+    static AgataMeshHealer* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataMeshHealer();
+
+  public:
+    ~AgataMeshHealer();
+
+  private:
+    static AgataMeshHealer* instance;
+
+  private:
+    G4bool              enabled;
+    G4double            tolerance;   //> for coincident vertices and flat facets
+    G4int               maxHole;     //> longest open loop which is closed (edges)
+    G4String            outputFile;  //> healed GDML, not written if empty
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> heals the tessellated solids of top and of its descendants
+    void  Apply( G4LogicalVolume* top );
+    //> returns the repairs done on mesh
+    AgataMeshRepairs Heal( AgataTriangleMesh& mesh );
+
+  private:
+    G4int Weld          ( AgataTriangleMesh& mesh );
+    G4int RemoveFlat    ( AgataTriangleMesh& mesh );
+    G4int RemoveDuplicates( AgataTriangleMesh& mesh );
+    G4int SplitTJunctions ( AgataTriangleMesh& mesh );
+    G4int Orient        ( AgataTriangleMesh& mesh );
+    G4int CloseHoles    ( AgataTriangleMesh& mesh, G4int& nOpenEdges );
+
+  public:
+    inline G4bool IsEnabled()              { return enabled; };
+    inline void   SetEnabled( G4bool val ) { enabled = val;  };
+};
+
+#endif
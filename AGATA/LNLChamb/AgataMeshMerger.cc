@@ -0,0 +1,325 @@
+//////////////////////////////////////////////////////////////////
+/// Merging of the same-material sibling meshes
+/// (see AgataMeshMerger.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataMeshMerger.hh"
+#include "AgataImportanceBiasing.hh"
+#include "AgataVolumeProfiler.hh"
+#include "AgataTriangleMesh.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4MultiUnion.hh"
+#include "G4Material.hh"
+#include "G4AffineTransform.hh"
+#include "G4Transform3D.hh"
+#include "G4GenericMessenger.hh"
+
+#include <map>
+#include <set>
+#include <cmath>
+#include <algorithm>
+
+AgataMeshMerger* AgataMeshMerger::instance = NULL;
+
+AgataMeshMerger* AgataMeshMerger::GetInstance()
+{
+  if( !instance )
+    instance = new AgataMeshMerger();
+  return instance;
+}
+
+void AgataMeshMerger::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataMeshMerger::AgataMeshMerger()
+{
+  enabled   = false;
+  tolerance = 1.e-6*mm;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/merge/", "Fusion of the CAD meshes" );
+  myMessenger->DeclareProperty( "siblings", enabled,
+                                "Fuses sibling meshes of the same material when the GDML files are read" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclarePropertyWithUnit( "tolerance", "mm", tolerance,
+                                        "Distance within which the vertices of two pieces are the same" )
+    .SetParameterName( "tolerance", false )
+    .SetRange( "tolerance>0." )
+    .SetToBeBroadcasted( false );
+}
+
+AgataMeshMerger::~AgataMeshMerger()
+{
+  delete myMessenger;
+}
+
+void AgataMeshMerger::Apply( G4LogicalVolume* top )
+{
+  G4int before = top->GetNoDaughters();
+  G4int merged = MergeDaughters(top);
+  if( merged > 0 )
+    G4cout << " ---> " << top->GetName() << ": " << merged << " meshes merged, "
+           << before << " -> " << top->GetNoDaughters() << " daughters" << G4endl;
+}
+
+G4int AgataMeshMerger::MergeDaughters( G4LogicalVolume* mother )
+{
+  G4int nMerged = 0;
+  std::map< G4Material*, std::vector<G4VPhysicalVolume*> > groups;
+
+  for( size_t ii=0; ii<mother->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = mother->GetDaughter(ii);
+    G4LogicalVolume*   dLog     = daughter->GetLogicalVolume();
+    if( dLog->GetNoDaughters() > 0 ) {
+      nMerged += MergeDaughters(dLog);
+      continue;
+    }
+    if( daughter->IsReplicated() || dLog->GetSensitiveDetector() ) continue;
+    if( !dynamic_cast<G4TessellatedSolid*>( dLog->GetSolid() ) ) continue;
+    groups[ dLog->GetMaterial() ].push_back(daughter);
+  }
+
+  std::map< G4Material*, std::vector<G4VPhysicalVolume*> >::iterator it;
+  for( it=groups.begin(); it!=groups.end(); ++it ) {
+    if( it->second.size() < 2 ) continue;
+    nMerged += it->second.size();
+    MergeGroup( mother, it->second );
+  }
+  return nMerged;
+}
+
+//////////////////////////////////////////////////////////////
+/// Pieces overlap if a vertex of one is inside another, or on its
+/// surface without being one of its vertices (partial contact,
+/// T-junctions), which the removal of the internal faces cannot
+/// handle, or if an edge of one crosses a facet of another (two
+/// bars crossing as a plus sign have no vertex inside each other).
+/// Only checked for overlapping bounding boxes.
+//////////////////////////////////////////////////////////////
+G4bool AgataMeshMerger::Overlapping( std::vector<G4VPhysicalVolume*>& group )
+{
+  size_t nn = group.size();
+  std::vector<G4AffineTransform> toMother(nn);
+  std::vector<AgataTriangleMesh> meshes(nn);
+  std::vector<G4ThreeVector> bMin(nn), bMax(nn);
+  std::vector< std::set< std::vector<long long> > > corners(nn);
+  for( size_t ii=0; ii<nn; ii++ ) {
+    toMother[ii] = G4AffineTransform( group[ii]->GetRotation(), group[ii]->GetTranslation() );
+    meshes[ii] = AgataTriangleMesh( (G4TessellatedSolid*)group[ii]->GetLogicalVolume()->GetSolid() );
+    for( size_t vv=0; vv<meshes[ii].vertices.size(); vv++ )
+      meshes[ii].vertices[vv] = toMother[ii].TransformPoint( meshes[ii].vertices[vv] );
+    for( size_t vv=0; vv<meshes[ii].vertices.size(); vv++ )
+      corners[ii].insert( WeldKey( meshes[ii].vertices[vv] ) );
+    meshes[ii].GetBoundingBox( bMin[ii], bMax[ii] );
+  }
+
+  for( size_t ii=0; ii<nn; ii++ ) {
+    for( size_t jj=0; jj<nn; jj++ ) {
+      if( ii == jj ) continue;
+      if( bMin[ii].x() > bMax[jj].x() || bMax[ii].x() < bMin[jj].x() ||
+          bMin[ii].y() > bMax[jj].y() || bMax[ii].y() < bMin[jj].y() ||
+          bMin[ii].z() > bMax[jj].z() || bMax[ii].z() < bMin[jj].z() ) continue;
+      G4VSolid* other = group[jj]->GetLogicalVolume()->GetSolid();
+      G4AffineTransform toOther = toMother[jj].Inverse();
+      for( size_t vv=0; vv<meshes[ii].vertices.size(); vv++ ) {
+        EInside where = other->Inside( toOther.TransformPoint( meshes[ii].vertices[vv] ) );
+        if( where == kInside ) return true;
+        if( where == kSurface && !corners[jj].count( WeldKey( meshes[ii].vertices[vv] ) ) )
+          return true;
+      }
+      G4ThreeVector lo( std::max( bMin[ii].x(), bMin[jj].x() ), std::max( bMin[ii].y(), bMin[jj].y() ),
+                        std::max( bMin[ii].z(), bMin[jj].z() ) );
+      G4ThreeVector hi( std::min( bMax[ii].x(), bMax[jj].x() ), std::min( bMax[ii].y(), bMax[jj].y() ),
+                        std::min( bMax[ii].z(), bMax[jj].z() ) );
+      if( Crossing( meshes[ii], meshes[jj], lo, hi ) ) return true;
+    }
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////
+/// Only proper crossings count: the ends of the edge strictly on
+/// both sides of the plane of the facet, the crossing point
+/// strictly inside it. Edges and facets in contact (shared faces,
+/// edges or vertices) are left to the vertex test. Only the
+/// edges and facets reaching the common box lo-hi are tried.
+//////////////////////////////////////////////////////////////
+G4bool AgataMeshMerger::Crossing( const AgataTriangleMesh& edges, const AgataTriangleMesh& facets,
+                                  const G4ThreeVector& lo, const G4ThreeVector& hi ) const
+{
+  std::vector<G4int> near;
+  for( G4int tt=0; tt<facets.GetNumberOfTriangles(); tt++ ) {
+    const G4ThreeVector& v0 = facets.GetVertex( tt, 0 );
+    const G4ThreeVector& v1 = facets.GetVertex( tt, 1 );
+    const G4ThreeVector& v2 = facets.GetVertex( tt, 2 );
+    G4bool outside = false;
+    for( G4int ax=0; ax<3 && !outside; ax++ ) {
+      G4double tMin = std::min( v0[ax], std::min( v1[ax], v2[ax] ) );
+      G4double tMax = std::max( v0[ax], std::max( v1[ax], v2[ax] ) );
+      outside = tMin > hi[ax] + tolerance || tMax < lo[ax] - tolerance;
+    }
+    if( !outside ) near.push_back(tt);
+  }
+  if( near.empty() ) return false;
+
+  for( G4int ee=0; ee<edges.GetNumberOfTriangles(); ee++ ) {
+    for( G4int cc=0; cc<3; cc++ ) {
+      const G4ThreeVector& pp = edges.GetVertex( ee, cc );
+      const G4ThreeVector& qq = edges.GetVertex( ee, (cc+1)%3 );
+      G4bool outside = false;
+      for( G4int ax=0; ax<3 && !outside; ax++ )
+        outside = std::min( pp[ax], qq[ax] ) > hi[ax] + tolerance ||
+                  std::max( pp[ax], qq[ax] ) < lo[ax] - tolerance;
+      if( outside ) continue;
+
+      for( size_t nn=0; nn<near.size(); nn++ ) {
+        G4int tt = near[nn];
+        const G4ThreeVector& aa = facets.GetVertex( tt, 0 );
+        G4ThreeVector normal = facets.GetTriangleNormal(tt);
+        if( normal.mag2() <= 0. ) continue;
+        normal = normal.unit();
+        G4double dp = normal.dot( pp - aa );
+        G4double dq = normal.dot( qq - aa );
+        if( std::fabs(dp) <= tolerance || std::fabs(dq) <= tolerance || dp*dq > 0. ) continue;
+
+        G4ThreeVector cross = pp + ( dp / ( dp - dq ) ) * ( qq - pp );
+        G4bool inside = true;
+        for( G4int kk=0; kk<3 && inside; kk++ ) {
+          const G4ThreeVector& v0 = facets.GetVertex( tt, kk );
+          const G4ThreeVector& v1 = facets.GetVertex( tt, (kk+1)%3 );
+          G4ThreeVector side = v1 - v0;
+          //> distance of the crossing point inside the side kk
+          inside = normal.dot( side.cross( cross - v0 ) ) > tolerance * side.mag();
+        }
+        if( inside ) return true;
+      }
+    }
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////
+/// Two pieces touching along a face share facets with the same
+/// (welded) vertices and opposite orientation: both go
+//////////////////////////////////////////////////////////////
+std::vector<long long> AgataMeshMerger::WeldKey( const G4ThreeVector& point ) const
+{
+  std::vector<long long> key(3);
+  for( G4int ax=0; ax<3; ax++ )
+    key[ax] = (long long)std::floor( point[ax] / tolerance + 0.5 );
+  return key;
+}
+
+G4int AgataMeshMerger::RemoveInternalFaces( AgataTriangleMesh& mesh )
+{
+  //> weld the vertices on a grid of size tolerance
+  std::map< std::vector<long long>, G4int > welded;
+  std::vector<G4int> weldId( mesh.vertices.size() );
+  for( size_t vv=0; vv<mesh.vertices.size(); vv++ ) {
+    std::vector<long long> key = WeldKey( mesh.vertices[vv] );
+    std::map< std::vector<long long>, G4int >::iterator it = welded.find(key);
+    if( it == welded.end() ) {
+      weldId[vv] = vv;
+      welded[key] = vv;
+    }
+    else
+      weldId[vv] = it->second;
+  }
+
+  G4int nTri = mesh.GetNumberOfTriangles();
+  std::map< std::vector<G4int>, std::vector<G4int> > byCorners;
+  for( G4int tt=0; tt<nTri; tt++ ) {
+    std::vector<G4int> key(3);
+    for( G4int cc=0; cc<3; cc++ )
+      key[cc] = weldId[ mesh.triangles[3*tt+cc] ];
+    std::sort( key.begin(), key.end() );
+    byCorners[key].push_back(tt);
+  }
+
+  std::vector<G4bool> removed( nTri, false );
+  std::map< std::vector<G4int>, std::vector<G4int> >::iterator it;
+  for( it=byCorners.begin(); it!=byCorners.end(); ++it ) {
+    std::vector<G4int>& tris = it->second;
+    for( size_t aa=0; aa<tris.size(); aa++ ) {
+      if( removed[tris[aa]] ) continue;
+      for( size_t bb=aa+1; bb<tris.size(); bb++ ) {
+        if( removed[tris[bb]] ) continue;
+        if( mesh.GetTriangleNormal(tris[aa]).dot( mesh.GetTriangleNormal(tris[bb]) ) < 0. ) {
+          removed[tris[aa]] = removed[tris[bb]] = true;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<G4int> kept;
+  for( G4int tt=0; tt<nTri; tt++ ) {
+    if( removed[tt] ) continue;
+    for( G4int cc=0; cc<3; cc++ )
+      kept.push_back( weldId[ mesh.triangles[3*tt+cc] ] );
+  }
+  G4int nRemoved = nTri - kept.size()/3;
+  mesh.triangles.swap(kept);
+  return nRemoved;
+}
+
+void AgataMeshMerger::MergeGroup( G4LogicalVolume* mother, std::vector<G4VPhysicalVolume*>& group )
+{
+  G4Material* material = group[0]->GetLogicalVolume()->GetMaterial();
+  G4String    name     = mother->GetName() + "_" + material->GetName() + "_merged";
+  G4VSolid*   solid    = NULL;
+
+  //> the fused mesh is kept only if it is a valid solid: closed and
+  //> 2-manifold once the shared faces are gone (touching along part of
+  //> a face, or along an edge, leaves open or non-manifold edges)
+  if( !Overlapping(group) ) {
+    AgataTriangleMesh merged;
+    for( size_t ii=0; ii<group.size(); ii++ ) {
+      AgataTriangleMesh piece( (G4TessellatedSolid*)group[ii]->GetLogicalVolume()->GetSolid() );
+      G4AffineTransform toMother( group[ii]->GetRotation(), group[ii]->GetTranslation() );
+      for( size_t vv=0; vv<piece.vertices.size(); vv++ )
+        piece.vertices[vv] = toMother.TransformPoint( piece.vertices[vv] );
+      merged.Append(piece);
+    }
+    G4int nInternal = RemoveInternalFaces(merged);
+    if( merged.IsClosedManifold() ) {
+      solid = merged.BuildSolid(name);
+      G4cout << " ---> " << name << ": " << group.size() << " meshes fused, "
+             << nInternal << " internal facets removed" << G4endl;
+    }
+    else
+      G4cout << " ---> " << name << ": the fused mesh would not be closed and manifold" << G4endl;
+  }
+  if( !solid ) {
+    G4MultiUnion* multi = new G4MultiUnion(name);
+    for( size_t ii=0; ii<group.size(); ii++ ) {
+      multi->AddNode( *group[ii]->GetLogicalVolume()->GetSolid(),
+                      G4Transform3D( group[ii]->GetObjectRotationValue(), group[ii]->GetObjectTranslation() ) );
+    }
+    multi->Voxelize();
+    solid = multi;
+    G4cout << " ---> " << name << ": " << group.size()
+           << " overlapping meshes, combined in a G4MultiUnion" << G4endl;
+  }
+
+  //> the merged volume keeps the importances and the files of the pieces
+  G4LogicalVolume* mergedLog = new G4LogicalVolume( solid, material, name );
+  for( size_t ii=0; ii<group.size(); ii++ ) {
+    G4cout << "      " << group[ii]->GetName() << " (" << group[ii]->GetLogicalVolume()->GetName()
+           << ") -> " << name << G4endl;
+    AgataImportanceBiasing::GetInstance()->AddReplacement( group[ii]->GetLogicalVolume(), mergedLog );
+    AgataVolumeProfiler::GetInstance()->AddReplacement( group[ii]->GetLogicalVolume(), mergedLog );
+    mother->RemoveDaughter( group[ii] );
+    delete group[ii];
+  }
+
+  new G4PVPlacement( NULL, G4ThreeVector(), mergedLog, name, mother, false, 0 );
+}
@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////
+/// Import option fusing the sibling CAD meshes of one material.
+/// The exports (MARA_Implant, galileoBGO_carter, LNL chamber) come
+/// as many small tessellated volumes under one mother: daughters
+/// made of the same material, without daughters or sensitive
+/// detector of their own, are replaced by
+///  - a single G4TessellatedSolid when the pieces do not overlap
+///    (no vertex inside another piece, no edge through one of its
+///    facets) and touch, if at all, only through shared vertices
+///    (welded within a tolerance); pairs of
+///    coincident facets with opposite orientation (the faces where
+///    two pieces touch) are removed, and the result is kept only if
+///    it is closed and 2-manifold;
+///  - a G4MultiUnion of the pieces otherwise.
+/// The mapping original -> merged volume is printed.
+///
+///   /Agata/geometry/merge/siblings  true (before /run/initialize)
+///   /Agata/geometry/merge/tolerance 1.e-6 mm
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataMeshMerger_h
+#define AgataMeshMerger_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4GenericMessenger;
+class AgataTriangleMesh;
+
+class AgataMeshMerger
+{
+  public:
+    static AgataMeshMerger* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataMeshMerger();
+
+  public:
+    ~AgataMeshMerger();
+
+  private:
+    static AgataMeshMerger* instance;
+
+  private:
+    G4bool              enabled;
+    G4double            tolerance;   //> for coincident vertices
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> merges the daughters of top and, recursively, of its descendants
+    void   Apply( G4LogicalVolume* top );
+
+  private:
+    G4int  MergeDaughters( G4LogicalVolume* mother );
+    void   MergeGroup    ( G4LogicalVolume* mother, std::vector<G4VPhysicalVolume*>& group );
+    G4bool Overlapping   ( std::vector<G4VPhysicalVolume*>& group );
+    //> an edge of edges crossing a facet of facets (inside box lo-hi)
+    G4bool Crossing      ( const AgataTriangleMesh& edges, const AgataTriangleMesh& facets,
+                           const G4ThreeVector& lo, const G4ThreeVector& hi ) const;
+    G4int  RemoveInternalFaces( AgataTriangleMesh& mesh );
+    //> cell of the welding grid containing point
+    std::vector<long long> WeldKey( const G4ThreeVector& point ) const;
+
+  public:
+    inline G4bool IsEnabled()              { return enabled; };
+    inline void   SetEnabled( G4bool val ) { enabled = val;  };
+    inline void   SetTolerance( G4double val ) { tolerance = val; };
+};
+
+#endif
@@ -0,0 +1,302 @@
+//////////////////////////////////////////////////////////////////
+/// Precomputed segment lookup (see AgataSegmentLookup.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataSegmentLookup.hh"
+
+#include "G4VSolid.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "Randomize.hh"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+std::map<std::pair<G4int,G4int>,AgataSegmentLookup*> AgataSegmentLookup::registry;
+std::vector<AgataSegmentLookup::LookupRequest>         AgataSegmentLookup::requests;
+std::vector<AgataSegmentLookup*>                       AgataSegmentLookup::owned;
+
+AgataSegmentLookup::AgataSegmentLookup( G4String name )
+{
+  theName  = name;
+  cellSize = 0.;
+  nCells[0] = nCells[1] = nCells[2] = 0;
+}
+
+AgataSegmentLookup::~AgataSegmentLookup()
+{}
+
+void AgataSegmentLookup::AddSegment( G4VSolid* solid, const G4AffineTransform& toSegment, G4int id )
+{
+  Segment seg;
+  seg.solid     = solid;
+  seg.toSegment = toSegment;
+  seg.id        = id;
+  segments.push_back(seg);
+}
+
+void AgataSegmentLookup::AddDaughters( G4LogicalVolume* detector )
+{
+  for( size_t ii=0; ii<detector->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = detector->GetDaughter(ii);
+    G4AffineTransform Td( daughter->GetRotation(), daughter->GetTranslation() );
+    AddSegment( daughter->GetLogicalVolume()->GetSolid(), Td.Inverse(), daughter->GetCopyNo() );
+  }
+}
+
+void AgataSegmentLookup::Build( G4double size )
+{
+  if( segments.empty() ) return;
+  cellSize = size;
+
+  //> bounding box of all the segments, in the detector frame
+  G4ThreeVector lMin( kInfinity, kInfinity, kInfinity ), lMax( -kInfinity, -kInfinity, -kInfinity );
+  for( size_t ss=0; ss<segments.size(); ss++ ) {
+    G4ThreeVector sMin, sMax;
+    segments[ss].solid->BoundingLimits( sMin, sMax );
+    G4AffineTransform toDetector = segments[ss].toSegment.Inverse();
+    for( G4int cc=0; cc<8; cc++ ) {
+      G4ThreeVector corner( (cc&1) ? sMax.x() : sMin.x(),
+                            (cc&2) ? sMax.y() : sMin.y(),
+                            (cc&4) ? sMax.z() : sMin.z() );
+      corner = toDetector.TransformPoint(corner);
+      lMin.set( std::min(lMin.x(),corner.x()), std::min(lMin.y(),corner.y()), std::min(lMin.z(),corner.z()) );
+      lMax.set( std::max(lMax.x(),corner.x()), std::max(lMax.y(),corner.y()), std::max(lMax.z(),corner.z()) );
+    }
+  }
+  for( G4int ax=0; ax<3; ax++ )
+    nCells[ax] = std::max( 1, (G4int)std::ceil( ( lMax[ax] - lMin[ax] ) / cellSize ) );
+  gridMin = lMin;
+
+  G4double halfDiagonal = 0.5 * std::sqrt(3.) * cellSize;
+  cells.assign( nCells[0]*nCells[1]*nCells[2], -1 );
+  interior.assign( segments.size(), G4ThreeVector( kInfinity, kInfinity, kInfinity ) );
+  listStart.clear();
+  listCount.clear();
+  candidates.clear();
+
+  G4int nPure = 0, nEmpty = 0, nMixed = 0;
+  std::vector<G4int> near;
+  for( G4int iz=0; iz<nCells[2]; iz++ ) {
+    for( G4int iy=0; iy<nCells[1]; iy++ ) {
+      for( G4int ix=0; ix<nCells[0]; ix++ ) {
+        G4ThreeVector centre = gridMin + cellSize * G4ThreeVector( ix+0.5, iy+0.5, iz+0.5 );
+        G4int index = ( iz*nCells[1] + iy )*nCells[0] + ix;
+        G4int inside = -1;
+        near.clear();
+        for( size_t ss=0; ss<segments.size(); ss++ ) {
+          G4ThreeVector local = segments[ss].toSegment.TransformPoint(centre);
+          EInside where = segments[ss].solid->Inside(local);
+          if( where == kInside && interior[ss].x() == kInfinity )
+            interior[ss] = centre;
+          if( where == kInside && segments[ss].solid->DistanceToOut(local) >= halfDiagonal ) {
+            inside = ss;
+            break;
+          }
+          if( where != kOutside || segments[ss].solid->DistanceToIn(local) < halfDiagonal )
+            near.push_back(ss);
+        }
+        if( inside >= 0 ) {
+          cells[index] = segments[inside].id;
+          nPure++;
+        }
+        else if( near.empty() ) {
+          cells[index] = -1;
+          nEmpty++;
+        }
+        else {
+          cells[index] = -2 - (G4int)listStart.size();
+          listStart.push_back( candidates.size() );
+          listCount.push_back( near.size() );
+          candidates.insert( candidates.end(), near.begin(), near.end() );
+          nMixed++;
+        }
+      }
+    }
+  }
+  G4cout << " ---> Segment lookup " << theName << ": " << nCells[0] << " x " << nCells[1] << " x "
+         << nCells[2] << " cells (" << nPure << " in one segment, " << nEmpty << " empty, "
+         << nMixed << " on boundaries)" << G4endl;
+}
+
+G4int AgataSegmentLookup::GetLocalSegment( const G4ThreeVector& local ) const
+{
+  G4ThreeVector rel = ( local - gridMin ) / cellSize;
+  G4int ix = (G4int)std::floor( rel.x() );
+  G4int iy = (G4int)std::floor( rel.y() );
+  G4int iz = (G4int)std::floor( rel.z() );
+  if( ix < 0 || iy < 0 || iz < 0 || ix >= nCells[0] || iy >= nCells[1] || iz >= nCells[2] )
+    return -1;
+
+  G4int value = cells[ ( iz*nCells[1] + iy )*nCells[0] + ix ];
+  if( value >= -1 ) return value;
+
+  //> boundary cell: exact test on the few candidates
+  G4int list = -2 - value;
+  for( G4int ii=0; ii<listCount[list]; ii++ ) {
+    const Segment& seg = segments[ candidates[ listStart[list] + ii ] ];
+    if( seg.solid->Inside( seg.toSegment.TransformPoint(local) ) != kOutside )
+      return seg.id;
+  }
+  return -1;
+}
+
+G4int AgataSegmentLookup::GetSegment( const G4ThreeVector& position ) const
+{
+  G4int id = GetLocalSegment( globalToLocal.TransformPoint(position) );
+  if( id < 0 || numbers.empty() ) return id;
+  return ( id < (G4int)numbers.size() ) ? numbers[id] : -1;
+}
+
+G4int AgataSegmentLookup::GetSegmentByGeometry( const G4ThreeVector& local ) const
+{
+  for( size_t ss=0; ss<segments.size(); ss++ ) {
+    if( segments[ss].solid->Inside( segments[ss].toSegment.TransformPoint(local) ) != kOutside )
+      return segments[ss].id;
+  }
+  return -1;
+}
+
+void AgataSegmentLookup::Benchmark( G4int nPoints )
+{
+  if( cells.empty() ) return;
+
+  std::vector<G4ThreeVector> points(nPoints);
+  G4ThreeVector extent = cellSize * G4ThreeVector( nCells[0], nCells[1], nCells[2] );
+  for( G4int ii=0; ii<nPoints; ii++ )
+    points[ii] = gridMin + G4ThreeVector( G4UniformRand()*extent.x(), G4UniformRand()*extent.y(),
+                                          G4UniformRand()*extent.z() );
+
+  std::vector<G4int> fromTable(nPoints), fromGeometry(nPoints);
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for( G4int ii=0; ii<nPoints; ii++ )
+    fromTable[ii] = GetLocalSegment(points[ii]);
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  for( G4int ii=0; ii<nPoints; ii++ )
+    fromGeometry[ii] = GetSegmentByGeometry(points[ii]);
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+  G4int nDiff = 0;
+  for( G4int ii=0; ii<nPoints; ii++ )
+    if( fromTable[ii] != fromGeometry[ii] ) nDiff++;
+
+  G4double tTable    = std::chrono::duration<G4double,std::nano>( t1 - t0 ).count() / nPoints;
+  G4double tGeometry = std::chrono::duration<G4double,std::nano>( t2 - t1 ).count() / nPoints;
+  G4cout << " ---> Segment lookup " << theName << ": " << tTable << " ns/point (table) vs "
+         << tGeometry << " ns/point (geometry), " << nDiff << " differences in "
+         << nPoints << " points" << G4endl;
+}
+
+////////////////////////////////////////////////////////////
+/// Registry
+////////////////////////////////////////////////////////////
+void AgataSegmentLookup::Register( G4int offset, G4int nDet, AgataSegmentLookup* lookup,
+                                   const G4AffineTransform& globalToLocal )
+{
+  lookup->globalToLocal = globalToLocal;
+  registry[ std::make_pair(offset,nDet) ] = lookup;
+}
+
+AgataSegmentLookup* AgataSegmentLookup::Find( G4int offset, G4int nDet )
+{
+  if( registry.empty() ) return NULL;
+  std::map<std::pair<G4int,G4int>,AgataSegmentLookup*>::const_iterator it =
+    registry.find( std::make_pair(offset,nDet) );
+  return ( it != registry.end() ) ? it->second : NULL;
+}
+
+void AgataSegmentLookup::RequestLookup( G4int offset, G4String segmentPrefix, G4double cellSize )
+{
+  LookupRequest request;
+  request.offset   = offset;
+  request.prefix   = segmentPrefix;
+  request.cellSize = cellSize;
+  requests.push_back(request);
+}
+
+//////////////////////////////////////////////////////////////
+/// A detector is a placement with daughters matching the prefix;
+/// its number is its copy number relative to the offset, as the
+/// ancillaries number their sensitive volumes
+//////////////////////////////////////////////////////////////
+void AgataSegmentLookup::FindDetectors( G4VPhysicalVolume* pv, const G4AffineTransform& toGlobal,
+                                        const LookupRequest& request,
+                                        std::vector< std::pair<G4VPhysicalVolume*,G4AffineTransform> >& found )
+{
+  G4LogicalVolume* lv = pv->GetLogicalVolume();
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ ) {
+    if( lv->GetDaughter(ii)->GetLogicalVolume()->GetName().find(request.prefix) == 0 ) {
+      found.push_back( std::make_pair( pv, toGlobal ) );
+      return;
+    }
+  }
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = lv->GetDaughter(ii);
+    if( daughter->IsReplicated() ) continue;
+    G4AffineTransform Td( daughter->GetRotation(), daughter->GetTranslation() );
+    FindDetectors( daughter, Td * toGlobal, request, found );
+  }
+}
+
+void AgataSegmentLookup::SetNumbering( G4int offset, G4int nDet, Numbering& numbering )
+{
+  G4AffineTransform toGlobal = globalToLocal.Inverse();
+  numbers.assign( segments.size(), -1 );
+  for( size_t ss=0; ss<segments.size(); ss++ ) {
+    if( interior[ss].x() == kInfinity ) continue;  //> thinner than a cell: left to the ancillary
+    numbers[segments[ss].id] = numbering( offset, nDet, toGlobal.TransformPoint(interior[ss]) );
+  }
+}
+
+G4int AgataSegmentLookup::BuildRequested( G4VPhysicalVolume* world, Numbering numbering )
+{
+  G4int nBuilt = 0;
+  if( !world ) return nBuilt;
+  for( size_t rr=0; rr<requests.size(); rr++ ) {
+    const LookupRequest& request = requests[rr];
+    std::vector< std::pair<G4VPhysicalVolume*,G4AffineTransform> > found;
+    FindDetectors( world, G4AffineTransform(), request, found );
+
+    //> one table per detector shape, copied for its other placements
+    std::map<G4LogicalVolume*,AgataSegmentLookup*> built;
+    for( size_t ii=0; ii<found.size(); ii++ ) {
+      G4LogicalVolume* detector = found[ii].first->GetLogicalVolume();
+      AgataSegmentLookup* lookup = NULL;
+      if( built.count(detector) ) {
+        lookup = new AgataSegmentLookup( *built[detector] );
+      }
+      else {
+        lookup = new AgataSegmentLookup( detector->GetName() );
+        for( size_t jj=0; jj<detector->GetNoDaughters(); jj++ ) {
+          G4VPhysicalVolume* daughter = detector->GetDaughter(jj);
+          if( daughter->GetLogicalVolume()->GetName().find(request.prefix) != 0 ) continue;
+          //> the copy numbers of the CAD segments are not unique: use the index
+          G4AffineTransform Td( daughter->GetRotation(), daughter->GetTranslation() );
+          lookup->AddSegment( daughter->GetLogicalVolume()->GetSolid(), Td.Inverse(), lookup->segments.size() );
+        }
+        lookup->Build( request.cellSize );
+        built[detector] = lookup;
+      }
+      owned.push_back(lookup);
+
+      G4int copyNo = found[ii].first->GetCopyNo();
+      G4int nDet   = ( copyNo >= request.offset ) ? copyNo - request.offset : copyNo;
+      Register( request.offset, nDet, lookup, found[ii].second.Inverse() );
+      lookup->SetNumbering( request.offset, nDet, numbering );
+      nBuilt++;
+    }
+    G4cout << " ---> Segment lookup: " << found.size() << " detectors with " << request.prefix
+           << "* segments at offset " << request.offset << G4endl;
+  }
+  return nBuilt;
+}
+
+void AgataSegmentLookup::Clear()
+{
+  for( size_t ii=0; ii<owned.size(); ii++ )
+    delete owned[ii];
+  owned.clear();
+  registry.clear();
+  requests.clear();
+}
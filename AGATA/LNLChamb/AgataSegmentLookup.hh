@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////
+/// Precomputed position -> segment lookup for segmented ancillary
+/// detectors described by several segment volumes (e.g. the SPIDER
+/// trapezoidal Si, GALILEO/Spider/spider_segments.gdml).
+/// The bounding box of the detector is divided in cells, in the
+/// local frame of the detector. A cell lying entirely in one
+/// segment (or in none) stores the answer directly; this is decided
+/// exactly from the safety distances at the centre of the cell.
+/// The other cells (crossed by a segment boundary) keep the short
+/// list of candidate segments, tested with Inside() as fallback.
+///
+/// Lookups are registered per (offset, detector) and used by
+/// AgataDetectorAncillary::GetSegmentNumber() before asking the
+/// ancillary. An ancillary requests them with RequestLookup() when
+/// it is created; once everything is placed, BuildRequested() finds
+/// the placements of its detectors and numbers their segments as
+/// the ancillary itself does (its GetSegmentNumber() is called once
+/// at a point inside each segment). Points the table cannot decide
+/// are still given to the ancillary.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataSegmentLookup_h
+#define AgataSegmentLookup_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+#include "G4AffineTransform.hh"
+
+#include <vector>
+#include <map>
+#include <functional>
+
+class G4VSolid;
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+
+class AgataSegmentLookup
+{
+  public:
+    AgataSegmentLookup( G4String name );
+    ~AgataSegmentLookup();
+
+  private:
+    struct Segment
+    {
+      G4VSolid*         solid;
+      G4AffineTransform toSegment;  //> detector frame -> segment frame
+      G4int             id;
+    };
+
+    //> segments of the detectors of one ancillary: the daughters
+    //> whose logical volume name starts with prefix
+    struct LookupRequest
+    {
+      G4int    offset;
+      G4String prefix;
+      G4double cellSize;
+    };
+
+  public:
+    //> numbering of the ancillary: (offset, detector, global position) -> segment
+    typedef std::function<G4int( G4int, G4int, const G4ThreeVector& )> Numbering;
+
+  private:
+    G4String             theName;
+    std::vector<Segment> segments;
+    std::vector<G4ThreeVector> interior;   //> a point inside each segment (local frame)
+    std::vector<G4int>   numbers;    //> segment id -> number given by the ancillary
+    G4AffineTransform    globalToLocal;
+    G4ThreeVector        gridMin;
+    G4double             cellSize;
+    G4int                nCells[3];
+    std::vector<G4int>   cells;      //> >=0 segment id, -1 none, <=-2 candidate list -(2+n)
+    std::vector<G4int>   listStart;
+    std::vector<G4int>   listCount;
+    std::vector<G4int>   candidates; //> indices in segments
+
+  private:
+    static std::map<std::pair<G4int,G4int>,AgataSegmentLookup*> registry;
+    static std::vector<LookupRequest>                           requests;
+    static std::vector<AgataSegmentLookup*>                     owned;
+
+  public:
+    void  AddSegment( G4VSolid* solid, const G4AffineTransform& toSegment, G4int id );
+    //> all the daughters of detector are segments, numbered by their copy number
+    void  AddDaughters( G4LogicalVolume* detector );
+    void  Build( G4double size );
+
+  public:
+    //> position in the frame of the detector
+    G4int GetLocalSegment  ( const G4ThreeVector& local ) const;
+    //> global position, with the transformation given at registration,
+    //> in the numbering of the ancillary when one was set (-1 if unknown)
+    G4int GetSegment       ( const G4ThreeVector& position ) const;
+    //> reference: Inside() on all the segments
+    G4int GetSegmentByGeometry( const G4ThreeVector& local ) const;
+
+  public:
+    //> times both methods on random points and checks they agree
+    void  Benchmark( G4int nPoints );
+
+  public:
+    static void                Register( G4int offset, G4int nDet, AgataSegmentLookup* lookup,
+                                         const G4AffineTransform& globalToLocal );
+    static AgataSegmentLookup* Find    ( G4int offset, G4int nDet );
+
+  public:
+    static void  RequestLookup ( G4int offset, G4String segmentPrefix, G4double cellSize = 1.*mm );
+    //> builds and registers the requested lookups, returns their number
+    static G4int BuildRequested( G4VPhysicalVolume* world, Numbering numbering );
+    //> deletes the lookups built by BuildRequested() and forgets all the registrations
+    static void  Clear();
+
+  private:
+    void  SetNumbering( G4int offset, G4int nDet, Numbering& numbering );
+    static void FindDetectors( G4VPhysicalVolume* pv, const G4AffineTransform& toGlobal,
+                               const LookupRequest& request,
+                               std::vector< std::pair<G4VPhysicalVolume*,G4AffineTransform> >& found );
+};
+
+#endif
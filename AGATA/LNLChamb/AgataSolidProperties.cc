@@ -0,0 +1,397 @@
+//////////////////////////////////////////////////////////////////
+/// Exact (or reproducible) volume, centroid and inertia of solids
+/// (see AgataSolidProperties.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataSolidProperties.hh"
+#include "AgataTriangleMesh.hh"
+
+#include "G4VSolid.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4DisplacedSolid.hh"
+#include "G4BooleanSolid.hh"
+#include "G4UnionSolid.hh"
+#include "G4SubtractionSolid.hh"
+#include "G4MultiUnion.hh"
+#include "G4Box.hh"
+#include "G4Tubs.hh"
+#include "G4Orb.hh"
+#include "G4Sphere.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4Material.hh"
+#include "G4UnitsTable.hh"
+#include "Randomize.hh"
+
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+AgataSolidProperties* AgataSolidProperties::instance = NULL;
+
+AgataSolidProperties* AgataSolidProperties::GetInstance()
+{
+  if( !instance )
+    instance = new AgataSolidProperties();
+  return instance;
+}
+
+void AgataSolidProperties::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataSolidProperties::AgataSolidProperties()
+{
+  nStrata = 50;
+}
+
+AgataSolidProperties::~AgataSolidProperties()
+{}
+
+//////////////////////////////////////////////////////////////
+/// Tessellated solids are keyed on their facets as they are (a
+/// lookup does not build the mesh), everything else on the
+/// parameters printed by StreamInfo()
+//////////////////////////////////////////////////////////////
+uint64_t AgataSolidProperties::HashOf( G4VSolid* solid )
+{
+  uint64_t hash;
+  G4TessellatedSolid* tess = dynamic_cast<G4TessellatedSolid*>(solid);
+  if( tess ) {
+    hash = AgataTriangleMesh::Hash(tess);
+  }
+  else {
+    std::ostringstream info;
+    info << std::setprecision(17);
+    solid->StreamInfo(info);
+    G4String text = info.str();
+    hash = AgataHashBytes( text.data(), text.size() );
+  }
+  return hash;
+}
+
+namespace {
+  //> I = tr(C) 1 - C for the second moments C about the centroid
+  void InertiaFromMoments( const G4double central[3][3], G4double inertia[3][3] )
+  {
+    G4double trace = central[0][0] + central[1][1] + central[2][2];
+    for( G4int ii=0; ii<3; ii++ )
+      for( G4int jj=0; jj<3; jj++ )
+        inertia[ii][jj] = ( ii == jj ? trace : 0. ) - central[ii][jj];
+  }
+
+  //> solid of revolution about z, centred on the origin
+  AgataSolidInfo Axial( G4double volume, G4double ixx, G4double izz )
+  {
+    AgataSolidInfo info;
+    info.volume = volume;
+    for( G4int ii=0; ii<3; ii++ )
+      for( G4int jj=0; jj<3; jj++ )
+        info.inertia[ii][jj] = 0.;
+    info.inertia[0][0] = info.inertia[1][1] = ixx;
+    info.inertia[2][2] = izz;
+    info.exact = info.exactVolume = true;
+    return info;
+  }
+
+  //> parallel axis theorem: adds the body (info) to the sum, about centre
+  void AddAbout( const AgataSolidInfo& info, const G4ThreeVector& centre, G4double inertia[3][3] )
+  {
+    G4ThreeVector dd = info.centroid - centre;
+    for( G4int ii=0; ii<3; ii++ )
+      for( G4int jj=0; jj<3; jj++ )
+        inertia[ii][jj] += info.inertia[ii][jj] +
+          info.volume * ( ( ii == jj ? dd.mag2() : 0. ) - dd[ii]*dd[jj] );
+  }
+
+  G4bool DisjointExtents( const G4VSolid* aa, const G4VSolid* bb )
+  {
+    G4ThreeVector aMin, aMax, bMin, bMax;
+    aa->BoundingLimits( aMin, aMax );
+    bb->BoundingLimits( bMin, bMax );
+    for( G4int ii=0; ii<3; ii++ )
+      if( aMax[ii] <= bMin[ii] || bMax[ii] <= aMin[ii] ) return true;
+    return false;
+  }
+}
+
+const AgataSolidInfo& AgataSolidProperties::GetInfo( G4VSolid* solid )
+{
+  uint64_t hash = HashOf(solid);
+  std::map<uint64_t,AgataSolidInfo>::iterator it = cache.find(hash);
+  if( it != cache.end() ) return it->second;
+  cache[hash] = Compute(solid);
+  return cache[hash];
+}
+
+//////////////////////////////////////////////////////////////
+/// Divergence theorem: each triangle (a,b,c) closes a tetrahedron
+/// with the origin, of signed volume a.(bxc)/6; the second moments
+/// of such a tetrahedron are det/120 * ( sum_k v_k v_k^T + s s^T )
+/// with s = a+b+c. Only needs a closed, consistently oriented mesh.
+//////////////////////////////////////////////////////////////
+AgataSolidInfo AgataSolidProperties::FromMesh( const AgataTriangleMesh& mesh )
+{
+  AgataSolidInfo info;
+  G4double volume = 0.;
+  G4ThreeVector first;
+  G4double second[3][3] = { {0.,0.,0.}, {0.,0.,0.}, {0.,0.,0.} };
+
+  for( G4int tt=0; tt<mesh.GetNumberOfTriangles(); tt++ ) {
+    const G4ThreeVector& a = mesh.GetVertex(tt,0);
+    const G4ThreeVector& b = mesh.GetVertex(tt,1);
+    const G4ThreeVector& c = mesh.GetVertex(tt,2);
+    G4double det = a.dot( b.cross(c) );
+    G4ThreeVector s = a + b + c;
+
+    volume += det / 6.;
+    first  += det / 24. * s;
+    for( G4int ii=0; ii<3; ii++ ) {
+      for( G4int jj=0; jj<3; jj++ ) {
+        second[ii][jj] += det / 120. *
+          ( a[ii]*a[jj] + b[ii]*b[jj] + c[ii]*c[jj] + s[ii]*s[jj] );
+      }
+    }
+  }
+
+  info.volume   = volume;
+  info.centroid    = ( volume != 0. ) ? first / volume : G4ThreeVector();
+  info.exact       = true;
+  info.exactVolume = true;
+
+  //> move to the centroid, then I = tr(C) 1 - C
+  G4double central[3][3];
+  for( G4int ii=0; ii<3; ii++ )
+    for( G4int jj=0; jj<3; jj++ )
+      central[ii][jj] = second[ii][jj] - volume * info.centroid[ii] * info.centroid[jj];
+  InertiaFromMoments( central, info.inertia );
+
+  return info;
+}
+
+AgataSolidInfo AgataSolidProperties::Compute( G4VSolid* solid )
+{
+  G4TessellatedSolid* tess = dynamic_cast<G4TessellatedSolid*>(solid);
+  if( tess ) {
+    return FromMesh( AgataTriangleMesh(tess) );
+  }
+
+  G4DisplacedSolid* disp = dynamic_cast<G4DisplacedSolid*>(solid);
+  if( disp ) {
+    AgataSolidInfo info = GetInfo( disp->GetConstituentMovedSolid() );
+
+    G4AffineTransform direct = disp->GetDirectTransform();
+    G4double rot[3][3];
+    for( G4int jj=0; jj<3; jj++ ) {
+      G4ThreeVector axis = direct.TransformAxis( G4ThreeVector( jj==0, jj==1, jj==2 ) );
+      for( G4int ii=0; ii<3; ii++ ) rot[ii][jj] = axis[ii];
+    }
+    AgataSolidInfo moved = info;
+    moved.centroid = direct.TransformPoint( info.centroid );
+    for( G4int ii=0; ii<3; ii++ ) {
+      for( G4int jj=0; jj<3; jj++ ) {
+        G4double sum = 0.;
+        for( G4int kk=0; kk<3; kk++ )
+          for( G4int ll=0; ll<3; ll++ )
+            sum += rot[ii][kk] * info.inertia[kk][ll] * rot[jj][ll];
+        moved.inertia[ii][jj] = sum;
+      }
+    }
+    return moved;
+  }
+
+  if( dynamic_cast<G4BooleanSolid*>(solid) ) {
+    return Combined(solid);
+  }
+  //> G4MultiUnion only has a Monte-Carlo GetCubicVolume()
+  if( dynamic_cast<G4MultiUnion*>(solid) ) {
+    return Stratified( solid, nStrata );
+  }
+  return Primitive(solid);
+}
+
+//////////////////////////////////////////////////////////////
+/// Formulas for the common primitives; the other ones have an
+/// analytic GetCubicVolume(), their centroid and inertia are
+/// sampled on a coarse grid and flagged as such
+//////////////////////////////////////////////////////////////
+AgataSolidInfo AgataSolidProperties::Primitive( G4VSolid* solid )
+{
+  G4Box* box = dynamic_cast<G4Box*>(solid);
+  if( box ) {
+    G4double dx2 = std::pow( box->GetXHalfLength(), 2 );
+    G4double dy2 = std::pow( box->GetYHalfLength(), 2 );
+    G4double dz2 = std::pow( box->GetZHalfLength(), 2 );
+    G4double volume = 8. * box->GetXHalfLength() * box->GetYHalfLength() * box->GetZHalfLength();
+    AgataSolidInfo info = Axial( volume, volume/3. * ( dy2 + dz2 ), volume/3. * ( dx2 + dy2 ) );
+    info.inertia[1][1] = volume/3. * ( dx2 + dz2 );
+    return info;
+  }
+
+  G4Tubs* tubs = dynamic_cast<G4Tubs*>(solid);
+  if( tubs && tubs->GetDeltaPhiAngle() >= CLHEP::twopi ) {
+    G4double r2 = std::pow( tubs->GetInnerRadius(), 2 ) + std::pow( tubs->GetOuterRadius(), 2 );
+    G4double dz = tubs->GetZHalfLength();
+    G4double volume = CLHEP::pi * ( std::pow( tubs->GetOuterRadius(), 2 ) -
+                                    std::pow( tubs->GetInnerRadius(), 2 ) ) * 2. * dz;
+    return Axial( volume, volume * ( r2/4. + dz*dz/3. ), volume * r2/2. );
+  }
+
+  G4Orb* orb = dynamic_cast<G4Orb*>(solid);
+  if( orb ) {
+    G4double rr = orb->GetRadius();
+    G4double volume = 4./3. * CLHEP::pi * rr*rr*rr;
+    return Axial( volume, 0.4 * volume * rr*rr, 0.4 * volume * rr*rr );
+  }
+
+  G4Sphere* sphere = dynamic_cast<G4Sphere*>(solid);
+  if( sphere && sphere->GetDeltaPhiAngle() >= CLHEP::twopi && sphere->GetDeltaThetaAngle() >= CLHEP::pi ) {
+    G4double r1 = sphere->GetInnerRadius(), r2 = sphere->GetOuterRadius();
+    G4double volume = 4./3. * CLHEP::pi * ( std::pow(r2,3) - std::pow(r1,3) );
+    G4double ii = ( volume > 0. ) ?
+      0.4 * volume * ( std::pow(r2,5) - std::pow(r1,5) ) / ( std::pow(r2,3) - std::pow(r1,3) ) : 0.;
+    return Axial( volume, ii, ii );
+  }
+
+  //> the sampled inertia is scaled to the analytic volume, so that
+  //> both describe the same body
+  AgataSolidInfo info = Stratified( solid, std::max( nStrata/4, 10 ) );
+  G4double volume = solid->GetCubicVolume();
+  G4double scale  = ( info.volume > 0. ) ? volume / info.volume : 0.;
+  for( G4int ii=0; ii<3; ii++ )
+    for( G4int jj=0; jj<3; jj++ )
+      info.inertia[ii][jj] *= scale;
+  info.volume      = volume;
+  info.exactVolume = true;
+  return info;
+}
+
+//////////////////////////////////////////////////////////////
+/// Operands with disjoint extents: the union is the sum of the
+/// two, the subtraction is the first one. Anything else (and
+/// intersections) is sampled.
+//////////////////////////////////////////////////////////////
+AgataSolidInfo AgataSolidProperties::Combined( G4VSolid* solid )
+{
+  G4VSolid* first  = solid->GetConstituentSolid(0);
+  G4VSolid* second = solid->GetConstituentSolid(1);
+  if( !first || !second || !DisjointExtents( first, second ) )
+    return Stratified( solid, nStrata );
+
+  if( dynamic_cast<G4SubtractionSolid*>(solid) )
+    return GetInfo(first);
+  if( !dynamic_cast<G4UnionSolid*>(solid) )
+    return Stratified( solid, nStrata );
+
+  AgataSolidInfo aa = GetInfo(first);
+  AgataSolidInfo bb = GetInfo(second);
+  AgataSolidInfo info;
+  info.volume      = aa.volume + bb.volume;
+  info.centroid    = ( info.volume > 0. ) ?
+    ( aa.volume * aa.centroid + bb.volume * bb.centroid ) / info.volume : G4ThreeVector();
+  info.exact       = aa.exact && bb.exact;
+  info.exactVolume = aa.exactVolume && bb.exactVolume;
+  for( G4int ii=0; ii<3; ii++ )
+    for( G4int jj=0; jj<3; jj++ )
+      info.inertia[ii][jj] = 0.;
+  AddAbout( aa, info.centroid, info.inertia );
+  AddAbout( bb, info.centroid, info.inertia );
+  return info;
+}
+
+//////////////////////////////////////////////////////////////
+/// One jittered point per cell of an nStrata^3 grid over the
+/// bounding box. The engine is private and always seeded the same
+/// way, so the result does not depend on the run seed.
+//////////////////////////////////////////////////////////////
+AgataSolidInfo AgataSolidProperties::Stratified( G4VSolid* solid, G4int nPerAxis )
+{
+  AgataSolidInfo info;
+  G4ThreeVector pMin, pMax;
+  solid->BoundingLimits( pMin, pMax );
+  G4ThreeVector cell = ( pMax - pMin ) / nPerAxis;
+  G4double cellVolume = cell.x() * cell.y() * cell.z();
+
+  CLHEP::MixMaxRng engine(20200713);
+
+  G4double weight = 0.;
+  G4ThreeVector first;
+  G4double second[3][3] = { {0.,0.,0.}, {0.,0.,0.}, {0.,0.,0.} };
+
+  for( G4int ix=0; ix<nPerAxis; ix++ ) {
+    for( G4int iy=0; iy<nPerAxis; iy++ ) {
+      for( G4int iz=0; iz<nPerAxis; iz++ ) {
+        G4ThreeVector point( pMin.x() + ( ix + engine.flat() ) * cell.x(),
+                             pMin.y() + ( iy + engine.flat() ) * cell.y(),
+                             pMin.z() + ( iz + engine.flat() ) * cell.z() );
+        EInside where = solid->Inside(point);
+        if( where == kOutside ) continue;
+        G4double ww = ( where == kInside ) ? 1. : 0.5;
+        weight += ww;
+        first  += ww * point;
+        for( G4int ii=0; ii<3; ii++ )
+          for( G4int jj=0; jj<3; jj++ )
+            second[ii][jj] += ww * point[ii] * point[jj];
+      }
+    }
+  }
+
+  info.volume   = weight * cellVolume;
+  info.centroid    = ( weight > 0. ) ? first / weight : G4ThreeVector();
+  info.exact       = false;
+  info.exactVolume = false;
+
+  G4double central[3][3];
+  for( G4int ii=0; ii<3; ii++ )
+    for( G4int jj=0; jj<3; jj++ )
+      central[ii][jj] = ( weight > 0. ) ?
+        cellVolume * ( second[ii][jj] - weight * info.centroid[ii] * info.centroid[jj] ) : 0.;
+  InertiaFromMoments( central, info.inertia );
+
+  return info;
+}
+
+////////////////////////////////////////////////////////////
+/// Mass report
+////////////////////////////////////////////////////////////
+void AgataSolidProperties::PrintMassReport( G4LogicalVolume* top )
+{
+  G4cout << " ---> Mass report for " << top->GetName()
+         << " (own mass = solid minus daughters; * = sampled volume)" << G4endl;
+  std::map<const G4VSolid*,const AgataSolidInfo*> known;
+  G4double total = MassReport( top, 0, known );
+  G4cout << " ---> Total mass: " << G4BestUnit(total,"Mass") << G4endl;
+}
+
+G4double AgataSolidProperties::MassReport( G4LogicalVolume* lv, G4int depth,
+                                           std::map<const G4VSolid*,const AgataSolidInfo*>& known )
+{
+  if( !known.count( lv->GetSolid() ) ) known[lv->GetSolid()] = &GetInfo( lv->GetSolid() );
+  const AgataSolidInfo& info = *known[lv->GetSolid()];
+  G4double ownVolume = info.volume;
+  G4bool   exact     = info.exactVolume;
+
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ ) {
+    G4VSolid* dSolid = lv->GetDaughter(ii)->GetLogicalVolume()->GetSolid();
+    if( !known.count(dSolid) ) known[dSolid] = &GetInfo(dSolid);
+    ownVolume -= lv->GetDaughter(ii)->GetMultiplicity() * known[dSolid]->volume;
+    exact = exact && known[dSolid]->exactVolume;
+  }
+
+  G4double density = lv->GetMaterial()->GetDensity();
+  G4double ownMass = ownVolume * density;
+
+  G4cout << std::setw(2*depth+2) << " " << lv->GetName() << ( exact ? " " : "* " )
+         << lv->GetMaterial()->GetName() << "  V = " << G4BestUnit(ownVolume,"Volume")
+         << "  m = " << G4BestUnit(ownMass,"Mass") << G4endl;
+
+  G4double totMass = ownMass;
+  for( size_t ii=0; ii<lv->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = lv->GetDaughter(ii);
+    totMass += daughter->GetMultiplicity() * MassReport( daughter->GetLogicalVolume(), depth+1, known );
+  }
+  return totMass;
+}
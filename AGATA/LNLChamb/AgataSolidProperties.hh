@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////
+/// Volume, centroid and inertia of the solids used by the
+/// ancillaries, replacing the Monte-Carlo estimate done by
+/// G4VSolid::GetCubicVolume() for tessellated and Boolean solids:
+///  - tessellated solids: exact, by the divergence theorem
+///    (sum of signed tetrahedra facet/origin)
+///  - G4Box, full G4Tubs, G4Orb, full G4Sphere: exact formulas
+///  - other CSG solids: their own analytic GetCubicVolume(), with
+///    centroid and inertia from a coarse sampling (not exact)
+///  - displaced solids: exact when the constituent is
+///  - union and subtraction of operands with disjoint extents:
+///    combined from the operands
+///  - other Boolean solids: stratified sampling of the bounding
+///    box with a fixed seed, i.e. reproducible from run to run
+/// Results are cached by a hash of the solid description, so a
+/// solid deleted and reallocated cannot pick up a stale entry.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataSolidProperties_h
+#define AgataSolidProperties_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <map>
+#include <stdint.h>
+
+class G4VSolid;
+class G4LogicalVolume;
+class AgataTriangleMesh;
+
+struct AgataSolidInfo
+{
+  G4double      volume;
+  G4ThreeVector centroid;
+  G4double      inertia[3][3];  //> per unit density, about the centroid
+  G4bool        exact;          //> volume, centroid and inertia
+  G4bool        exactVolume;
+};
+
+class AgataSolidProperties
+{
+  public:
+    static AgataSolidProperties* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataSolidProperties();
+
+  public:
+    ~AgataSolidProperties();
+
+  private:
+    static AgataSolidProperties* instance;
+
+  private:
+    std::map<uint64_t,AgataSolidInfo>        cache;
+    G4int                                    nStrata;  //> per axis, for Boolean solids
+
+  public:
+    const AgataSolidInfo& GetInfo     ( G4VSolid* solid );
+    G4double              GetVolume   ( G4VSolid* solid ) { return GetInfo(solid).volume; };
+
+  public:
+    static AgataSolidInfo FromMesh    ( const AgataTriangleMesh& mesh );
+
+  private:
+    uint64_t              HashOf      ( G4VSolid* solid );
+    AgataSolidInfo        Compute     ( G4VSolid* solid );
+    AgataSolidInfo        Primitive   ( G4VSolid* solid );
+    AgataSolidInfo        Combined    ( G4VSolid* solid );
+    AgataSolidInfo        Stratified  ( G4VSolid* solid, G4int nPerAxis );
+
+  public:
+    //> mass of each logical volume in the tree (own and with daughters)
+    void                  PrintMassReport( G4LogicalVolume* top );
+
+  private:
+    //> infos keyed by pointer: only valid during one report
+    G4double              MassReport  ( G4LogicalVolume* lv, G4int depth,
+                                        std::map<const G4VSolid*,const AgataSolidInfo*>& known );
+
+  public:
+    inline void           SetNumberOfStrata( G4int num ) { nStrata = num; cache.clear(); };
+};
+
+#endif
@@ -0,0 +1,344 @@
+//////////////////////////////////////////////////////////////////
+/// Alias-table surface sampling of tessellated solids
+/// (see AgataSurfaceSampler.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataSurfaceSampler.hh"
+#include "AgataTriangleMesh.hh"
+
+#include "G4VSolid.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4AffineTransform.hh"
+#include "G4TransportationManager.hh"
+#include "G4GenericMessenger.hh"
+#include "G4UnitsTable.hh"
+#include "Randomize.hh"
+
+G4ThreadLocal AgataSurfaceSampler* AgataSurfaceSampler::instance = NULL;
+
+AgataSurfaceSampler* AgataSurfaceSampler::GetInstance()
+{
+  if( !instance )
+    instance = new AgataSurfaceSampler();
+  return instance;
+}
+
+void AgataSurfaceSampler::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataSurfaceSampler::AgataSurfaceSampler()
+{
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/overlaps/", "Fast overlap checks" );
+  myMessenger->DeclareMethod( "check", &AgataSurfaceSampler::CheckAllOverlaps,
+                              "Checks the whole geometry for overlaps (surface points per volume)" )
+    .SetParameterName( "nPoints", true )
+    .SetDefaultValue( "10000" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataSurfaceSampler::~AgataSurfaceSampler()
+{
+  std::map<const G4VSolid*,AliasTable*>::iterator it;
+  for( it=tables.begin(); it!=tables.end(); ++it )
+    delete it->second;
+  tables.clear();
+  delete myMessenger;
+}
+
+void AgataSurfaceSampler::Forget( const G4VSolid* solid )
+{
+  if( !instance ) return;
+  std::map<const G4VSolid*,AliasTable*>::iterator it = instance->tables.find(solid);
+  if( it == instance->tables.end() ) return;
+  delete it->second;
+  instance->tables.erase(it);
+}
+
+AgataSurfaceSampler::AliasTable* AgataSurfaceSampler::GetTable( const G4VSolid* solid )
+{
+  std::map<const G4VSolid*,AliasTable*>::iterator it = tables.find(solid);
+  if( it != tables.end() ) return it->second;
+
+  AliasTable* table = NULL;
+  const G4TessellatedSolid* tess = dynamic_cast<const G4TessellatedSolid*>(solid);
+  if( tess && tess->GetNumberOfFacets() > 0 )
+    table = BuildTable(tess);
+  tables[solid] = table;
+  return table;
+}
+
+AgataSurfaceSampler::AliasTable* AgataSurfaceSampler::BuildTable( const G4TessellatedSolid* solid )
+{
+  AliasTable* table = new AliasTable;
+  AgataTriangleMesh mesh(solid);
+  FillTable( mesh, table->block );
+  //> no table for a mesh without area (FillTable leaves nTri at 0): the
+  //> normalisation would divide by zero, and there is no surface anyway
+  const G4double* data = (const G4double*)&table->block[0];
+  if( data[0] < 1. ) {
+    G4cout << " ---> AgataSurfaceSampler: " << solid->GetName()
+           << " has no surface area, using G4VSolid::GetPointOnSurface()" << G4endl;
+    delete table;
+    return NULL;
+  }
+
+  table->nTri        = (G4int)data[0];
+  table->area        = data[1];
+  table->corners     = data + 2;
+  table->probability = table->corners + 9*table->nTri;
+  table->alias       = (const int32_t*)( table->probability + table->nTri );
+  return table;
+}
+
+//////////////////////////////////////////////////////////////
+/// Vose's construction of the alias table: O(N) in the number
+/// of triangles
+//////////////////////////////////////////////////////////////
+void AgataSurfaceSampler::FillTable( const AgataTriangleMesh& mesh, std::vector<char>& data )
+{
+  G4int nTri = mesh.GetNumberOfTriangles();
+  data.assign( (2 + 10*nTri)*sizeof(G4double) + nTri*sizeof(int32_t), 0 );
+
+  G4double* header      = (G4double*)&data[0];
+  G4double* corners     = header + 2;
+  G4double* probability = corners + 9*nTri;
+  int32_t*  alias       = (int32_t*)( probability + nTri );
+
+  G4double area = 0.;
+  std::vector<G4double> scaled(nTri);
+  for( G4int ii=0; ii<nTri; ii++ ) {
+    const G4ThreeVector& a = mesh.GetVertex(ii,0);
+    G4ThreeVector edge[3] = { a, mesh.GetVertex(ii,1) - a, mesh.GetVertex(ii,2) - a };
+    for( G4int cc=0; cc<3; cc++ ) {
+      corners[9*ii+3*cc]   = edge[cc].x();
+      corners[9*ii+3*cc+1] = edge[cc].y();
+      corners[9*ii+3*cc+2] = edge[cc].z();
+    }
+    scaled[ii] = mesh.GetTriangleArea(ii);
+    area      += scaled[ii];
+  }
+  header[0] = nTri;
+  header[1] = area;
+  if( !( area > 0. ) ) {
+    header[0] = 0;
+    return;
+  }
+  for( G4int ii=0; ii<nTri; ii++ )
+    scaled[ii] *= nTri / area;
+
+  std::vector<G4int> small, large;
+  for( G4int ii=0; ii<nTri; ii++ ) {
+    if( scaled[ii] < 1. ) small.push_back(ii);
+    else                  large.push_back(ii);
+  }
+  while( !small.empty() && !large.empty() ) {
+    G4int ss = small.back(); small.pop_back();
+    G4int ll = large.back();
+    probability[ss] = scaled[ss];
+    alias      [ss] = ll;
+    scaled[ll] -= 1. - scaled[ss];
+    if( scaled[ll] < 1. ) {
+      large.pop_back();
+      small.push_back(ll);
+    }
+  }
+  //> what is left has probability one (up to rounding)
+  for( size_t ii=0; ii<large.size(); ii++ ) {
+    probability[large[ii]] = 1.;
+    alias      [large[ii]] = large[ii];
+  }
+  for( size_t ii=0; ii<small.size(); ii++ ) {
+    probability[small[ii]] = 1.;
+    alias      [small[ii]] = small[ii];
+  }
+}
+
+G4ThreeVector AgataSurfaceSampler::Sample( const AliasTable* table )
+{
+  G4int nTri = table->nTri;
+  G4double uu = G4UniformRand() * nTri;
+  G4int tri = (G4int)uu;
+  if( tri >= nTri ) tri = nTri - 1;
+  if( uu - tri >= table->probability[tri] )
+    tri = table->alias[tri];
+
+  G4double r1 = G4UniformRand();
+  G4double r2 = G4UniformRand();
+  if( r1 + r2 > 1. ) {
+    r1 = 1. - r1;
+    r2 = 1. - r2;
+  }
+  const G4double* cc = table->corners + 9*tri;
+  return G4ThreeVector( cc[0] + r1*cc[3] + r2*cc[6],
+                        cc[1] + r1*cc[4] + r2*cc[7],
+                        cc[2] + r1*cc[5] + r2*cc[8] );
+}
+
+G4ThreeVector AgataSurfaceSampler::GetPointOnSurface( const G4VSolid* solid )
+{
+  AliasTable* table = GetTable(solid);
+  if( !table ) return solid->GetPointOnSurface();
+  return Sample(table);
+}
+
+void AgataSurfaceSampler::GetPointsOnSurface( const G4VSolid* solid, G4int nPoints,
+                                              std::vector<G4ThreeVector>& points )
+{
+  points.resize(nPoints);
+  AliasTable* table = GetTable(solid);
+  if( !table ) {
+    for( G4int ii=0; ii<nPoints; ii++ )
+      points[ii] = solid->GetPointOnSurface();
+    return;
+  }
+  for( G4int ii=0; ii<nPoints; ii++ )
+    points[ii] = Sample(table);
+}
+
+G4double AgataSurfaceSampler::GetSurfaceArea( const G4VSolid* solid )
+{
+  AliasTable* table = GetTable(solid);
+  if( !table ) return const_cast<G4VSolid*>(solid)->GetSurfaceArea();
+  return table->area;
+}
+
+////////////////////////////////////////////////////////////
+/// Overlap checks. The surface points of the daughter, moved to
+/// the mother frame, must be inside the mother and outside the
+/// siblings; with a target, only that sibling is tested (and not
+/// the mother).
+////////////////////////////////////////////////////////////
+G4int AgataSurfaceSampler::CheckSurface( G4VPhysicalVolume* daughter, G4VPhysicalVolume* target,
+                                         G4int nPoints, G4double tolerance )
+{
+  G4LogicalVolume* motherLog = daughter->GetMotherLogical();
+  if( !motherLog || daughter->IsReplicated() ) return 0;
+
+  G4VSolid* solid       = daughter->GetLogicalVolume()->GetSolid();
+  G4VSolid* motherSolid = motherLog->GetSolid();
+  G4AffineTransform Tm( daughter->GetRotation(), daughter->GetTranslation() );
+
+  std::vector<G4ThreeVector> points;
+  GetPointsOnSurface( solid, nPoints, points );
+
+  G4int nOverlaps = 0;
+  G4bool motherDone = ( target != NULL );
+  std::vector<G4bool> siblingDone( motherLog->GetNoDaughters(), false );
+
+  for( G4int ii=0; ii<nPoints; ii++ ) {
+    G4ThreeVector mp = Tm.TransformPoint( points[ii] );
+
+    //> the point must be inside the mother ...
+    if( !motherDone && motherSolid->Inside(mp) == kOutside ) {
+      G4double distin = motherSolid->DistanceToIn(mp);
+      if( distin > tolerance ) {
+        G4cout << " ---> Overlap: " << daughter->GetName() << " protrudes from mother "
+               << motherLog->GetName() << " by " << G4BestUnit(distin,"Length")
+               << " at local " << points[ii] << G4endl;
+        nOverlaps++;
+        motherDone = true;
+      }
+    }
+
+    //> ... and outside all the other daughters
+    for( size_t jj=0; jj<motherLog->GetNoDaughters(); jj++ ) {
+      G4VPhysicalVolume* sibling = motherLog->GetDaughter(jj);
+      if( sibling == daughter || siblingDone[jj] || sibling->IsReplicated() ) continue;
+      if( target && sibling != target ) continue;
+      G4AffineTransform Td( sibling->GetRotation(), sibling->GetTranslation() );
+      G4ThreeVector md = Td.Inverse().TransformPoint(mp);
+      G4VSolid* siblingSolid = sibling->GetLogicalVolume()->GetSolid();
+      if( siblingSolid->Inside(md) == kInside ) {
+        G4double distout = siblingSolid->DistanceToOut(md);
+        if( distout > tolerance ) {
+          G4cout << " ---> Overlap: " << daughter->GetName() << " overlaps with "
+                 << sibling->GetName() << " by " << G4BestUnit(distout,"Length")
+                 << " at local " << points[ii] << G4endl;
+          nOverlaps++;
+          siblingDone[jj] = true;
+        }
+      }
+    }
+  }
+  return nOverlaps;
+}
+
+//////////////////////////////////////////////////////////////
+/// Both ways: a sibling inside the daughter has none of its
+/// points inside the sibling, the other way round is needed
+//////////////////////////////////////////////////////////////
+G4int AgataSurfaceSampler::CheckOverlaps( G4VPhysicalVolume* daughter, G4int nPoints, G4double tolerance )
+{
+  G4LogicalVolume* motherLog = daughter->GetMotherLogical();
+  if( !motherLog || daughter->IsReplicated() ) return 0;
+
+  G4int nOverlaps = CheckSurface( daughter, NULL, nPoints, tolerance );
+  for( size_t jj=0; jj<motherLog->GetNoDaughters(); jj++ ) {
+    G4VPhysicalVolume* sibling = motherLog->GetDaughter(jj);
+    if( sibling != daughter )
+      nOverlaps += CheckSurface( sibling, daughter, nPoints, tolerance );
+  }
+  return nOverlaps;
+}
+
+//////////////////////////////////////////////////////////////
+/// The points of every daughter are tested against all the
+/// others: each pair is checked both ways
+//////////////////////////////////////////////////////////////
+G4int AgataSurfaceSampler::CheckDaughters( G4LogicalVolume* mother, G4int nPoints,
+                                           G4double tolerance, G4bool recursive )
+{
+  G4int nOverlaps = 0;
+  for( size_t ii=0; ii<mother->GetNoDaughters(); ii++ ) {
+    G4VPhysicalVolume* daughter = mother->GetDaughter(ii);
+    nOverlaps += CheckSurface( daughter, NULL, nPoints, tolerance );
+    if( recursive )
+      nOverlaps += CheckDaughters( daughter->GetLogicalVolume(), nPoints, tolerance, true );
+  }
+  return nOverlaps;
+}
+
+////////////////////////////////////////////////////////////
+/// AgataTessellatedSolid: without a table (no surface area) the
+/// sampling of G4TessellatedSolid is used, not the fallback of
+/// the sampler, which would call this one again
+////////////////////////////////////////////////////////////
+AgataTessellatedSolid::AgataTessellatedSolid( const G4String& name )
+  : G4TessellatedSolid( name )
+{}
+
+AgataTessellatedSolid::~AgataTessellatedSolid()
+{
+  AgataSurfaceSampler::Forget(this);
+}
+
+G4ThreeVector AgataTessellatedSolid::GetPointOnSurface() const
+{
+  AgataSurfaceSampler* theSampler = AgataSurfaceSampler::GetInstance();
+  if( theSampler->HasTable(this) ) return theSampler->GetPointOnSurface(this);
+  return G4TessellatedSolid::GetPointOnSurface();
+}
+
+G4double AgataTessellatedSolid::GetSurfaceArea()
+{
+  AgataSurfaceSampler* theSampler = AgataSurfaceSampler::GetInstance();
+  if( theSampler->HasTable(this) ) return theSampler->GetSurfaceArea(this);
+  return G4TessellatedSolid::GetSurfaceArea();
+}
+
+void AgataSurfaceSampler::CheckAllOverlaps( G4int nPoints )
+{
+  G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()
+    ->GetNavigatorForTracking()->GetWorldVolume();
+  if( !world ) {
+    G4cout << " Geometry has not been constructed yet, cannot check overlaps!" << G4endl;
+    return;
+  }
+  G4int nOverlaps = CheckDaughters( world->GetLogicalVolume(), nPoints, 0. );
+  G4cout << " ---> Overlap check done: " << nOverlaps << " overlap(s) found." << G4endl;
+}
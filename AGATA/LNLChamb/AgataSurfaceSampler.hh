@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////
+/// Area-weighted sampling of points on the surface of tessellated
+/// solids. The first request for a solid builds a Walker alias
+/// table over its facet areas; every further point then costs two
+/// random numbers for the facet plus two for the position in it,
+/// whatever the number of facets.
+/// The tables are kept per thread, so sampling needs no locking.
+/// Non-tessellated solids, and meshes without surface area, fall
+/// back to GetPointOnSurface().
+/// The tables serve the overlap checks of this class, for every
+/// tessellated solid, and the GetPointOnSurface() of the solids
+/// built by the mesh tools (AgataTessellatedSolid, below), i.e.
+/// also the G4 users of it: /geometry/test/run, placements
+/// checking their overlaps. The solids read by the GDML parser
+/// are plain G4TessellatedSolid and keep the sampling of G4.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataSurfaceSampler_h
+#define AgataSurfaceSampler_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+#include "G4TessellatedSolid.hh"
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+class G4VSolid;
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4GenericMessenger;
+class AgataTriangleMesh;
+
+class AgataSurfaceSampler
+{
+  public:
+    static AgataSurfaceSampler* GetInstance();
+    //> the instance of the calling thread only
+    static void DeleteInstance();
+
+  private:
+    AgataSurfaceSampler();
+
+  public:
+    ~AgataSurfaceSampler();
+
+  private:
+    static G4ThreadLocal AgataSurfaceSampler* instance;
+
+  private:
+    //> a block laid out as nTri, area, corners[9*nTri],
+    //> probability[nTri], alias[nTri], and views of it
+    struct AliasTable
+    {
+      std::vector<char> block;
+      G4int             nTri;
+      G4double          area;
+      const G4double*   corners;      //> a, b-a, c-a per triangle
+      const G4double*   probability;
+      const int32_t*    alias;
+    };
+
+  private:
+    std::map<const G4VSolid*,AliasTable*> tables;
+    G4GenericMessenger*                   myMessenger;
+
+  public:
+    G4ThreeVector GetPointOnSurface ( const G4VSolid* solid );
+    void          GetPointsOnSurface( const G4VSolid* solid, G4int nPoints,
+                                      std::vector<G4ThreeVector>& points );
+    G4double      GetSurfaceArea    ( const G4VSolid* solid );
+    //> false when GetPointOnSurface() is that of the solid
+    G4bool        HasTable          ( const G4VSolid* solid ) { return GetTable(solid) != NULL; };
+    //> drops the table of a deleted solid (calling thread)
+    static void   Forget            ( const G4VSolid* solid );
+
+  private:
+    AliasTable*   GetTable  ( const G4VSolid* solid );
+    AliasTable*   BuildTable( const G4TessellatedSolid* solid );
+    static void   FillTable ( const AgataTriangleMesh& mesh, std::vector<char>& data );
+    G4ThreeVector Sample    ( const AliasTable* table );
+
+  private:
+    G4int         CheckSurface    ( G4VPhysicalVolume* daughter, G4VPhysicalVolume* target,
+                                    G4int nPoints, G4double tolerance );
+
+  public:
+    //> overlap check of the daughters of a volume (same criteria as
+    //> G4PVPlacement::CheckOverlaps, with the fast surface sampling,
+    //> and both ways: the points of the siblings are tested too)
+    G4int         CheckOverlaps   ( G4VPhysicalVolume* daughter, G4int nPoints, G4double tolerance );
+    G4int         CheckDaughters  ( G4LogicalVolume* mother, G4int nPoints, G4double tolerance,
+                                    G4bool recursive = true );
+    //> whole geometry, from the macro command /Agata/geometry/overlaps/check
+    void          CheckAllOverlaps( G4int nPoints );
+};
+
+//////////////////////////////////////////////////////////////////
+/// Tessellated solid sampled through the alias tables
+/////////////////////////////////////////////////////////////////
+class AgataTessellatedSolid : public G4TessellatedSolid
+{
+  public:
+    AgataTessellatedSolid( const G4String& name );
+    ~AgataTessellatedSolid();
+
+  public:
+    G4ThreeVector GetPointOnSurface() const;
+    G4double      GetSurfaceArea();
+};
+
+#endif
@@ -0,0 +1,190 @@
+//////////////////////////////////////////////////////////////////
+/// Indexed triangle mesh (see AgataTriangleMesh.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataTriangleMesh.hh"
+#include "AgataSurfaceSampler.hh"
+
+#include "G4TessellatedSolid.hh"
+#include "G4TriangularFacet.hh"
+
+#include <map>
+#include <algorithm>
+
+namespace {
+  struct VertexLess
+  {
+    bool operator()( const G4ThreeVector& a, const G4ThreeVector& b ) const
+    {
+      if( a.x() != b.x() ) return a.x() < b.x();
+      if( a.y() != b.y() ) return a.y() < b.y();
+      return a.z() < b.z();
+    }
+  };
+}
+
+AgataTriangleMesh::AgataTriangleMesh()
+{}
+
+AgataTriangleMesh::AgataTriangleMesh( const G4TessellatedSolid* solid )
+{
+  std::map<G4ThreeVector,G4int,VertexLess> index;
+  G4int nFacets = solid->GetNumberOfFacets();
+  triangles.reserve( 3*nFacets );
+
+  G4int ids[4];
+  for( G4int ii=0; ii<nFacets; ii++ ) {
+    G4VFacet* facet = solid->GetFacet(ii);
+    G4int nVert = facet->GetNumberOfVertices();
+    for( G4int jj=0; jj<nVert; jj++ ) {
+      G4ThreeVector vertex = facet->GetVertex(jj);
+      std::map<G4ThreeVector,G4int,VertexLess>::iterator it = index.find(vertex);
+      if( it == index.end() ) {
+        ids[jj] = vertices.size();
+        index[vertex] = ids[jj];
+        vertices.push_back(vertex);
+      }
+      else
+        ids[jj] = it->second;
+    }
+    AddTriangle( ids[0], ids[1], ids[2] );
+    if( nVert == 4 )
+      AddTriangle( ids[0], ids[2], ids[3] );
+  }
+}
+
+AgataTriangleMesh::~AgataTriangleMesh()
+{}
+
+G4int AgataTriangleMesh::AddVertex( const G4ThreeVector& vertex )
+{
+  vertices.push_back(vertex);
+  return vertices.size() - 1;
+}
+
+void AgataTriangleMesh::AddTriangle( G4int i0, G4int i1, G4int i2 )
+{
+  triangles.push_back(i0);
+  triangles.push_back(i1);
+  triangles.push_back(i2);
+}
+
+void AgataTriangleMesh::Append( const AgataTriangleMesh& other )
+{
+  G4int shift = vertices.size();
+  vertices.insert( vertices.end(), other.vertices.begin(), other.vertices.end() );
+  for( size_t ii=0; ii<other.triangles.size(); ii++ )
+    triangles.push_back( other.triangles[ii] + shift );
+}
+
+G4TessellatedSolid* AgataTriangleMesh::BuildSolid( G4String name ) const
+{
+  //> sampled through the alias tables (see AgataSurfaceSampler.hh)
+  G4TessellatedSolid* solid = new AgataTessellatedSolid(name);
+  for( G4int ii=0; ii<GetNumberOfTriangles(); ii++ ) {
+    solid->AddFacet( new G4TriangularFacet( GetVertex(ii,0), GetVertex(ii,1),
+                                            GetVertex(ii,2), ABSOLUTE ) );
+  }
+  solid->SetSolidClosed(true);
+  return solid;
+}
+
+G4ThreeVector AgataTriangleMesh::GetTriangleNormal( G4int tri ) const
+{
+  const G4ThreeVector& a = GetVertex(tri,0);
+  return ( GetVertex(tri,1) - a ).cross( GetVertex(tri,2) - a );
+}
+
+G4double AgataTriangleMesh::GetTriangleArea( G4int tri ) const
+{
+  return 0.5 * GetTriangleNormal(tri).mag();
+}
+
+void AgataTriangleMesh::GetBoundingBox( G4ThreeVector& pMin, G4ThreeVector& pMax ) const
+{
+  if( vertices.empty() ) {
+    pMin = pMax = G4ThreeVector();
+    return;
+  }
+  pMin = pMax = vertices[0];
+  for( size_t ii=1; ii<vertices.size(); ii++ ) {
+    const G4ThreeVector& v = vertices[ii];
+    pMin.set( std::min(pMin.x(),v.x()), std::min(pMin.y(),v.y()), std::min(pMin.z(),v.z()) );
+    pMax.set( std::max(pMax.x(),v.x()), std::max(pMax.y(),v.y()), std::max(pMax.z(),v.z()) );
+  }
+}
+
+G4bool AgataTriangleMesh::IsClosedManifold() const
+{
+  G4int nTri = GetNumberOfTriangles();
+  if( nTri < 4 ) return false;
+  std::map< std::pair<G4int,G4int>, G4int > edges;
+  for( G4int tt=0; tt<nTri; tt++ ) {
+    for( G4int cc=0; cc<3; cc++ ) {
+      G4int aa = triangles[3*tt+cc], bb = triangles[3*tt+(cc+1)%3];
+      if( aa == bb ) return false;
+      if( ++edges[ std::make_pair(aa,bb) ] > 1 ) return false;
+    }
+  }
+  std::map< std::pair<G4int,G4int>, G4int >::const_iterator it;
+  for( it=edges.begin(); it!=edges.end(); ++it ) {
+    if( edges.find( std::make_pair( it->first.second, it->first.first ) ) == edges.end() )
+      return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////
+/// Closest point by regions of the triangle (Voronoi regions of
+/// the corners, then of the edges, then the face)
+//////////////////////////////////////////////////////////////
+G4double AgataTriangleMesh::GetTriangleDistance( G4int tri, const G4ThreeVector& point ) const
+{
+  const G4ThreeVector& a = GetVertex(tri,0);
+  const G4ThreeVector& b = GetVertex(tri,1);
+  const G4ThreeVector& c = GetVertex(tri,2);
+  G4ThreeVector ab = b - a, ac = c - a, ap = point - a;
+
+  G4double d1 = ab.dot(ap), d2 = ac.dot(ap);
+  if( d1 <= 0. && d2 <= 0. ) return ap.mag();
+
+  G4ThreeVector bp = point - b;
+  G4double d3 = ab.dot(bp), d4 = ac.dot(bp);
+  if( d3 >= 0. && d4 <= d3 ) return bp.mag();
+
+  G4double vc = d1*d4 - d3*d2;
+  if( vc <= 0. && d1 >= 0. && d3 <= 0. )
+    return ( ap - ab*( d1/( d1 - d3 ) ) ).mag();
+
+  G4ThreeVector cp = point - c;
+  G4double d5 = ab.dot(cp), d6 = ac.dot(cp);
+  if( d6 >= 0. && d5 <= d6 ) return cp.mag();
+
+  G4double vb = d5*d2 - d1*d6;
+  if( vb <= 0. && d2 >= 0. && d6 <= 0. )
+    return ( ap - ac*( d2/( d2 - d6 ) ) ).mag();
+
+  G4double va = d3*d6 - d5*d4;
+  if( va <= 0. && ( d4 - d3 ) >= 0. && ( d5 - d6 ) >= 0. )
+    return ( bp - ( c - b )*( ( d4 - d3 )/( ( d4 - d3 ) + ( d5 - d6 ) ) ) ).mag();
+
+  G4double sum = va + vb + vc;
+  if( !( sum > 0. ) ) return ap.mag();  //> degenerate triangle
+  return ( ap - ab*( vb/sum ) - ac*( vc/sum ) ).mag();
+}
+
+uint64_t AgataTriangleMesh::Hash( const G4TessellatedSolid* solid )
+{
+  uint64_t hash = AgataHashBytes( 0, 0 );
+  for( G4int ii=0; ii<solid->GetNumberOfFacets(); ii++ ) {
+    G4VFacet* facet = solid->GetFacet(ii);
+    G4int nVert = facet->GetNumberOfVertices();
+    hash = AgataHashBytes( &nVert, sizeof(nVert), hash );
+    for( G4int jj=0; jj<nVert; jj++ ) {
+      G4ThreeVector vertex = facet->GetVertex(jj);
+      G4double xyz[3] = { vertex.x(), vertex.y(), vertex.z() };
+      hash = AgataHashBytes( xyz, sizeof(xyz), hash );
+    }
+  }
+  return hash;
+}
@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////
+/// Indexed triangle mesh extracted from a G4TessellatedSolid.
+/// Quadrangular facets are split in two triangles; vertices shared
+/// by several facets (bitwise identical coordinates) are stored
+/// once. This is the common input of the mesh tools used with the
+/// CAD (GDML) geometries of the ancillaries.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataTriangleMesh_h
+#define AgataTriangleMesh_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+#include <stdint.h>
+
+class G4TessellatedSolid;
+
+class AgataTriangleMesh
+{
+  public:
+    AgataTriangleMesh();
+    AgataTriangleMesh( const G4TessellatedSolid* solid );
+    ~AgataTriangleMesh();
+
+  public:
+    std::vector<G4ThreeVector> vertices;
+    std::vector<G4int>         triangles;  //> three vertex indices per triangle
+
+  public:
+    G4int AddVertex  ( const G4ThreeVector& vertex );
+    void  AddTriangle( G4int i0, G4int i1, G4int i2 );
+    void  Append     ( const AgataTriangleMesh& other );
+
+  public:
+    //> builds a new solid (closed, an AgataTessellatedSolid) from the triangles
+    G4TessellatedSolid* BuildSolid( G4String name ) const;
+
+  public:
+    inline G4int GetNumberOfTriangles() const { return triangles.size()/3; };
+    inline const G4ThreeVector& GetVertex( G4int tri, G4int corner ) const
+    { return vertices[triangles[3*tri+corner]]; };
+
+    G4ThreeVector GetTriangleNormal( G4int tri ) const;  //> not normalised: |n| = 2*area
+    G4double      GetTriangleArea  ( G4int tri ) const;
+    void          GetBoundingBox   ( G4ThreeVector& pMin, G4ThreeVector& pMax ) const;
+    //> distance of a point from a triangle (its closest point)
+    G4double      GetTriangleDistance( G4int tri, const G4ThreeVector& point ) const;
+    //> every edge used by exactly two triangles, once in each direction,
+    //> no degenerate triangle (vertex indices, i.e. after welding)
+    G4bool        IsClosedManifold () const;
+
+  public:
+    //> hash of the facets of a solid as they are (vertex coordinates),
+    //> without building the mesh
+    static uint64_t Hash( const G4TessellatedSolid* solid );
+};
+
+//////////////////////////////////////////////////////////////////
+/// 64-bit FNV-1a, used to key caches on geometry or file content
+/////////////////////////////////////////////////////////////////
+inline uint64_t AgataHashBytes( const void* data, size_t size, uint64_t hash = 14695981039346656037ULL )
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for( size_t ii=0; ii<size; ii++ ) {
+    hash ^= bytes[ii];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+#endif
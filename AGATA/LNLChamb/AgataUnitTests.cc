@@ -0,0 +1,1201 @@
+//////////////////////////////////////////////////////////////////
+/// Unit checks of the ancillary tools (see AgataUnitTests.hh).
+/// The groups:
+///
+///   listmode    binary list-mode file written by several threads
+///               and read back
+///   arena       hits of successive events without heap
+///               allocations; kept events outliving their thread
+///   properties  volume, centroid and inertia of meshes against
+///               those of G4Box and G4Tubs; a sampled G4Tubs
+///               segment
+///   sampler     surface points of a tessellated solid: on the
+///               surface, spread as the areas of its facets;
+///               overlaps found both ways
+///   voxels      materials of a voxelised tree, inside its
+///               daughters and outside the tree
+///   budget      X/X0 and path length of the rays through a box,
+///               against those of straight lines
+///   segments    precomputed segment lookup against Inside() on
+///               the segments, numbered by the ancillary
+///   mask        sub-files skipped before parsing (commented-out
+///               ones ignored), volumes removed, emptied and boxed
+///               after it, with what they held
+///   gdml        validation cache: a file is validated again when
+///               an entity it includes changes
+///   merger      sibling meshes fused into a closed, manifold mesh
+///               of the same volume; crossing ones only combined
+///   benchmark   thread counts of the sweep, results read back
+///               from its children
+///   profiler    tracks killed by the transport only, volumes
+///               charged to their GDML files (merged ones too)
+///   biasing     weights of split tracks, before and after the
+///               splitting, for the current event only
+///   hull        convex hulls containing all their input points
+///   healer      broken meshes (inverted shells, unwelded vertices,
+///               duplicated facets, a hole) left closed, manifold
+///               and of positive volume
+/////////////////////////////////////////////////////////////////
+
+#include "AgataUnitTests.hh"
+#include "AgataListModeWriter.hh"
+#include "AgataListModeReader.hh"
+#include "AgataHitArena.hh"
+#include "AgataAncillaryHit.hh"
+#include "AgataSolidProperties.hh"
+#include "AgataTriangleMesh.hh"
+#include "AgataSurfaceSampler.hh"
+#include "AgataVoxelMaterialMap.hh"
+#include "AgataSegmentLookup.hh"
+#include "AgataMaterialBudgetScanner.hh"
+#include "AgataGeometryMask.hh"
+#include "AgataGdmlValidator.hh"
+#include "AgataMeshMerger.hh"
+#include "AgataBenchmark.hh"
+#include "AgataVolumeProfiler.hh"
+#include "AgataImportanceBiasing.hh"
+#include "AgataConvexPolyhedron.hh"
+#include "AgataMeshHealer.hh"
+
+#include "G4Box.hh"
+#include "G4Tubs.hh"
+#include "G4TessellatedSolid.hh"
+#include "G4TriangularFacet.hh"
+#include "G4LogicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4NistManager.hh"
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4StepPoint.hh"
+#include "G4VDiscreteProcess.hh"
+#include "G4Event.hh"
+#include "G4EventManager.hh"
+#include "Randomize.hh"
+#include "G4ThreeVector.hh"
+#include "G4GenericMessenger.hh"
+#include "G4AutoLock.hh"
+#include "globals.hh"
+
+#include <vector>
+#include <set>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+#include <unistd.h>
+#include <stdint.h>
+
+namespace {
+  G4int nChecks = 0;
+  G4int nFailed = 0;
+
+  void Check( G4bool condition, const G4String& what )
+  {
+    nChecks++;
+    if( condition ) return;
+    nFailed++;
+    G4cout << "   FAILED: " << what << G4endl;
+  }
+
+  G4bool IsClose( G4double value, G4double expected, G4double tolerance )
+  {
+    return std::fabs( value - expected ) <= tolerance * std::max( 1., std::fabs(expected) );
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Test meshes, outward oriented; quads are given counter-
+  /// clockwise as seen from outside
+  //////////////////////////////////////////////////////////////
+  void AddQuad( AgataTriangleMesh& mesh, G4int i0, G4int i1, G4int i2, G4int i3 )
+  {
+    mesh.AddTriangle( i0, i1, i2 );
+    mesh.AddTriangle( i0, i2, i3 );
+  }
+
+  void AddBox( AgataTriangleMesh& mesh, const G4ThreeVector& centre, const G4ThreeVector& half )
+  {
+    G4int first = mesh.vertices.size();
+    for( G4int ii=0; ii<8; ii++ )
+      mesh.vertices.push_back( centre + G4ThreeVector( ( ii & 1 ) ? half.x() : -half.x(),
+                                                       ( ii & 2 ) ? half.y() : -half.y(),
+                                                       ( ii & 4 ) ? half.z() : -half.z() ) );
+    const G4int faces[6][4] = { {0,2,3,1}, {4,5,7,6}, {0,1,5,4}, {2,6,7,3}, {0,4,6,2}, {1,3,7,5} };
+    for( G4int ii=0; ii<6; ii++ )
+      AddQuad( mesh, first+faces[ii][0], first+faces[ii][1], first+faces[ii][2], first+faces[ii][3] );
+  }
+
+  //> cylindrical shell around z, the circles as polygons of nSides
+  void AddTube( AgataTriangleMesh& mesh, G4double rMin, G4double rMax, G4double dz, G4int nSides )
+  {
+    G4int first = mesh.vertices.size();
+    for( G4int ii=0; ii<nSides; ii++ ) {
+      G4double phi = CLHEP::twopi * ii / nSides;
+      G4ThreeVector radial( std::cos(phi), std::sin(phi), 0. );
+      mesh.vertices.push_back( rMin*radial - G4ThreeVector( 0., 0., dz ) );
+      mesh.vertices.push_back( rMin*radial + G4ThreeVector( 0., 0., dz ) );
+      mesh.vertices.push_back( rMax*radial - G4ThreeVector( 0., 0., dz ) );
+      mesh.vertices.push_back( rMax*radial + G4ThreeVector( 0., 0., dz ) );
+    }
+    for( G4int ii=0; ii<nSides; ii++ ) {
+      G4int aa = first + 4*ii, bb = first + 4*( (ii+1) % nSides );
+      AddQuad( mesh, aa+1, aa+3, bb+3, bb+1 );  //> top
+      AddQuad( mesh, aa,   bb,   bb+2, aa+2 );  //> bottom
+      AddQuad( mesh, aa+2, bb+2, bb+3, aa+3 );  //> outer wall
+      AddQuad( mesh, aa,   aa+1, bb+1, bb   );  //> inner wall
+    }
+  }
+
+  G4bool SameInfo( const AgataSolidInfo& mesh, const AgataSolidInfo& solid,
+                   const G4ThreeVector& shift, G4double tolerance )
+  {
+    G4bool same = IsClose( mesh.volume, solid.volume, tolerance ) &&
+                  ( mesh.centroid - shift - solid.centroid ).mag() <= tolerance;
+    G4double scale = std::max( solid.inertia[0][0], std::max( solid.inertia[1][1], solid.inertia[2][2] ) );
+    for( G4int ii=0; ii<3; ii++ )
+      for( G4int jj=0; jj<3; jj++ )
+        same = same && std::fabs( mesh.inertia[ii][jj] - solid.inertia[ii][jj] ) <= tolerance * scale;
+    return same;
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Events written by several threads with small blocks (many
+  /// of them in flight), read back: header, every event once,
+  /// hits unchanged (weight included)
+  //////////////////////////////////////////////////////////////
+  const G4int nWriters         = 4;
+  const G4int nEventsPerWriter = 2000;
+
+  AgataLMHit MakeHit( G4int eventId, G4int ii )
+  {
+    AgataLMHit hit;
+    hit.detCode = 35000 + ii;
+    hit.segment = eventId % 7;
+    hit.energy  = 0.5f * eventId + ii;
+    hit.x       = 1.f * ii;
+    hit.y       = -2.f * ii;
+    hit.z       = 0.25f * eventId;
+    hit.time    = 0.1f * ii;
+    hit.weight  = ( ii % 2 ) ? 0.5f : 1.f;
+    return hit;
+  }
+
+  void TestListMode()
+  {
+    const char* fileName = "AgataUnitTests.blm";
+    AgataListModeWriter* theWriter = AgataListModeWriter::GetInstance();
+    theWriter->SetBlockSize( 4096 );
+    std::vector<G4int> offsets( 1, 35000 );
+    theWriter->AddAncillary( "LNLChamb", offsets );
+    Check( theWriter->Open( fileName ), "list-mode file opened" );
+    theWriter->CommitHeader( 1. );
+
+    std::vector<std::thread> writers;
+    for( G4int tt=0; tt<nWriters; tt++ ) {
+      writers.push_back( std::thread( [theWriter,tt]() {
+        for( G4int ee=0; ee<nEventsPerWriter; ee++ ) {
+          G4int eventId = tt*nEventsPerWriter + ee;
+          std::vector<AgataLMHit> hits;
+          for( G4int ii=0; ii<eventId%4; ii++ )
+            hits.push_back( MakeHit( eventId, ii ) );
+          theWriter->WriteEvent( eventId, hits );
+        }
+        theWriter->FlushThread();
+      } ) );
+    }
+    for( size_t tt=0; tt<writers.size(); tt++ )
+      writers[tt].join();
+    theWriter->Close();
+    AgataListModeWriter::DeleteInstance();
+
+    AgataListModeReader theReader;
+    Check( theReader.Open( fileName ), "list-mode file read back" );
+    Check( theReader.GetAncillaries().size() == 1 &&
+           theReader.GetAncillaries()[0].name == "LNLChamb" &&
+           theReader.GetAncillaries()[0].offsets == std::vector<int32_t>( 1, 35000 ),
+           "ancillary descriptors in the header" );
+    Check( theReader.GetUnitLength() == 1., "unit of length in the header" );
+
+    std::set<G4int> seen;
+    G4int nBad = 0;
+    int32_t eventId;
+    std::vector<AgataLMHit> hits;
+    while( theReader.NextEvent( eventId, hits ) ) {
+      if( !seen.insert(eventId).second || (G4int)hits.size() != eventId%4 ) nBad++;
+      for( size_t ii=0; ii<hits.size(); ii++ ) {
+        AgataLMHit hit = MakeHit( eventId, ii );
+        if( memcmp( &hit, &hits[ii], sizeof(hit) ) ) nBad++;
+      }
+    }
+    Check( (G4int)seen.size() == nWriters*nEventsPerWriter, "every event read back" );
+    Check( nBad == 0, "events read back unchanged" );
+    theReader.Close();
+
+    //> a block header claiming more than the format allows is
+    //> refused, not allocated
+    std::fstream corrupt( fileName, std::ios::in | std::ios::out | std::ios::binary );
+    std::streamoff firstBlock = sizeof(AgataLMFileHeader) + sizeof(AgataLMAncHeader)
+                              + strlen("LNLChamb") + sizeof(int32_t);
+    AgataLMBlockHeader bh;
+    corrupt.seekg( firstBlock );
+    corrupt.read( (char*)&bh, sizeof(bh) );
+    bh.rawSize = AgataLM::maxBlockSize + 1;
+    corrupt.seekp( firstBlock );
+    corrupt.write( (const char*)&bh, sizeof(bh) );
+    corrupt.close();
+    Check( theReader.Open( fileName ) && !theReader.NextEvent( eventId, hits ),
+           "oversized block header rejected" );
+    theReader.Close();
+    remove( fileName );
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Events of hits, on a thread of their own as in a worker:
+  /// each event is deleted before the next one starts, as the
+  /// run manager does; from the third event on, the chunks and
+  /// generations released by the earlier ones are enough. The
+  /// last event is kept past the end of the thread (and of its
+  /// arena).
+  //////////////////////////////////////////////////////////////
+  void TestArena()
+  {
+    const G4int nEvents = 10;
+    const G4int nHits   = 5000;
+    G4bool heapFree = true, aligned = true;
+    G4long nAllocations = 0;
+    AgataAncillaryHitsCollection* kept = NULL;
+
+    std::thread worker( [&]() {
+      AgataHitArena* theArena = AgataHitArena::GetInstance();
+      theArena->SetChunkSize( 64*1024 );
+      for( G4int ee=0; ee<nEvents; ee++ ) {
+        delete kept;
+        theArena->NewEvent();
+        kept = new AgataAncillaryHitsCollection( "unitSD", "unitHits" );
+        for( G4int ii=0; ii<nHits; ii++ ) {
+          AgataAncillaryHit* hit = new AgataAncillaryHit();
+          hit->SetDetNb( ii );
+          kept->insert( hit );
+          aligned = aligned && ( (uintptr_t)hit % alignof(AgataAncillaryHit) ) == 0;
+        }
+        if( ee >= 2 && theArena->GetHeapAllocationsThisEvent() > 0 ) heapFree = false;
+      }
+      nAllocations = theArena->GetTotalAllocations();
+    } );
+    worker.join();
+
+    Check( aligned, "hits aligned" );
+    Check( nAllocations >= nEvents*( nHits + 1 ), "hits and collections taken from the arena" );
+    Check( heapFree, "no heap allocation once the first events are released" );
+    Check( kept->entries() == (size_t)nHits && (*kept)[nHits-1]->GetDetNb() == nHits-1,
+           "kept event readable after the end of its thread" );
+    delete kept;
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// The mesh integrals against the closed forms of the
+  /// primitives; the box is shifted, its inertia about the
+  /// centroid must not change. The polygonal tube is smaller than
+  /// the round one by (2pi/n)^2/6 to first order.
+  //////////////////////////////////////////////////////////////
+  void TestProperties()
+  {
+    AgataSolidProperties* theProperties = AgataSolidProperties::GetInstance();
+
+    G4ThreeVector half( 10.*mm, 20.*mm, 30.*mm );
+    G4ThreeVector shift( 5.*mm, -7.*mm, 100.*mm );
+    AgataTriangleMesh boxMesh;
+    AddBox( boxMesh, shift, half );
+    G4Box box( "unitBox", half.x(), half.y(), half.z() );
+    AgataSolidInfo boxInfo = AgataSolidProperties::FromMesh( boxMesh );
+    Check( boxInfo.exact, "box mesh integrated exactly" );
+    Check( SameInfo( boxInfo, theProperties->GetInfo( &box ), shift, 1.e-9 ),
+           "box mesh against G4Box" );
+
+    const G4int nSides = 720;
+    AgataTriangleMesh tubeMesh;
+    AddTube( tubeMesh, 10.*mm, 30.*mm, 25.*mm, nSides );
+    G4Tubs tubs( "unitTubs", 10.*mm, 30.*mm, 25.*mm, 0., CLHEP::twopi );
+    AgataSolidInfo tubeInfo = AgataSolidProperties::FromMesh( tubeMesh );
+    Check( SameInfo( tubeInfo, theProperties->GetInfo( &tubs ), G4ThreeVector(),
+                     std::pow( CLHEP::twopi/nSides, 2 ) ),
+           "tube mesh against G4Tubs" );
+
+    //> sampled primitive: analytic volume, moments of the same body
+    const G4double r1 = 10.*mm, r2 = 30.*mm, hz = 25.*mm;
+    G4Tubs halfTubs( "unitHalfTubs", r1, r2, hz, 0., CLHEP::pi );
+    const AgataSolidInfo& halfInfo = theProperties->GetInfo( &halfTubs );
+    G4double halfVolume = CLHEP::halfpi * ( r2*r2 - r1*r1 ) * 2. * hz;
+    G4double yc = 4. * ( r2*r2*r2 - r1*r1*r1 ) / ( 3. * CLHEP::pi * ( r2*r2 - r1*r1 ) );
+    Check( IsClose( halfInfo.volume, halfVolume, 1.e-12 ), "half tube volume from GetCubicVolume()" );
+    Check( ( halfInfo.centroid - G4ThreeVector( 0., yc, 0. ) ).mag() < 0.02 * r2, "half tube centroid" );
+    //> the grid is seeded: its 0.6% error on I/V is reproducible, the
+    //> 0.3% error on the sampled volume must not be added to it
+    Check( IsClose( halfInfo.inertia[2][2], halfVolume * ( 0.5 * ( r1*r1 + r2*r2 ) - yc*yc ), 0.0075 ),
+           "half tube inertia for the analytic volume" );
+
+    //> reversed orientation
+    AgataTriangleMesh inverted = boxMesh;
+    for( G4int ii=0; ii<inverted.GetNumberOfTriangles(); ii++ )
+      std::swap( inverted.triangles[3*ii+1], inverted.triangles[3*ii+2] );
+    Check( AgataSolidProperties::FromMesh( inverted ).volume < 0., "inverted mesh has negative volume" );
+
+    AgataSolidProperties::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// A coarse tube, whose triangles have different areas: the
+  /// points found on each of its four faces (top, bottom, outer
+  /// and inner wall) against the area fractions, within 5 sigma
+  //////////////////////////////////////////////////////////////
+  void TestSampler()
+  {
+    const G4double rMin = 10.*mm, rMax = 30.*mm, dz = 5.*mm;
+    AgataTriangleMesh mesh;
+    AddTube( mesh, rMin, rMax, dz, 12 );
+    G4TessellatedSolid* solid = mesh.BuildSolid( "unitSampled" );
+
+    //> face of a point or of a triangle: 0 top, 1 bottom, 2 outer, 3 inner
+    G4double rMid = 0.5 * ( rMin + rMax );
+    G4double area[4] = { 0., 0., 0., 0. }, total = 0.;
+    for( G4int ii=0; ii<mesh.GetNumberOfTriangles(); ii++ ) {
+      G4ThreeVector centre = ( mesh.GetVertex(ii,0) + mesh.GetVertex(ii,1) + mesh.GetVertex(ii,2) ) / 3.;
+      G4int face = ( centre.z() >  dz - 1.e-9 ) ? 0 : ( centre.z() < -dz + 1.e-9 ) ? 1 :
+                   ( centre.perp() > rMid ) ? 2 : 3;
+      area[face] += mesh.GetTriangleArea(ii);
+      total      += mesh.GetTriangleArea(ii);
+    }
+
+    AgataSurfaceSampler* theSampler = AgataSurfaceSampler::GetInstance();
+    Check( IsClose( theSampler->GetSurfaceArea( solid ), total, 1.e-12 ), "surface area of the alias table" );
+
+    const G4int nPoints = 200000;
+    std::vector<G4ThreeVector> points;
+    theSampler->GetPointsOnSurface( solid, nPoints, points );
+    Check( (G4int)points.size() == nPoints, "number of sampled points" );
+
+    G4int counts[4] = { 0, 0, 0, 0 };
+    G4int nOff = 0;
+    for( size_t ii=0; ii<points.size(); ii++ ) {
+      const G4ThreeVector& point = points[ii];
+      G4double best = kInfinity;
+      for( G4int jj=0; jj<mesh.GetNumberOfTriangles(); jj++ )
+        best = std::min( best, mesh.GetTriangleDistance( jj, point ) );
+      if( best > 1.e-9*mm ) nOff++;
+      G4int face = ( point.z() >  dz - 1.e-9 ) ? 0 : ( point.z() < -dz + 1.e-9 ) ? 1 :
+                   ( point.perp() > rMid ) ? 2 : 3;
+      counts[face]++;
+    }
+    Check( nOff == 0, "sampled points on the surface" );
+    for( G4int ii=0; ii<4; ii++ ) {
+      G4double expected = nPoints * area[ii] / total;
+      G4double sigma    = std::sqrt( expected * ( 1. - area[ii]/total ) );
+      std::ostringstream what;
+      what << "points on face " << ii << ": " << counts[ii] << ", expected " << expected;
+      Check( std::fabs( counts[ii] - expected ) < 5.*sigma, what.str() );
+    }
+    Check( solid->GetSurfaceArea() == theSampler->GetSurfaceArea( solid ),
+           "built solids sampled through the table" );
+
+    //> a box inside its sibling has no point of the sibling inside
+    //> it: only the reverse test finds the overlap
+    G4LogicalVolume* world = new G4LogicalVolume( new G4Box( "unitWorld", 100.*mm, 100.*mm, 100.*mm ), NULL, "unitWorld" );
+    G4LogicalVolume* large = new G4LogicalVolume( new G4Box( "unitLarge", 20.*mm, 20.*mm, 20.*mm ), NULL, "unitLarge" );
+    G4LogicalVolume* small = new G4LogicalVolume( new G4Box( "unitSmall", 5.*mm, 5.*mm, 5.*mm ), NULL, "unitSmall" );
+    G4VPhysicalVolume* largePV = new G4PVPlacement( NULL, G4ThreeVector(), large, "unitLarge", world, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(), small, "unitSmall", world, false, 0 );
+    G4VPhysicalVolume* apartPV = new G4PVPlacement( NULL, G4ThreeVector( 60.*mm, 0., 0. ), small, "unitApart", world, false, 0 );
+    Check( theSampler->CheckOverlaps( largePV, 1000, 0. ) > 0, "sibling inside the checked volume found" );
+    Check( theSampler->CheckOverlaps( apartPV, 1000, 0. ) == 0, "no overlap reported for a separate sibling" );
+
+    AgataSurfaceSampler::DeleteInstance();
+    delete solid;
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Three cubes in an L, sharing whole faces, fuse into one mesh;
+  /// two cubes sharing only an edge must not (the fused mesh would
+  /// not be manifold there)
+  //////////////////////////////////////////////////////////////
+  G4LogicalVolume* PlaceCubes( const G4String& name, const std::vector<G4ThreeVector>& centres, G4double half )
+  {
+    G4Material* material = G4NistManager::Instance()->FindOrBuildMaterial( "G4_Al" );
+    G4LogicalVolume* mother = new G4LogicalVolume( new G4Box( name, 1.*m, 1.*m, 1.*m ), material, name );
+    for( size_t ii=0; ii<centres.size(); ii++ ) {
+      std::ostringstream piece;
+      piece << name << "_" << ii;
+      AgataTriangleMesh mesh;
+      AddBox( mesh, G4ThreeVector(), G4ThreeVector( half, half, half ) );
+      G4LogicalVolume* volume = new G4LogicalVolume( mesh.BuildSolid( piece.str() ), material, piece.str() );
+      new G4PVPlacement( NULL, centres[ii], volume, piece.str(), mother, false, 0 );
+    }
+    return mother;
+  }
+
+  void TestMerger()
+  {
+    const G4double half = 10.*mm;
+    AgataMeshMerger* theMerger = AgataMeshMerger::GetInstance();
+
+    std::vector<G4ThreeVector> centres;
+    centres.push_back( G4ThreeVector() );
+    centres.push_back( G4ThreeVector( 2.*half, 0., 0. ) );
+    centres.push_back( G4ThreeVector( 0., 2.*half, 0. ) );
+    G4LogicalVolume* mother = PlaceCubes( "unitMergedL", centres, half );
+    theMerger->Apply( mother );
+    Check( mother->GetNoDaughters() == 1, "face-sharing cubes replaced by one volume" );
+    G4TessellatedSolid* merged = ( mother->GetNoDaughters() == 1 ) ?
+      dynamic_cast<G4TessellatedSolid*>( mother->GetDaughter(0)->GetLogicalVolume()->GetSolid() ) : NULL;
+    Check( merged != NULL, "face-sharing cubes fused into a mesh" );
+    if( merged ) {
+      AgataTriangleMesh mesh( merged );
+      Check( mesh.IsClosedManifold(), "fused mesh closed and manifold" );
+      Check( IsClose( AgataSolidProperties::FromMesh( mesh ).volume, 3.*std::pow( 2.*half, 3 ), 1.e-9 ),
+             "fused mesh has the volume of the pieces" );
+    }
+
+    centres.clear();
+    centres.push_back( G4ThreeVector() );
+    centres.push_back( G4ThreeVector( 2.*half, 2.*half, 0. ) );
+    mother = PlaceCubes( "unitMergedEdge", centres, half );
+    theMerger->Apply( mother );
+    G4bool valid = true;
+    for( size_t ii=0; ii<mother->GetNoDaughters(); ii++ ) {
+      G4TessellatedSolid* tess =
+        dynamic_cast<G4TessellatedSolid*>( mother->GetDaughter(ii)->GetLogicalVolume()->GetSolid() );
+      if( !tess ) continue;
+      AgataTriangleMesh mesh( tess );
+      valid = valid && mesh.IsClosedManifold() && AgataSolidProperties::FromMesh( mesh ).volume > 0.;
+    }
+    Check( valid, "edge-sharing cubes: every mesh left closed, manifold, positive" );
+
+    //> two bars crossing as a plus sign: no vertex of one inside the other
+    G4Material* material = G4NistManager::Instance()->FindOrBuildMaterial( "G4_Al" );
+    mother = new G4LogicalVolume( new G4Box( "unitMergedPlus", 1.*m, 1.*m, 1.*m ), material, "unitMergedPlus" );
+    const G4ThreeVector halves[2] = { G4ThreeVector( 3.*half, half/2., half/2. ),
+                                      G4ThreeVector( half/2., 3.*half, 0.3*half ) };
+    for( G4int ii=0; ii<2; ii++ ) {
+      std::ostringstream piece;
+      piece << "unitMergedPlus_" << ii;
+      AgataTriangleMesh mesh;
+      AddBox( mesh, G4ThreeVector(), halves[ii] );
+      G4LogicalVolume* volume = new G4LogicalVolume( mesh.BuildSolid( piece.str() ), material, piece.str() );
+      new G4PVPlacement( NULL, G4ThreeVector(), volume, piece.str(), mother, false, 0 );
+    }
+    theMerger->Apply( mother );
+    Check( mother->GetNoDaughters() == 1 &&
+           !dynamic_cast<G4TessellatedSolid*>( mother->GetDaughter(0)->GetLogicalVolume()->GetSolid() ),
+           "crossing bars combined, not fused" );
+
+    AgataMeshMerger::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// No input point may be outside the hull: cube corners with
+  /// points inside and on the faces (many coplanar), a sphere
+  /// sampled on its surface, a small cloud far from the origin.
+  /// Coplanar points have no hull.
+  //////////////////////////////////////////////////////////////
+  G4int PointsOutside( const AgataConvexPolyhedron* hull, const std::vector<G4ThreeVector>& points )
+  {
+    G4int nOut = 0;
+    for( size_t ii=0; ii<points.size(); ii++ )
+      if( hull->Inside( points[ii] ) == kOutside ) nOut++;
+    return nOut;
+  }
+
+  void TestHull()
+  {
+    const G4double side = 20.*mm;
+    std::vector<G4ThreeVector> points;
+    for( G4int ii=0; ii<8; ii++ )
+      points.push_back( G4ThreeVector( ( ii & 1 ) ? side : 0., ( ii & 2 ) ? side : 0., ( ii & 4 ) ? side : 0. ) );
+    for( G4int ii=0; ii<3000; ii++ ) {
+      G4ThreeVector point( side*G4UniformRand(), side*G4UniformRand(), side*G4UniformRand() );
+      //> one point in three moved onto a face
+      if( ii % 3 == 0 ) point.setZ( ( ii % 2 ) ? side : 0. );
+      points.push_back( point );
+    }
+    AgataConvexPolyhedron* cube = AgataConvexPolyhedron::FromPoints( "unitHullCube", points );
+    Check( cube != NULL, "hull of the cube built" );
+    if( cube ) {
+      Check( PointsOutside( cube, points ) == 0, "cube points inside their hull" );
+      Check( IsClose( cube->GetCubicVolume(), side*side*side, 1.e-9 ), "volume of the cube hull" );
+      G4ThreeVector centre( 0.5*side, 0.5*side, 0.5*side ), start( -side, 0.5*side, 0.5*side );
+      G4ThreeVector normal;
+      G4bool validNorm = false;
+      Check( IsClose( cube->DistanceToIn( start, G4ThreeVector( 1., 0., 0. ) ), side, 1.e-9 ) &&
+             cube->DistanceToIn( start, G4ThreeVector( -1., 0., 0. ) ) == kInfinity,
+             "ray into the cube hull" );
+      Check( IsClose( cube->DistanceToOut( centre, G4ThreeVector( 0., 0., 1. ), true, &validNorm, &normal ),
+                      0.5*side, 1.e-9 ) && validNorm && IsClose( normal.z(), 1., 1.e-9 ),
+             "ray out of the cube hull" );
+      delete cube;
+    }
+
+    const G4double radius = 50.*mm;
+    points.clear();
+    for( G4int ii=0; ii<3000; ii++ ) {
+      G4double cosTheta = 2.*G4UniformRand() - 1., phi = CLHEP::twopi*G4UniformRand();
+      G4double sinTheta = std::sqrt( 1. - cosTheta*cosTheta );
+      points.push_back( radius * G4ThreeVector( sinTheta*std::cos(phi), sinTheta*std::sin(phi), cosTheta ) );
+    }
+    AgataConvexPolyhedron* sphere = AgataConvexPolyhedron::FromPoints( "unitHullSphere", points );
+    Check( sphere != NULL, "hull of the sphere built" );
+    if( sphere ) {
+      Check( PointsOutside( sphere, points ) == 0, "sphere points inside their hull" );
+      G4double volume = 4./3. * CLHEP::pi * std::pow( radius, 3 );
+      Check( sphere->GetCubicVolume() <= volume && sphere->GetCubicVolume() > 0.95*volume,
+             "volume of the sphere hull" );
+      delete sphere;
+    }
+
+    points.clear();
+    G4ThreeVector far( 1.*m, -2.*m, 3.*m );
+    for( G4int ii=0; ii<1000; ii++ )
+      points.push_back( far + G4ThreeVector( G4UniformRand(), G4UniformRand(), G4UniformRand() ) * mm );
+    AgataConvexPolyhedron* cloud = AgataConvexPolyhedron::FromPoints( "unitHullFar", points );
+    Check( cloud != NULL && PointsOutside( cloud, points ) == 0, "far points inside their hull" );
+    delete cloud;
+
+    points.clear();
+    for( G4int ii=0; ii<100; ii++ )
+      points.push_back( G4ThreeVector( G4UniformRand(), G4UniformRand(), 0. ) * mm );
+    AgataConvexPolyhedron* flat = AgataConvexPolyhedron::FromPoints( "unitHullFlat", points );
+    Check( flat == NULL, "no hull of coplanar points" );
+    delete flat;
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Each broken mesh is a daughter of one volume, healed by
+  /// Apply() as after the parsing; the healed solids must be
+  /// closed, manifold and of the expected (positive) volume
+  //////////////////////////////////////////////////////////////
+  void Invert( AgataTriangleMesh& mesh, G4int firstTriangle )
+  {
+    for( G4int ii=firstTriangle; ii<mesh.GetNumberOfTriangles(); ii++ )
+      std::swap( mesh.triangles[3*ii+1], mesh.triangles[3*ii+2] );
+  }
+
+  //> each facet gets its own copy of the vertices, moved by less than the tolerance
+  G4TessellatedSolid* BuildUnwelded( const AgataTriangleMesh& mesh, const G4String& name, G4double shift )
+  {
+    G4TessellatedSolid* solid = new G4TessellatedSolid(name);
+    for( G4int ii=0; ii<mesh.GetNumberOfTriangles(); ii++ ) {
+      G4ThreeVector moved[3];
+      for( G4int jj=0; jj<3; jj++ )
+        moved[jj] = mesh.GetVertex(ii,jj) + shift * G4ThreeVector( G4UniformRand(), G4UniformRand(), G4UniformRand() );
+      solid->AddFacet( new G4TriangularFacet( moved[0], moved[1], moved[2], ABSOLUTE ) );
+    }
+    solid->SetSolidClosed(true);
+    return solid;
+  }
+
+  void TestHealer()
+  {
+    G4Material* material = G4NistManager::Instance()->FindOrBuildMaterial( "G4_Al" );
+    G4LogicalVolume* top = new G4LogicalVolume( new G4Box( "unitHealed", 1.*m, 1.*m, 1.*m ), material, "unitHealed" );
+    std::vector<G4String> names;
+    std::vector<G4double> volumes;
+
+    //> hollow box with an island in the cavity: outer shell right,
+    //> cavity written outward, island written inward
+    AgataTriangleMesh hollow;
+    AddBox( hollow, G4ThreeVector(), G4ThreeVector( 20.*mm, 20.*mm, 20.*mm ) );
+    AddBox( hollow, G4ThreeVector(), G4ThreeVector( 10.*mm, 10.*mm, 10.*mm ) );
+    G4int island = hollow.GetNumberOfTriangles();
+    AddBox( hollow, G4ThreeVector(), G4ThreeVector( 2.5*mm, 2.5*mm, 2.5*mm ) );
+    Invert( hollow, island );
+    names.push_back( "unitHollow" );
+    volumes.push_back( std::pow( 40.*mm, 3 ) - std::pow( 20.*mm, 3 ) + std::pow( 5.*mm, 3 ) );
+    G4TessellatedSolid* hollowSolid = hollow.BuildSolid( names.back() );
+
+    //> box written inward
+    AgataTriangleMesh inverted;
+    AddBox( inverted, G4ThreeVector(), G4ThreeVector( 10.*mm, 20.*mm, 30.*mm ) );
+    Invert( inverted, 0 );
+    names.push_back( "unitInverted" );
+    volumes.push_back( 8. * 10.*mm * 20.*mm * 30.*mm );
+    G4TessellatedSolid* invertedSolid = inverted.BuildSolid( names.back() );
+
+    //> box without its last face, unwelded vertices and a duplicated facet
+    AgataTriangleMesh open;
+    AddBox( open, G4ThreeVector(), G4ThreeVector( 10.*mm, 10.*mm, 10.*mm ) );
+    open.triangles.resize( open.triangles.size() - 6 );
+    open.AddTriangle( open.triangles[0], open.triangles[1], open.triangles[2] );
+    names.push_back( "unitOpen" );
+    volumes.push_back( std::pow( 20.*mm, 3 ) );
+    G4TessellatedSolid* openSolid = BuildUnwelded( open, names.back(), 1.e-5*mm );
+
+    G4TessellatedSolid* solids[3] = { hollowSolid, invertedSolid, openSolid };
+    for( G4int ii=0; ii<3; ii++ ) {
+      G4LogicalVolume* volume = new G4LogicalVolume( solids[ii], material, names[ii] );
+      new G4PVPlacement( NULL, G4ThreeVector(), volume, names[ii], top, false, 0 );
+    }
+
+    AgataMeshHealer::GetInstance()->Apply( top );
+    for( size_t ii=0; ii<top->GetNoDaughters(); ii++ ) {
+      G4TessellatedSolid* tess =
+        dynamic_cast<G4TessellatedSolid*>( top->GetDaughter(ii)->GetLogicalVolume()->GetSolid() );
+      Check( tess != NULL, names[ii] + " still a mesh" );
+      if( !tess ) continue;
+      AgataTriangleMesh mesh( tess );
+      Check( mesh.IsClosedManifold(), names[ii] + " closed and manifold" );
+      Check( IsClose( AgataSolidProperties::FromMesh( mesh ).volume, volumes[ii], 1.e-5 ),
+             names[ii] + " has the expected volume" );
+    }
+
+    AgataMeshHealer::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// A tube with a box inside, voxelised: the voxels of the box,
+  /// of the tube, and those at the corners of the grid, outside
+  /// the tube, which belong to the mother once placed
+  //////////////////////////////////////////////////////////////
+  void TestVoxels()
+  {
+    G4NistManager* theNist = G4NistManager::Instance();
+    G4Material* tubeMaterial = theNist->FindOrBuildMaterial("G4_Al");
+    G4Material* boxMaterial  = theNist->FindOrBuildMaterial("G4_Cu");
+    G4Material* hallMaterial = theNist->FindOrBuildMaterial("G4_AIR");
+
+    G4LogicalVolume* hall = new G4LogicalVolume( new G4Box( "unitHall", 100.*mm, 100.*mm, 100.*mm ),
+                                                 hallMaterial, "unitHall" );
+    G4VPhysicalVolume* hallPV = new G4PVPlacement( NULL, G4ThreeVector(), hall, "unitHall", NULL, false, 0 );
+    G4LogicalVolume* tube = new G4LogicalVolume( new G4Tubs( "unitVoxTube", 0., 20.*mm, 20.*mm, 0., CLHEP::twopi ),
+                                                 tubeMaterial, "unitVoxTube" );
+    G4LogicalVolume* box  = new G4LogicalVolume( new G4Box( "unitVoxBox", 5.*mm, 5.*mm, 5.*mm ),
+                                                 boxMaterial, "unitVoxBox" );
+    new G4PVPlacement( NULL, G4ThreeVector( 10.*mm, 0., 0. ), box, "unitVoxBox", tube, false, 0 );
+
+    AgataVoxelMaterialMap* theMap = AgataVoxelMaterialMap::GetInstance();
+    theMap->SetVoxelSize( 5.*mm );
+    theMap->SetSubSamples( 3 );
+    theMap->Build( tube );
+    theMap->Place( "unitVoxels", NULL, G4ThreeVector(), hallPV );
+
+    Check( theMap->GetNumberOfVoxels(0) == 8 && theMap->GetNumberOfVoxels(1) == 8 &&
+           theMap->GetNumberOfVoxels(2) == 8, "grid over the bounding box" );
+    //> voxel 6 along x spans 10 to 15 mm
+    Check( theMap->GetVoxelMaterial( 6, 4, 4 ) == boxMaterial, "voxel inside the daughter" );
+    Check( theMap->GetVoxelMaterial( 1, 4, 4 ) == tubeMaterial, "voxel inside the tube only" );
+    Check( theMap->GetVoxelMaterial( 0, 0, 4 ) == hallMaterial, "voxel outside the tube" );
+    G4bool allSet = true;
+    for( size_t ii=0; ii<theMap->GetMaterials().size(); ii++ )
+      allSet = allSet && theMap->GetMaterials()[ii];
+    Check( allSet, "every voxel has a material once placed" );
+
+    AgataVoxelMaterialMap::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// A detector of two box segments, placed away from the origin:
+  /// the table against the geometric method everywhere in (and
+  /// around) the detector, boundary cells included, and the
+  /// numbers given by the ancillary (here, by the side in x)
+  //////////////////////////////////////////////////////////////
+  G4int UnitNumbering( G4int, G4int, const G4ThreeVector& position )
+  {
+    return ( position.x() < 100.*mm ) ? 10 : 11;
+  }
+
+  void TestSegments()
+  {
+    G4Material* vacuum = G4NistManager::Instance()->FindOrBuildMaterial("G4_Galactic");
+    G4LogicalVolume* hall = new G4LogicalVolume( new G4Box( "unitSegHall", 500.*mm, 500.*mm, 500.*mm ),
+                                                 vacuum, "unitSegHall" );
+    G4VPhysicalVolume* hallPV = new G4PVPlacement( NULL, G4ThreeVector(), hall, "unitSegHall",
+                                                   NULL, false, 0 );
+    G4LogicalVolume* detector = new G4LogicalVolume( new G4Box( "unitSegDet", 10.*mm, 10.*mm, 5.*mm ),
+                                                     vacuum, "unitSegDet" );
+    G4LogicalVolume* segment  = new G4LogicalVolume( new G4Box( "unitSegment", 5.*mm, 10.*mm, 5.*mm ),
+                                                     vacuum, "unitSegment" );
+    new G4PVPlacement( NULL, G4ThreeVector( -5.*mm, 0., 0. ), segment, "unitSegment", detector, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(  5.*mm, 0., 0. ), segment, "unitSegment", detector, false, 1 );
+    const G4int offset = 3000;
+    new G4PVPlacement( NULL, G4ThreeVector( 100.*mm, 0., 0. ), detector, "unitSegDet", hall, false, offset+2 );
+
+    //> 3 mm cells: the boundary at x=0 crosses a row of cells
+    AgataSegmentLookup::RequestLookup( offset, "unitSegment", 3.*mm );
+    Check( AgataSegmentLookup::BuildRequested( hallPV, UnitNumbering ) == 1, "one detector found" );
+    AgataSegmentLookup* lookup = AgataSegmentLookup::Find( offset, 2 );
+    Check( lookup != NULL, "lookup registered as (offset, detector)" );
+    if( !lookup ) {
+      AgataSegmentLookup::Clear();
+      return;
+    }
+
+    G4int nDiff = 0, nWrongNumber = 0;
+    for( G4int ii=0; ii<20000; ii++ ) {
+      G4ThreeVector local( 24.*mm*( G4UniformRand() - 0.5 ), 24.*mm*( G4UniformRand() - 0.5 ),
+                           12.*mm*( G4UniformRand() - 0.5 ) );
+      G4int id = lookup->GetLocalSegment(local);
+      if( id != lookup->GetSegmentByGeometry(local) ) nDiff++;
+      G4ThreeVector global = local + G4ThreeVector( 100.*mm, 0., 0. );
+      G4int expected = ( id < 0 ) ? -1 : UnitNumbering( offset, 2, global );
+      if( lookup->GetSegment(global) != expected ) nWrongNumber++;
+    }
+    Check( nDiff == 0, "table and geometry agree" );
+    Check( nWrongNumber == 0, "segments numbered as by the ancillary" );
+    Check( lookup->GetLocalSegment( G4ThreeVector( 0.1*mm, 0., 0. ) ) ==
+           lookup->GetSegmentByGeometry( G4ThreeVector( 0.1*mm, 0., 0. ) ), "point next to the boundary" );
+
+    AgataSegmentLookup::Clear();
+    Check( AgataSegmentLookup::Find( offset, 2 ) == NULL, "registrations forgotten" );
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Rays from the centre of an aluminium box in a vacuum hall:
+  /// each line of the map against the crossing of the box and of
+  /// the hall along its direction
+  //////////////////////////////////////////////////////////////
+  void TestBudget()
+  {
+    G4NistManager* theNist = G4NistManager::Instance();
+    G4Material* hallMaterial = theNist->FindOrBuildMaterial("G4_Galactic");
+    G4Material* boxMaterial  = theNist->FindOrBuildMaterial("G4_Al");
+    const G4double hallHalf = 100.*mm;
+    const G4double boxHalf  = 10.*mm;
+
+    G4LogicalVolume* hall = new G4LogicalVolume( new G4Box( "unitBudgetHall", hallHalf, hallHalf, hallHalf ),
+                                                 hallMaterial, "unitBudgetHall" );
+    G4VPhysicalVolume* hallPV = new G4PVPlacement( NULL, G4ThreeVector(), hall, "unitBudgetHall",
+                                                   NULL, false, 0 );
+    G4LogicalVolume* box = new G4LogicalVolume( new G4Box( "unitBudgetBox", boxHalf, boxHalf, boxHalf ),
+                                                boxMaterial, "unitBudgetBox" );
+    new G4PVPlacement( NULL, G4ThreeVector(), box, "unitBudgetBox", hall, false, 0 );
+
+    const G4int nTheta = 4, nPhi = 6;
+    const char* fileName = "unitBudget.dat";
+    AgataMaterialBudgetScanner* theScanner = AgataMaterialBudgetScanner::GetInstance();
+    theScanner->SetGrid( nTheta, nPhi );
+    theScanner->SetOrigin( G4ThreeVector() );
+    theScanner->ScanWorld( hallPV, fileName );
+
+    std::ifstream inFile( fileName );
+    std::string line;
+    G4int nRays = 0;
+    G4bool budgetOk = true, lengthOk = true;
+    while( std::getline( inFile, line ) ) {
+      if( line.empty() || line[0] == '#' ) continue;
+      std::istringstream fields(line);
+      G4double theta, phi, x0, lambda, length;
+      fields >> theta >> phi >> x0 >> lambda >> length;
+      nRays++;
+      G4ThreeVector dir;
+      dir.setRThetaPhi( 1., theta*deg, phi*deg );
+      G4double maxCos = std::max( std::fabs(dir.x()), std::max( std::fabs(dir.y()), std::fabs(dir.z()) ) );
+      G4double inBox  = boxHalf / maxCos;
+      G4double inHall = hallHalf / maxCos - inBox;
+      G4double expected = inBox / boxMaterial->GetRadlen() + inHall / hallMaterial->GetRadlen();
+      budgetOk = budgetOk && IsClose( x0, expected, 1.e-4 );
+      lengthOk = lengthOk && IsClose( length*mm, hallHalf / maxCos, 1.e-4 );
+    }
+    std::remove( fileName );
+
+    Check( nRays == nTheta*nPhi, "one line per direction" );
+    Check( budgetOk, "X/X0 along each ray" );
+    Check( lengthOk, "path length to the hall boundary" );
+
+    AgataMaterialBudgetScanner::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// An assembly of three sub-files, one commented out, in a
+  /// scratch directory; then a parsed-like tree with a volume to
+  /// remove, one to empty (holding a volume also placed outside
+  /// it) and a mesh to replace by its bounding box
+  //////////////////////////////////////////////////////////////
+  void WriteText( const std::string& fileName, const std::string& text )
+  {
+    std::ofstream outFile( fileName.c_str() );
+    outFile << text;
+  }
+
+  G4bool InStore( G4LogicalVolume* lv )
+  {
+    G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+    return std::find( theStore->begin(), theStore->end(), lv ) != theStore->end();
+  }
+
+  void TestMask()
+  {
+    char dirName[] = "/tmp/AgataMaskTestXXXXXX";
+    if( !mkdtemp(dirName) ) {
+      Check( false, "scratch directory" );
+      return;
+    }
+    std::string dir = dirName;
+    WriteText( dir + "/assembly.gdml",
+               "<!DOCTYPE gdml [ <!ENTITY materials SYSTEM \"materials.xml\"> ]>\n"
+               "<gdml>\n<structure>\n<volume name=\"World\">\n"
+               "<physvol><file name=\"partA.gdml\"/></physvol>\n"
+               "<physvol><file name=\"partB.gdml\"/></physvol>\n"
+               "<!-- <physvol><file name=\"partC.gdml\"/></physvol> -->\n"
+               "</volume>\n</structure>\n</gdml>\n" );
+    WriteText( dir + "/materials.xml", "<materials/>\n" );
+    WriteText( dir + "/partA.gdml", "<gdml/>\n" );
+    WriteText( dir + "/partB.gdml", "<triangular/>\n<triangular/>\n<quadrangular/>\n" );
+
+    AgataGeometryMask* theMask = AgataGeometryMask::GetInstance();
+    theMask->AddRule( "skip part[BC]" );
+    G4String filtered = theMask->Filter( dir + "/assembly.gdml" );
+    std::ifstream inFile( filtered.c_str() );
+    std::ostringstream text;
+    text << inFile.rdbuf();
+    Check( text.str().find("partA") != std::string::npos &&
+           text.str().find("partB") == std::string::npos, "skipped sub-file out of the copy" );
+    Check( theMask->GetNumberOfSkippedFiles() == 1, "commented-out sub-file not counted" );
+    Check( theMask->GetSkippedFacets() == 3, "facets of the skipped file" );
+    std::vector<G4String> kept = theMask->GetKeptFiles();
+    Check( kept.size() == 3 && kept[1] == dir + "/materials.xml" && kept[2] == dir + "/partA.gdml",
+           "kept files: assembly, entity, sub-file" );
+    theMask->Release();
+    const char* files[4] = { "/assembly.gdml", "/materials.xml", "/partA.gdml", "/partB.gdml" };
+    for( G4int ii=0; ii<4; ii++ )
+      std::remove( ( dir + files[ii] ).c_str() );
+    rmdir( dirName );
+
+    //> after parsing
+    G4Material* vacuum = G4NistManager::Instance()->FindOrBuildMaterial("G4_Galactic");
+    G4Material* metal  = G4NistManager::Instance()->FindOrBuildMaterial("G4_Al");
+    G4LogicalVolume* top = new G4LogicalVolume( new G4Box( "unitMaskTop", 100.*mm, 100.*mm, 100.*mm ),
+                                                vacuum, "unitMaskTop" );
+    AgataTriangleMesh cube;
+    AddBox( cube, G4ThreeVector( 1.*mm, 2.*mm, 3.*mm ), G4ThreeVector( 5.*mm, 5.*mm, 5.*mm ) );
+
+    G4LogicalVolume* removed = new G4LogicalVolume( new G4Box( "unitMaskGone", 10.*mm, 10.*mm, 10.*mm ),
+                                                    metal, "unitMaskGone" );
+    G4LogicalVolume* inside  = new G4LogicalVolume( cube.BuildSolid( "unitMaskGoneMesh" ), metal,
+                                                    "unitMaskGoneMesh" );
+    new G4PVPlacement( NULL, G4ThreeVector(), inside, "unitMaskGoneMesh", removed, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector( -50.*mm, 0., 0. ), removed, "unitMaskGone", top, false, 0 );
+
+    G4LogicalVolume* emptied = new G4LogicalVolume( new G4Box( "unitMaskVac", 10.*mm, 10.*mm, 10.*mm ),
+                                                    metal, "unitMaskVac" );
+    G4LogicalVolume* shared  = new G4LogicalVolume( new G4Box( "unitMaskShared", 1.*mm, 1.*mm, 1.*mm ),
+                                                    metal, "unitMaskShared" );
+    new G4PVPlacement( NULL, G4ThreeVector(), shared, "unitMaskShared", emptied, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(), emptied, "unitMaskVac", top, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector( 0., 50.*mm, 0. ), shared, "unitMaskShared", top, false, 1 );
+
+    G4LogicalVolume* boxed = new G4LogicalVolume( cube.BuildSolid( "unitMaskMesh" ), metal, "unitMaskMesh" );
+    new G4PVPlacement( NULL, G4ThreeVector( 50.*mm, 0., 0. ), boxed, "unitMaskMesh", top, false, 0 );
+
+    theMask->Clear();
+    theMask->AddRule( "skip unitMaskGone" );
+    theMask->AddRule( "vacuum unitMaskVac" );
+    theMask->AddRule( "bbox unitMaskMesh" );
+    theMask->Apply( top );
+
+    Check( top->GetNoDaughters() == 3, "skipped volume no longer placed" );
+    Check( !InStore(removed) && !InStore(inside), "removed volumes deleted" );
+    Check( emptied->GetMaterial() == vacuum && emptied->GetNoDaughters() == 0, "volume emptied" );
+    Check( InStore(shared), "volume placed elsewhere kept" );
+    Check( boxed->GetSolid()->GetName() == "unitMaskMesh_bbox", "mesh replaced by its bounding box" );
+    Check( theMask->GetRemovedFacets() == 24, "facets of the removed meshes" );
+
+    AgataGeometryMask::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// A document including a materials entity, with a schema
+  /// directory and a cache of its own
+  //////////////////////////////////////////////////////////////
+  void TestGdml()
+  {
+    char dirName[] = "/tmp/AgataGdmlTestXXXXXX";
+    if( !mkdtemp(dirName) ) {
+      Check( false, "scratch directory" );
+      return;
+    }
+    std::string dir = dirName;
+    //> a schema the document is valid against, whatever the materials
+    WriteText( dir + "/gdml.xsd",
+               "<xs:schema xmlns:xs=\"http://www.w3.org/2001/XMLSchema\">\n"
+               " <xs:element name=\"gdml\"><xs:complexType><xs:sequence>\n"
+               "  <xs:element name=\"materials\"><xs:complexType><xs:sequence>\n"
+               "   <xs:any processContents=\"skip\" minOccurs=\"0\" maxOccurs=\"unbounded\"/>\n"
+               "  </xs:sequence></xs:complexType></xs:element>\n"
+               " </xs:sequence></xs:complexType></xs:element>\n"
+               "</xs:schema>\n" );
+    WriteText( dir + "/part.gdml",
+               "<!DOCTYPE gdml [ <!ENTITY materials SYSTEM \"materials.xml\"> ]>\n"
+               "<gdml>&materials;</gdml>\n" );
+    WriteText( dir + "/materials.xml", "<materials/>\n" );
+
+    AgataGdmlValidator* theValidator = AgataGdmlValidator::GetInstance();
+    theValidator->SetSchemaDir( dir );
+    theValidator->SetCacheFile( dir + "/cache" );
+    std::vector<G4String> files( 1, dir + "/part.gdml" );
+    files.push_back( dir + "/materials.xml" );
+
+    theValidator->Check(files);
+    G4int nFirst = theValidator->GetNumberOfValidations();
+    theValidator->Check(files);
+    G4int nSecond = theValidator->GetNumberOfValidations();
+    WriteText( dir + "/materials.xml", "<materials><element/></materials>\n" );
+    theValidator->Check(files);
+    G4int nThird = theValidator->GetNumberOfValidations();
+
+    Check( nFirst == 1, "document validated once, the entity with it" );
+    Check( nSecond == nFirst, "known-good document not validated again" );
+    Check( nThird == nSecond + 1, "changed entity: validated again" );
+
+    AgataGdmlValidator::DeleteInstance();
+    const char* names[4] = { "/gdml.xsd", "/part.gdml", "/materials.xml", "/cache" };
+    for( G4int ii=0; ii<4; ii++ )
+      std::remove( ( dir + names[ii] ).c_str() );
+    rmdir( dirName );
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// The sweep and the reading of the results of its children
+  /// (the runs themselves need the AGATA executable)
+  //////////////////////////////////////////////////////////////
+  void TestBenchmark()
+  {
+    Check( AgataBenchmark::ThreadCounts(1) == std::vector<G4int>( 1, 1 ), "one thread: one run" );
+    const G4int six[4]   = { 1, 2, 4, 6 };
+    const G4int eight[4] = { 1, 2, 4, 8 };
+    Check( AgataBenchmark::ThreadCounts(6) == std::vector<G4int>( six, six+4 ),
+           "powers of two below the largest count, then the largest count" );
+    Check( AgataBenchmark::ThreadCounts(8) == std::vector<G4int>( eight, eight+4 ),
+           "largest count a power of two: run once" );
+
+    std::string result = "{ \"threads\": 4, \"eventsPerSecond\": 1234.5, \"peakRSS_kB\": 100 }";
+    G4double value = 0.;
+    Check( AgataBenchmark::ReadValue( result, "eventsPerSecond", value ) && value == 1234.5,
+           "rate read from a result" );
+    Check( !AgataBenchmark::ReadValue( result, "runTime_s", value ), "missing value reported" );
+    Check( !AgataBenchmark::ReadValue( "{ \"eventsPerSecond\": }", "eventsPerSecond", value ),
+           "value without a number reported" );
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Tracks killed by the transport, not by the physics; the
+  /// volumes of a GDML assembly charged to their files, merged
+  /// ones to those of their pieces; the user action replaced by
+  /// the profiler deleted with it
+  //////////////////////////////////////////////////////////////
+  class UnitProcess : public G4VDiscreteProcess
+  {
+    public:
+      UnitProcess( G4ProcessType type ) : G4VDiscreteProcess( "unitProcess", type ) {};
+      G4double GetMeanFreePath( const G4Track&, G4double, G4ForceCondition* ) { return DBL_MAX; };
+  };
+
+  class UnitSteppingAction : public G4UserSteppingAction
+  {
+    public:
+      UnitSteppingAction( G4bool* flag ) : deleted(flag) {};
+      ~UnitSteppingAction() { *deleted = true; };
+
+    private:
+      G4bool* deleted;
+  };
+
+  void TestProfiler()
+  {
+    UnitProcess transport( fTransportation ), physics( fElectromagnetic );
+    G4Step step;
+    G4Track track;
+    step.SetTrack( &track );
+    G4StepPoint* post = step.GetPostStepPoint();
+    track.SetTrackStatus( fStopAndKill );
+    post->SetStepStatus( fWorldBoundary );
+    Check( AgataProfilerSteppingAction::KilledByTransport( &step ), "track leaving the world killed by the transport" );
+    post->SetStepStatus( fPostStepDoItProc );
+    post->SetProcessDefinedStep( &physics );
+    Check( !AgataProfilerSteppingAction::KilledByTransport( &step ), "track absorbed: not counted" );
+    post->SetProcessDefinedStep( &transport );
+    Check( AgataProfilerSteppingAction::KilledByTransport( &step ), "looping track killed by the transport" );
+    track.SetTrackStatus( fAlive );
+    Check( !AgataProfilerSteppingAction::KilledByTransport( &step ), "live track not counted" );
+
+    G4Material* air = G4NistManager::Instance()->FindOrBuildMaterial("G4_AIR");
+    size_t firstVolume = G4LogicalVolumeStore::GetInstance()->size();
+    G4Box* box = new G4Box( "unitProfBox", 1.*mm, 1.*mm, 1.*mm );
+    G4LogicalVolume* world = new G4LogicalVolume( box, air, "ReactChamber" );
+    G4LogicalVolume* partA = new G4LogicalVolume( box, air, "partA0x1234" );
+    G4LogicalVolume* inner = new G4LogicalVolume( box, air, "inner" );
+    G4LogicalVolume* partB = new G4LogicalVolume( box, air, "partB" );
+    G4LogicalVolume* loose = new G4LogicalVolume( box, air, "loose" );
+    new G4PVPlacement( NULL, G4ThreeVector(), partA, "partA", world, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(), inner, "inner", partA, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(), partB, "partB", world, false, 0 );
+    new G4PVPlacement( NULL, G4ThreeVector(), loose, "loose", world, false, 0 );
+
+    AgataVolumeProfiler* theProfiler = AgataVolumeProfiler::GetInstance();
+    std::vector<G4String> files( 1, "gdml/partA.gdml" );
+    files.push_back( "gdml/partB.gdml" );
+    theProfiler->RegisterFile( "gdml/assembly.gdml", firstVolume, files );
+    Check( theProfiler->GetSourceFile(inner) == "partA.gdml", "daughter charged to the file of its world" );
+    Check( theProfiler->GetSourceFile(loose) == "assembly.gdml", "other volumes charged to the top file" );
+
+    G4LogicalVolume* merged = new G4LogicalVolume( box, air, "merged" );
+    theProfiler->AddReplacement( inner, merged );
+    theProfiler->AddReplacement( partB, merged );
+    theProfiler->AddReplacement( partA, merged );
+    Check( theProfiler->GetSourceFile(merged) == "partA.gdml+partB.gdml", "merged volume charged to its pieces" );
+
+    AgataVolumeStatsMap threadStats;
+    threadStats[loose].nSteps  = 3;
+    threadStats[loose].nKilled = 1;
+    theProfiler->Merge( threadStats );
+    theProfiler->Merge( threadStats );
+    Check( theProfiler->GetMerged().find(loose)->second.nSteps == 6 &&
+           theProfiler->GetMerged().find(loose)->second.nKilled == 2, "thread counters merged" );
+    theProfiler->Clear();
+
+    G4bool userDeleted = false;
+    delete new AgataProfilerSteppingAction( new UnitSteppingAction( &userDeleted ) );
+    Check( userDeleted, "replaced user action deleted with the profiler one" );
+
+    AgataVolumeProfiler::DeleteInstance();
+  }
+
+  //////////////////////////////////////////////////////////////
+  /// Weights of a track split on its third step, of one of its
+  /// clones, and of a track never biased; a new event forgets
+  /// them
+  //////////////////////////////////////////////////////////////
+  void TestBiasing()
+  {
+    AgataWeightSteppingAction theRecord( NULL );
+    G4Event firstEvent(0), nextEvent(1);
+    G4EventManager::GetEventManager()->SetCurrentEvent( &firstEvent );
+
+    G4Step step;
+    G4Track split, clone, plain;
+    split.SetTrackID(1);
+    clone.SetTrackID(2);
+    plain.SetTrackID(3);
+    const G4double splitWeights[4] = { 1., 1., 0.5, 0.5 };
+    step.SetTrack( &split );
+    for( G4int ii=0; ii<4; ii++ ) {
+      step.GetPreStepPoint()->SetWeight( splitWeights[ii] );
+      step.GetPreStepPoint()->SetGlobalTime( ii*ns );
+      step.GetPostStepPoint()->SetGlobalTime( (ii+1)*ns );
+      theRecord.UserSteppingAction( &step );
+      split.IncrementCurrentStepNumber();
+    }
+    step.SetTrack( &clone );
+    step.GetPreStepPoint()->SetWeight( 0.5 );
+    step.GetPreStepPoint()->SetGlobalTime( 2.*ns );
+    step.GetPostStepPoint()->SetGlobalTime( 3.*ns );
+    theRecord.UserSteppingAction( &step );
+    step.SetTrack( &plain );
+    step.GetPreStepPoint()->SetWeight( 1. );
+    theRecord.UserSteppingAction( &step );
+
+    Check( theRecord.GetWeight( 1, 1.*ns ) == 1. && theRecord.GetWeight( 1, 2.*ns ) == 1.,
+           "steps before the splitting keep weight 1" );
+    Check( theRecord.GetWeight( 1, 2.5*ns ) == 0.5 && theRecord.GetWeight( 1, 4.*ns ) == 0.5,
+           "steps after the splitting have the new weight" );
+    Check( theRecord.GetWeight( 2, 3.*ns ) == 0.5, "clone has its weight from its first step" );
+    Check( theRecord.GetWeight( 3, 3.*ns ) == 1., "track never biased has weight 1" );
+
+    G4EventManager::GetEventManager()->SetCurrentEvent( &nextEvent );
+    step.SetTrack( &plain );
+    theRecord.UserSteppingAction( &step );
+    Check( theRecord.GetWeight( 1, 4.*ns ) == 1., "history of the previous event forgotten" );
+    G4EventManager::GetEventManager()->SetCurrentEvent( NULL );
+  }
+
+  struct Group
+  {
+    const char* name;
+    void      (*run)();
+  };
+
+  const Group groups[] = {
+    { "listmode",   TestListMode   },
+    { "arena",      TestArena      },
+    { "properties", TestProperties },
+    { "sampler",    TestSampler    },
+    { "voxels",     TestVoxels     },
+    { "budget",     TestBudget     },
+    { "segments",   TestSegments   },
+    { "mask",       TestMask       },
+    { "gdml",       TestGdml       },
+    { "merger",     TestMerger     },
+    { "benchmark",  TestBenchmark  },
+    { "profiler",   TestProfiler   },
+    { "biasing",    TestBiasing    },
+    { "hull",       TestHull       },
+    { "healer",     TestHealer     }
+  };
+}
+
+namespace { G4Mutex unitTestsMutex = G4MUTEX_INITIALIZER; }
+
+AgataUnitTests* AgataUnitTests::instance = NULL;
+
+AgataUnitTests* AgataUnitTests::GetInstance()
+{
+  G4AutoLock lock(&unitTestsMutex);
+  if( !instance )
+    instance = new AgataUnitTests();
+  return instance;
+}
+
+void AgataUnitTests::DeleteInstance()
+{
+  G4AutoLock lock(&unitTestsMutex);
+  delete instance;
+  instance = NULL;
+}
+
+AgataUnitTests::AgataUnitTests()
+{
+  myMessenger = new G4GenericMessenger( this, "/Agata/test/", "Unit checks of the ancillary tools" );
+  myMessenger->DeclareMethod( "run", &AgataUnitTests::RunCommand,
+                              "Runs the checks of one group (all of them by default)" )
+    .SetParameterName( "group", true )
+    .SetDefaultValue( "all" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataUnitTests::~AgataUnitTests()
+{
+  delete myMessenger;
+}
+
+G4int AgataUnitTests::Run( G4String group )
+{
+  nChecks = 0;
+  nFailed = 0;
+  G4bool found = false;
+  for( size_t ii=0; ii<sizeof(groups)/sizeof(groups[0]); ii++ ) {
+    if( group != "all" && group != groups[ii].name ) continue;
+    found = true;
+    G4int failedBefore = nFailed;
+    G4cout << " ---> " << groups[ii].name << G4endl;
+    groups[ii].run();
+    G4cout << " ---> " << groups[ii].name << ( nFailed > failedBefore ? ": FAILED" : ": ok" ) << G4endl;
+  }
+  Check( found, "known group " + group );
+  G4cout << " ---> " << nChecks << " checks, " << nFailed << " failed" << G4endl;
+  return nFailed;
+}
+
+void AgataUnitTests::RunCommand( G4String group )
+{
+  if( Run( group ) > 0 )
+    G4Exception( "AgataUnitTests::RunCommand()", "AgataTest001", FatalException,
+                 "Unit checks failed (see above)" );
+}
+
+#ifdef AGATA_UNIT_TESTS
+int main( int argc, char** argv )
+{
+  return AgataUnitTests::GetInstance()->Run( argc > 1 ? argv[1] : "all" );
+}
+#endif
@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////
+/// Unit checks of the ancillary tools of this directory. They are
+/// compiled with the tools and run from a macro, in a job of their
+/// own, before /run/initialize:
+///
+///   /Agata/test/run            runs all the checks
+///   /Agata/test/run listmode   only those of the named group
+///
+/// Every failed check is printed; failures end the job with a
+/// fatal exception, i.e. a non-zero exit code. The groups are
+/// listed in AgataUnitTests.cc.
+/// Built with -DAGATA_UNIT_TESTS, AgataUnitTests.cc also has a
+/// main of its own (exit code: number of failures), to run the
+/// checks without the AGATA executable.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataUnitTests_h
+#define AgataUnitTests_h 1
+
+#include "globals.hh"
+
+class G4GenericMessenger;
+
+class AgataUnitTests
+{
+  public:
+    static AgataUnitTests* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataUnitTests();
+
+  public:
+    ~AgataUnitTests();
+
+  private:
+    static AgataUnitTests* instance;
+
+  private:
+    G4GenericMessenger* myMessenger;
+
+  public:
+    //> "all" or a group name; returns the number of failed checks
+    G4int Run( G4String group );
+
+  private:
+    void  RunCommand( G4String group );
+};
+
+#endif
@@ -0,0 +1,356 @@
+//////////////////////////////////////////////////////////////////
+/// Per-volume tracking profiler (see AgataVolumeProfiler.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataVolumeProfiler.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4StepPoint.hh"
+#include "G4VProcess.hh"
+#include "G4Run.hh"
+#include "G4RunManager.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Threading.hh"
+#include "G4AutoLock.hh"
+
+#include <set>
+#include <algorithm>
+
+namespace { G4Mutex profilerMutex = G4MUTEX_INITIALIZER; }
+
+AgataVolumeProfiler* AgataVolumeProfiler::instance = NULL;
+G4ThreadLocal AgataProfilerSteppingAction* AgataVolumeProfiler::threadAction = NULL;
+G4ThreadLocal AgataProfilerRunAction*      AgataVolumeProfiler::threadRunAction = NULL;
+
+////////////////////////////////////////////////////////////
+/// Stepping action
+////////////////////////////////////////////////////////////
+AgataProfilerSteppingAction::AgataProfilerSteppingAction( G4UserSteppingAction* chained )
+{
+  userAction  = chained;
+  theProfiler = AgataVolumeProfiler::GetInstance();
+  lastVolume = NULL;
+  lastStats  = NULL;
+  counter    = 0;
+  armed      = false;
+}
+
+//> deleted by the run manager, in place of the user action
+AgataProfilerSteppingAction::~AgataProfilerSteppingAction()
+{
+  delete userAction;
+  AgataVolumeProfiler::Detach( this );
+}
+
+//> the track leaves the world, or is given up by the transport
+//> (loopers); the kills of the physics processes are not counted
+G4bool AgataProfilerSteppingAction::KilledByTransport( const G4Step* aStep )
+{
+  if( aStep->GetTrack()->GetTrackStatus() != fStopAndKill ) return false;
+  const G4StepPoint* post = aStep->GetPostStepPoint();
+  if( post->GetStepStatus() == fWorldBoundary ) return true;
+  const G4VProcess* process = post->GetProcessDefinedStep();
+  return process && process->GetProcessType() == fTransportation;
+}
+
+void AgataProfilerSteppingAction::UserSteppingAction( const G4Step* aStep )
+{
+  if( theProfiler->IsEnabled() ) {
+    const G4StepPoint* pre = aStep->GetPreStepPoint();
+    const G4LogicalVolume* volume = pre->GetPhysicalVolume()->GetLogicalVolume();
+    if( volume != lastVolume ) {
+      lastVolume = volume;
+      lastStats  = &stats[volume];
+    }
+    lastStats->nSteps++;
+    if( aStep->GetPostStepPoint()->GetStepStatus() == fGeomBoundary )
+      lastStats->nBoundary++;
+    if( KilledByTransport( aStep ) )
+      lastStats->nKilled++;
+
+    //> the time since the previous step is the cost of this one,
+    //> unless a new track was set up in between
+    G4int sampling = theProfiler->GetSampling();
+    if( armed ) {
+      if( aStep->GetTrack()->GetCurrentStepNumber() > 1 )
+        lastStats->time += sampling * std::chrono::duration<G4double>( std::chrono::steady_clock::now() - lastTime ).count();
+      armed = false;
+    }
+    if( ++counter >= sampling ) {
+      counter  = 0;
+      armed    = true;
+      lastTime = std::chrono::steady_clock::now();
+    }
+  }
+  if( userAction ) userAction->UserSteppingAction( aStep );
+}
+
+void AgataProfilerSteppingAction::Merge()
+{
+  theProfiler->Merge( stats );
+  stats.clear();
+  lastVolume = NULL;
+  lastStats  = NULL;
+  armed      = false;
+}
+
+////////////////////////////////////////////////////////////
+/// Run action
+////////////////////////////////////////////////////////////
+AgataProfilerRunAction::AgataProfilerRunAction( G4UserRunAction* chained )
+{
+  userAction = chained;
+}
+
+AgataProfilerRunAction::~AgataProfilerRunAction()
+{
+  delete userAction;
+  AgataVolumeProfiler::Detach( this );
+}
+
+G4Run* AgataProfilerRunAction::GenerateRun()
+{
+  return userAction ? userAction->GenerateRun() : G4UserRunAction::GenerateRun();
+}
+
+void AgataProfilerRunAction::BeginOfRunAction( const G4Run* aRun )
+{
+  if( userAction ) userAction->BeginOfRunAction( aRun );
+}
+
+void AgataProfilerRunAction::EndOfRunAction( const G4Run* aRun )
+{
+  if( userAction ) userAction->EndOfRunAction( aRun );
+  AgataVolumeProfiler::GetInstance()->EndOfRun();
+}
+
+////////////////////////////////////////////////////////////
+/// Profiler
+////////////////////////////////////////////////////////////
+AgataVolumeProfiler* AgataVolumeProfiler::GetInstance()
+{
+  G4AutoLock lock(&profilerMutex);
+  if( !instance )
+    instance = new AgataVolumeProfiler();
+  return instance;
+}
+
+void AgataVolumeProfiler::DeleteInstance()
+{
+  G4AutoLock lock(&profilerMutex);
+  delete instance;
+  instance = NULL;
+}
+
+AgataVolumeProfiler::AgataVolumeProfiler()
+{
+  enabled  = false;
+  sampling = 16;
+  nTop     = 20;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/profile/", "Per-volume tracking profiler" );
+  myMessenger->DeclareMethod( "enable", &AgataVolumeProfiler::Enable, "Profiles the tracking from the next event on" )
+    .SetParameterName( "flag", true )
+    .SetDefaultValue( "true" );
+  myMessenger->DeclareProperty( "sampling", sampling, "Times one step out of this many" )
+    .SetParameterName( "num", false ).SetRange( "num>0" );
+  myMessenger->DeclareProperty( "top", nTop, "Number of volumes listed in the report" )
+    .SetParameterName( "num", false ).SetRange( "num>0" );
+  myMessenger->DeclareMethod( "report", &AgataVolumeProfiler::Report, "Prints the merged counters" )
+    .SetToBeBroadcasted( false );
+  myMessenger->DeclareMethod( "clear", &AgataVolumeProfiler::Clear, "Resets the merged counters" )
+    .SetToBeBroadcasted( false );
+}
+
+AgataVolumeProfiler::~AgataVolumeProfiler()
+{
+  delete myMessenger;
+}
+
+void AgataVolumeProfiler::Enable( G4bool flag )
+{
+  enabled = flag;
+  if( enabled ) Attach();
+}
+
+//////////////////////////////////////////////////////////////
+/// The run manager of the thread owns the actions from now on
+/// (the MT master refuses stepping actions: it does not track)
+//////////////////////////////////////////////////////////////
+void AgataVolumeProfiler::Attach()
+{
+  G4RunManager* runManager = G4RunManager::GetRunManager();
+  if( !runManager ) return;
+
+  if( !threadRunAction ) {
+    threadRunAction = new AgataProfilerRunAction( const_cast<G4UserRunAction*>( runManager->GetUserRunAction() ) );
+    runManager->SetUserAction( threadRunAction );
+  }
+  if( !threadAction && !( G4Threading::IsMultithreadedApplication() && G4Threading::IsMasterThread() ) ) {
+    threadAction = new AgataProfilerSteppingAction( const_cast<G4UserSteppingAction*>( runManager->GetUserSteppingAction() ) );
+    runManager->SetUserAction( threadAction );
+  }
+}
+
+void AgataVolumeProfiler::Detach( const AgataProfilerSteppingAction* action )
+{
+  if( threadAction == action ) threadAction = NULL;
+}
+
+void AgataVolumeProfiler::Detach( const AgataProfilerRunAction* action )
+{
+  if( threadRunAction == action ) threadRunAction = NULL;
+}
+
+void AgataVolumeProfiler::EndOfRun()
+{
+  if( threadAction )
+    threadAction->Merge();
+  if( G4Threading::IsMasterThread() && enabled ) {
+    Report();
+    Clear();
+  }
+}
+
+void AgataVolumeProfiler::Merge( AgataVolumeStatsMap& threadStats )
+{
+  G4AutoLock lock(&profilerMutex);
+  for( AgataVolumeStatsMap::iterator it=threadStats.begin(); it!=threadStats.end(); ++it )
+    merged[it->first].Add( it->second );
+}
+
+void AgataVolumeProfiler::Clear()
+{
+  G4AutoLock lock(&profilerMutex);
+  merged.clear();
+}
+
+////////////////////////////////////////////////////////////
+/// No file is read here: the world volume of each sub-file has
+/// the name of the file (the CAD export names it so), and its
+/// subtree is charged to that file. Anything else created while
+/// reading the assembly is charged to the top file. To be called
+/// right after parsing: the volumes built later from these (see
+/// AgataMeshMerger) are charged through AddReplacement().
+////////////////////////////////////////////////////////////
+void AgataVolumeProfiler::RegisterFile( G4String fileName, size_t firstVolume,
+                                        const std::vector<G4String>& files )
+{
+  std::map<G4String, G4String> fileOf;
+  for( size_t ff=0; ff<files.size(); ff++ ) {
+    G4String baseName = files[ff].substr( files[ff].rfind('/') + 1 );
+    G4String volName  = baseName;
+    if( volName.size() > 5 && volName.compare( volName.size()-5, 5, ".gdml" ) == 0 )
+      volName = volName.substr( 0, volName.size()-5 );
+    fileOf[volName] = baseName;
+  }
+
+  G4String topName = fileName.substr( fileName.rfind('/') + 1 );
+  G4LogicalVolumeStore* theStore = G4LogicalVolumeStore::GetInstance();
+  for( size_t ii=firstVolume; ii<theStore->size(); ii++ ) {
+    if( sourceFile.find( (*theStore)[ii] ) == sourceFile.end() )
+      sourceFile[ (*theStore)[ii] ] = topName;
+  }
+
+  //> sub-file worlds, then their subtrees (a volume placed twice
+  //> keeps the first file it was found in)
+  for( size_t ii=firstVolume; ii<theStore->size(); ii++ ) {
+    G4String name = (*theStore)[ii]->GetName();
+    //> pointer suffixes are stripped by the parser
+    if( name.find("0x") != std::string::npos )
+      name = name.substr( 0, name.find("0x") );
+    std::map<G4String, G4String>::iterator it = fileOf.find( name );
+    if( it == fileOf.end() ) continue;
+
+    std::vector<G4LogicalVolume*> stack( 1, (*theStore)[ii] );
+    std::set<G4LogicalVolume*>    seen;
+    while( !stack.empty() ) {
+      G4LogicalVolume* volume = stack.back();
+      stack.pop_back();
+      if( !seen.insert(volume).second ) continue;
+      sourceFile[volume] = it->second;
+      for( size_t dd=0; dd<volume->GetNoDaughters(); dd++ )
+        stack.push_back( volume->GetDaughter(dd)->GetLogicalVolume() );
+    }
+  }
+}
+
+//> a replacement of pieces from several files is charged to all of them
+void AgataVolumeProfiler::AddReplacement( const G4LogicalVolume* original, const G4LogicalVolume* replacement )
+{
+  std::map<const G4LogicalVolume*, G4String>::iterator it = sourceFile.find( original );
+  if( it == sourceFile.end() ) return;
+  G4String& files = sourceFile[replacement];
+  if( files == "" )
+    files = it->second;
+  else if( ( "+" + files + "+" ).find( "+" + it->second + "+" ) == std::string::npos )
+    files += "+" + it->second;
+}
+
+G4String AgataVolumeProfiler::GetSourceFile( const G4LogicalVolume* volume ) const
+{
+  std::map<const G4LogicalVolume*, G4String>::const_iterator it = sourceFile.find( volume );
+  return it != sourceFile.end() ? it->second : G4String("");
+}
+
+////////////////////////////////////////////////////////////
+/// Top N volumes (by sampled time, by steps when not timed)
+/// and the totals per source file
+////////////////////////////////////////////////////////////
+namespace {
+  typedef std::pair<const G4LogicalVolume*, AgataVolumeStats> VolumeEntry;
+
+  G4bool MoreExpensive( const VolumeEntry& aa, const VolumeEntry& bb )
+  {
+    if( aa.second.time != bb.second.time ) return aa.second.time > bb.second.time;
+    return aa.second.nSteps > bb.second.nSteps;
+  }
+}
+
+void AgataVolumeProfiler::Report()
+{
+  G4AutoLock lock(&profilerMutex);
+
+  std::vector<VolumeEntry> entries( merged.begin(), merged.end() );
+  std::sort( entries.begin(), entries.end(), MoreExpensive );
+
+  AgataVolumeStats total;
+  std::map<G4String, AgataVolumeStats> perFile;
+  for( size_t ii=0; ii<entries.size(); ii++ ) {
+    total.Add( entries[ii].second );
+    std::map<const G4LogicalVolume*, G4String>::iterator it = sourceFile.find( entries[ii].first );
+    perFile[ it != sourceFile.end() ? it->second : G4String("(not from GDML)") ].Add( entries[ii].second );
+  }
+  if( total.nSteps == 0 ) {
+    G4cout << " ---> Volume profiler: no steps recorded" << G4endl;
+    return;
+  }
+
+  G4cout << G4endl << " ---> Volume profiler: " << total.nSteps << " steps, "
+         << total.time << " s sampled (1/" << sampling << " steps)" << G4endl;
+  G4cout << "      volume                        file                            steps  %steps  boundary  killed   time(s)  %time" << G4endl;
+  char line[256];
+  for( size_t ii=0; ii<entries.size() && ii<(size_t)nTop; ii++ ) {
+    const AgataVolumeStats& ss = entries[ii].second;
+    std::map<const G4LogicalVolume*, G4String>::iterator it = sourceFile.find( entries[ii].first );
+    snprintf( line, sizeof(line), "      %-29.29s %-29.29s %10ld  %6.2f %9ld %7ld %9.3f %6.2f",
+              entries[ii].first->GetName().c_str(),
+              it != sourceFile.end() ? it->second.c_str() : "-",
+              ss.nSteps, 100.*ss.nSteps/total.nSteps, ss.nBoundary, ss.nKilled,
+              ss.time, total.time > 0. ? 100.*ss.time/total.time : 0. );
+    G4cout << line << G4endl;
+  }
+
+  G4cout << "      per source file:" << G4endl;
+  for( std::map<G4String, AgataVolumeStats>::iterator it=perFile.begin(); it!=perFile.end(); ++it ) {
+    snprintf( line, sizeof(line), "      %-60.60s %10ld  %6.2f %9ld %7ld %9.3f %6.2f",
+              it->first.c_str(), it->second.nSteps, 100.*it->second.nSteps/total.nSteps,
+              it->second.nBoundary, it->second.nKilled, it->second.time,
+              total.time > 0. ? 100.*it->second.time/total.time : 0. );
+    G4cout << line << G4endl;
+  }
+}
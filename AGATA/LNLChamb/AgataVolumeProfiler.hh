@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////
+/// Runtime profiler of the tracking, per logical volume and per
+/// source GDML file. It counts the steps taken in each volume, the
+/// boundary steps (those ending on a volume boundary), the tracks
+/// killed there by the transport (leaving the world, looping) and,
+/// on one step out of "sampling", the wall time between two
+/// consecutive steps (scaled back by "sampling").
+///
+///   /Agata/profile/enable true
+///   /Agata/profile/sampling 16
+///   /Agata/profile/top 20
+///
+/// The enable command attaches the profiler to each thread running
+/// it: the workers at their next run (the command is broadcast),
+/// the master at once. A stepping action (not on the master of MT
+/// builds, which does not track) and a run action take the place of
+/// the user ones and call them; at the end of each run the thread
+/// counters are merged, and the master prints the N most expensive
+/// volumes. Both actions belong to the run manager, and delete the
+/// user actions they replaced.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataVolumeProfiler_h
+#define AgataVolumeProfiler_h 1
+
+#include "globals.hh"
+#include "G4UserSteppingAction.hh"
+#include "G4UserRunAction.hh"
+
+#include <map>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+
+class G4LogicalVolume;
+class G4GenericMessenger;
+class AgataVolumeProfiler;
+
+struct AgataVolumeStats
+{
+  G4long   nSteps;
+  G4long   nBoundary;
+  G4long   nKilled;   //> by the transport
+  G4double time;      //> seconds (sampled)
+
+  AgataVolumeStats() : nSteps(0), nBoundary(0), nKilled(0), time(0.) {};
+  void Add( const AgataVolumeStats& other )
+  {
+    nSteps    += other.nSteps;
+    nBoundary += other.nBoundary;
+    nKilled   += other.nKilled;
+    time      += other.time;
+  };
+};
+
+typedef std::unordered_map<const G4LogicalVolume*, AgataVolumeStats> AgataVolumeStatsMap;
+
+//////////////////////////////////////////////////////////////
+/// The per-thread part
+//////////////////////////////////////////////////////////////
+class AgataProfilerSteppingAction : public G4UserSteppingAction
+{
+  public:
+    AgataProfilerSteppingAction( G4UserSteppingAction* chained );
+    ~AgataProfilerSteppingAction();
+
+  private:
+    G4UserSteppingAction*  userAction;   //> the action we replaced (owned)
+    AgataVolumeProfiler*   theProfiler;
+    AgataVolumeStatsMap    stats;
+    const G4LogicalVolume* lastVolume;   //> consecutive steps are mostly in one volume
+    AgataVolumeStats*      lastStats;
+    G4long                 counter;
+    G4bool                 armed;
+    std::chrono::steady_clock::time_point lastTime;
+
+  public:
+    void UserSteppingAction( const G4Step* aStep );
+
+  public:
+    //> moves the counters of this thread to the profiler
+    void Merge();
+
+  public:
+    //> the track was killed by the transport in this step
+    static G4bool KilledByTransport( const G4Step* aStep );
+};
+
+//////////////////////////////////////////////////////////////
+/// End of run of each thread: merges, then (master) reports
+//////////////////////////////////////////////////////////////
+class AgataProfilerRunAction : public G4UserRunAction
+{
+  public:
+    AgataProfilerRunAction( G4UserRunAction* chained );
+    ~AgataProfilerRunAction();
+
+  private:
+    G4UserRunAction* userAction;   //> the action we replaced (owned)
+
+  public:
+    G4Run* GenerateRun();
+    void   BeginOfRunAction( const G4Run* aRun );
+    void   EndOfRunAction  ( const G4Run* aRun );
+};
+
+class AgataVolumeProfiler
+{
+  public:
+    static AgataVolumeProfiler* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataVolumeProfiler();
+
+  public:
+    ~AgataVolumeProfiler();
+
+  private:
+    static AgataVolumeProfiler* instance;
+    static G4ThreadLocal AgataProfilerSteppingAction* threadAction;
+    static G4ThreadLocal AgataProfilerRunAction*      threadRunAction;
+
+  private:
+    G4bool                                    enabled;
+    G4int                                     sampling;
+    G4int                                     nTop;
+    AgataVolumeStatsMap                       merged;
+    std::map<const G4LogicalVolume*, G4String> sourceFile;
+    G4GenericMessenger*                       myMessenger;
+
+  public:
+    //> /Agata/profile/enable: attaches the actions of the calling thread
+    void     Enable( G4bool flag );
+    //> end of run: workers merge, the master prints
+    void     EndOfRun();
+    void     Report();
+    void     Clear();
+
+  private:
+    void     Attach();
+
+  public:
+    //> the run manager deleted an action of the calling thread
+    static void Detach( const AgataProfilerSteppingAction* action );
+    static void Detach( const AgataProfilerRunAction* action );
+
+  public:
+    //> volumes created by reading fileName: those in logical volume
+    //> store from index firstVolume on; files are the ones actually
+    //> read (AgataGeometryMask::GetKeptFiles())
+    void     RegisterFile( G4String fileName, size_t firstVolume,
+                           const std::vector<G4String>& files );
+    //> replacement takes the place of original (see AgataMeshMerger)
+    void     AddReplacement( const G4LogicalVolume* original, const G4LogicalVolume* replacement );
+    //> "" when not from a registered file
+    G4String GetSourceFile( const G4LogicalVolume* volume ) const;
+
+  public:
+    void     Merge( AgataVolumeStatsMap& threadStats );
+
+  public:
+    inline G4bool IsEnabled()   { return enabled;  };
+    inline G4int  GetSampling() { return sampling; };
+    inline const AgataVolumeStatsMap& GetMerged() { return merged; };
+};
+
+#endif
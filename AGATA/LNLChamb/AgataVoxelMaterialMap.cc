@@ -0,0 +1,262 @@
+//////////////////////////////////////////////////////////////////
+/// Voxelised material map of a volume tree
+/// (see AgataVoxelMaterialMap.hh)
+/////////////////////////////////////////////////////////////////
+
+#include "AgataVoxelMaterialMap.hh"
+
+#include "G4Material.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4PVReplica.hh"
+#include "G4PVParameterised.hh"
+#include "G4VPVParameterisation.hh"
+#include "G4Box.hh"
+#include "G4Navigator.hh"
+#include "G4GeometryManager.hh"
+#include "G4TouchableHistory.hh"
+#include "G4GenericMessenger.hh"
+#include "G4UnitsTable.hh"
+
+#include <map>
+#include <cmath>
+
+AgataVoxelMaterialMap* AgataVoxelMaterialMap::instance = NULL;
+
+AgataVoxelMaterialMap* AgataVoxelMaterialMap::GetInstance()
+{
+  if( !instance )
+    instance = new AgataVoxelMaterialMap();
+  return instance;
+}
+
+void AgataVoxelMaterialMap::DeleteInstance()
+{
+  delete instance;
+  instance = NULL;
+}
+
+AgataVoxelMaterialMap::AgataVoxelMaterialMap()
+{
+  voxelSize       = 0.;
+  nSubSamples     = 3;
+  nVoxels[0] = nVoxels[1] = nVoxels[2] = 0;
+  outsideMaterial = NULL;
+
+  myMessenger = new G4GenericMessenger( this, "/Agata/geometry/voxel/",
+                                        "Voxelised (quick-look) approximation of the GDML geometries" );
+  myMessenger->DeclarePropertyWithUnit( "size", "mm", voxelSize,
+                                        "Voxel size (0 = exact geometry). To be set before /run/initialize" )
+    .SetParameterName( "size", false )
+    .SetRange( "size>=0." );
+  myMessenger->DeclareProperty( "subSamples", nSubSamples,
+                                "Sub-samples per axis used to decide the material of a voxel" )
+    .SetParameterName( "num", false )
+    .SetRange( "num>0" );
+}
+
+AgataVoxelMaterialMap::~AgataVoxelMaterialMap()
+{
+  delete myMessenger;
+}
+
+unsigned short AgataVoxelMaterialMap::MaterialIndex( G4Material* mat )
+{
+  for( size_t ii=0; ii<materials.size(); ii++ ) {
+    if( materials[ii] == mat ) return ii;
+  }
+  materials.push_back(mat);
+  return materials.size() - 1;
+}
+
+//////////////////////////////////////////////////////////////
+/// The material of a parameterised volume comes from its
+/// parameterisation, given the parent touchable (as in
+/// AgataMaterialBudgetScanner)
+//////////////////////////////////////////////////////////////
+G4Material* AgataVoxelMaterialMap::LocateMaterial( G4Navigator* navigator, const G4ThreeVector& point )
+{
+  G4VPhysicalVolume* pv = navigator->LocateGlobalPointAndSetup( point, NULL, false, true );
+  if( !pv ) return NULL;
+
+  G4Material* mat = pv->GetLogicalVolume()->GetMaterial();
+  G4VPVParameterisation* param = pv->IsParameterised() ? pv->GetParameterisation() : NULL;
+  if( param ) {
+    G4TouchableHistory* touch = navigator->CreateTouchableHistory();
+    G4int copyNo = touch->GetReplicaNumber(0);
+    touch->MoveUpHistory(1);
+    G4Material* pmat = param->ComputeMaterial( copyNo, pv, touch );
+    if( pmat ) mat = pmat;
+    delete touch;
+  }
+  return mat;
+}
+
+//////////////////////////////////////////////////////////////
+/// The tree is navigated under a world volume of its own,
+/// closed (voxelised) for the time of the build only
+//////////////////////////////////////////////////////////////
+void AgataVoxelMaterialMap::Build( G4LogicalVolume* top )
+{
+  G4VPhysicalVolume* topWorld = new G4PVPlacement( NULL, G4ThreeVector(), top, top->GetName()+"_voxelWorld",
+                                                   NULL, false, 0 );
+  G4GeometryManager::GetInstance()->CloseGeometry( true, false, topWorld );
+  G4Navigator* navigator = new G4Navigator();
+  navigator->SetWorldVolume(topWorld);
+
+  G4ThreeVector pMin, pMax;
+  top->GetSolid()->BoundingLimits( pMin, pMax );
+  for( G4int ax=0; ax<3; ax++ )
+    nVoxels[ax] = std::max( 1, (G4int)std::ceil( ( pMax[ax] - pMin[ax] ) / voxelSize ) );
+  G4ThreeVector extent( nVoxels[0]*voxelSize, nVoxels[1]*voxelSize, nVoxels[2]*voxelSize );
+  gridCentre = 0.5 * ( pMin + pMax );
+  gridMin    = gridCentre - 0.5 * extent;
+
+  G4long nTot = (G4long)nVoxels[0] * nVoxels[1] * nVoxels[2];
+  G4cout << " ---> Voxelising " << top->GetName() << " with " << G4BestUnit(voxelSize,"Length")
+         << " voxels: " << nVoxels[0] << " x " << nVoxels[1] << " x " << nVoxels[2]
+         << " = " << nTot << " voxels" << G4endl;
+
+  materials.clear();
+  voxels.assign( nTot, 0 );
+
+  //> sub-sample counts: exact (sampled) and voxelised volume per material
+  std::map<G4Material*,G4double> exactVolume, voxelVolume;
+  G4long nMixed = 0;
+  G4double subSize   = voxelSize / nSubSamples;
+  G4double subVolume = subSize * subSize * subSize;
+  std::map<G4Material*,G4int> counts;
+
+  for( G4int iz=0; iz<nVoxels[2]; iz++ ) {
+    for( G4int iy=0; iy<nVoxels[1]; iy++ ) {
+      for( G4int ix=0; ix<nVoxels[0]; ix++ ) {
+        counts.clear();
+        for( G4int sz=0; sz<nSubSamples; sz++ ) {
+          for( G4int sy=0; sy<nSubSamples; sy++ ) {
+            for( G4int sx=0; sx<nSubSamples; sx++ ) {
+              G4ThreeVector point = gridMin + G4ThreeVector( ix*voxelSize + ( sx + 0.5 )*subSize,
+                                                             iy*voxelSize + ( sy + 0.5 )*subSize,
+                                                             iz*voxelSize + ( sz + 0.5 )*subSize );
+              G4Material* mat = LocateMaterial( navigator, point );
+              counts[mat]++;
+              exactVolume[mat] += subVolume;
+            }
+          }
+        }
+        G4Material* majority = NULL;
+        G4int nMax = 0;
+        std::map<G4Material*,G4int>::iterator it;
+        for( it=counts.begin(); it!=counts.end(); ++it ) {
+          if( it->second > nMax ) {
+            nMax     = it->second;
+            majority = it->first;
+          }
+        }
+        if( counts.size() > 1 ) nMixed++;
+        voxels[ ( iz*nVoxels[1] + iy )*nVoxels[0] + ix ] = MaterialIndex(majority);
+        voxelVolume[majority] += voxelSize * voxelSize * voxelSize;
+      }
+    }
+  }
+  delete navigator;
+  G4GeometryManager::GetInstance()->OpenGeometry(topWorld);
+  delete topWorld;
+
+  //> approximation error (inside the tree)
+  G4cout << " ---> Voxel map built: " << materials.size() << " materials, "
+         << nMixed << " mixed voxels (" << 100. * nMixed / nTot << "%)" << G4endl;
+  G4double massExact = 0., massVoxel = 0.;
+  std::map<G4Material*,G4double>::iterator it;
+  for( it=exactVolume.begin(); it!=exactVolume.end(); ++it ) {
+    G4Material* mat = it->first;
+    if( !mat ) continue;
+    G4double vox = voxelVolume[mat];
+    massExact += it->second * mat->GetDensity();
+    massVoxel += vox * mat->GetDensity();
+    G4cout << "      " << mat->GetName() << ": volume " << G4BestUnit(it->second,"Volume")
+           << " -> " << G4BestUnit(vox,"Volume");
+    if( it->second > 0. )
+      G4cout << " (" << 100. * ( vox - it->second ) / it->second << "%)";
+    G4cout << G4endl;
+  }
+  G4cout << "      total mass " << G4BestUnit(massExact,"Mass") << " -> "
+         << G4BestUnit(massVoxel,"Mass");
+  if( massExact > 0. )
+    G4cout << " (" << 100. * ( massVoxel - massExact ) / massExact << "%)";
+  G4cout << G4endl;
+}
+
+//////////////////////////////////////////////////////////////
+/// Same structure as the nested-parameterisation DICOM example:
+/// container -> replica along y -> replica along x -> voxels
+/// along z, material chosen by AgataVoxelParameterisation
+//////////////////////////////////////////////////////////////
+G4VPhysicalVolume* AgataVoxelMaterialMap::Place( G4String name, G4RotationMatrix* rot,
+                                                 const G4ThreeVector& pos, G4VPhysicalVolume* mother )
+{
+  //> the voxels outside the tree (no material yet) are part of the mother
+  outsideMaterial = mother->GetLogicalVolume()->GetMaterial();
+  for( size_t ii=0; ii<materials.size(); ii++ )
+    if( !materials[ii] ) materials[ii] = outsideMaterial;
+
+  G4double half = 0.5 * voxelSize;
+
+  G4Box* contSolid = new G4Box( name+"_voxels", nVoxels[0]*half, nVoxels[1]*half, nVoxels[2]*half );
+  G4LogicalVolume* contLog = new G4LogicalVolume( contSolid, outsideMaterial, name+"_voxels" );
+
+  G4Box* rowYSolid = new G4Box( name+"_voxY", nVoxels[0]*half, half, nVoxels[2]*half );
+  G4LogicalVolume* rowYLog = new G4LogicalVolume( rowYSolid, outsideMaterial, name+"_voxY" );
+  new G4PVReplica( name+"_voxY", rowYLog, contLog, kYAxis, nVoxels[1], voxelSize );
+
+  G4Box* rowXSolid = new G4Box( name+"_voxX", half, half, nVoxels[2]*half );
+  G4LogicalVolume* rowXLog = new G4LogicalVolume( rowXSolid, outsideMaterial, name+"_voxX" );
+  new G4PVReplica( name+"_voxX", rowXLog, rowYLog, kXAxis, nVoxels[0], voxelSize );
+
+  G4Box* voxSolid = new G4Box( name+"_vox", half, half, half );
+  G4LogicalVolume* voxLog = new G4LogicalVolume( voxSolid, outsideMaterial, name+"_vox" );
+  new G4PVParameterised( name+"_vox", voxLog, rowXLog, kUndefined, nVoxels[2],
+                         new AgataVoxelParameterisation(this) );
+
+  //> the grid is centred on the bounding box, not on the origin of top
+  G4ThreeVector shift = rot ? ( rot->inverse() * gridCentre ) : gridCentre;
+  return new G4PVPlacement( rot, pos + shift, name, contLog, mother, false, 0 );
+}
+
+////////////////////////////////////////////////////////////
+/// Parameterisation
+////////////////////////////////////////////////////////////
+AgataVoxelParameterisation::AgataVoxelParameterisation( AgataVoxelMaterialMap* map )
+{
+  theMap   = map;
+  halfSize = 0.5 * map->GetVoxelSize();
+}
+
+AgataVoxelParameterisation::~AgataVoxelParameterisation()
+{}
+
+G4Material* AgataVoxelParameterisation::ComputeMaterial( G4VPhysicalVolume*, const G4int repNo,
+                                                         const G4VTouchable* parentTouch )
+{
+  //> materials are needed without touchable when the geometry is closed
+  if( !parentTouch ) return theMap->GetMaterials()[0];
+  G4int ix = parentTouch->GetReplicaNumber(0);
+  G4int iy = parentTouch->GetReplicaNumber(1);
+  return theMap->GetVoxelMaterial( ix, iy, repNo );
+}
+
+G4int AgataVoxelParameterisation::GetNumberOfMaterials() const
+{
+  return theMap->GetMaterials().size();
+}
+
+G4Material* AgataVoxelParameterisation::GetMaterial( G4int idx ) const
+{
+  return theMap->GetMaterials()[idx];
+}
+
+void AgataVoxelParameterisation::ComputeTransformation( const G4int copyNo, G4VPhysicalVolume* physVol ) const
+{
+  G4double zz = ( 2*copyNo + 1 ) * halfSize - theMap->GetNumberOfVoxels(2) * halfSize;
+  physVol->SetTranslation( G4ThreeVector( 0., 0., zz ) );
+}
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////
+/// Quick-look approximation of a GDML volume tree: the tree is
+/// rasterised into a regular grid of materials (majority material
+/// of n^3 sub-samples per voxel) which can be placed instead of the
+/// exact meshes through a nested parameterisation
+/// (replica along y, replica along x, parameterised along z).
+/// The error of the approximation (mixed voxels, volume of each
+/// material) is printed when the map is built.
+/// The materials are located by a navigator, replicas and
+/// parameterisations of the tree included; the voxels outside the
+/// tree get the material of the volume the grid is placed in.
+/////////////////////////////////////////////////////////////////
+
+#ifndef AgataVoxelMaterialMap_h
+#define AgataVoxelMaterialMap_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+#include "G4VNestedParameterisation.hh"
+
+#include <vector>
+
+class G4Material;
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4Navigator;
+class G4GenericMessenger;
+
+class AgataVoxelMaterialMap
+{
+  public:
+    static AgataVoxelMaterialMap* GetInstance();
+    static void DeleteInstance();
+
+  private:
+    AgataVoxelMaterialMap();
+
+  public:
+    ~AgataVoxelMaterialMap();
+
+  private:
+    static AgataVoxelMaterialMap* instance;
+
+  private:
+    G4double                    voxelSize;   //> 0 means exact geometry
+    G4int                       nSubSamples; //> per axis and per voxel
+    G4int                       nVoxels[3];
+    G4ThreeVector               gridMin;
+    G4ThreeVector               gridCentre;
+    std::vector<G4Material*>    materials;
+    std::vector<unsigned short> voxels;      //> material index, x fastest
+    G4Material*                 outsideMaterial; //> that of the mother, known from Place()
+    G4GenericMessenger*         myMessenger;
+
+  public:
+    //> rasterises the volume tree of top (in its own frame)
+    void               Build   ( G4LogicalVolume* top );
+    //> places the grid in mother, where top would have been placed
+    G4VPhysicalVolume* Place   ( G4String name, G4RotationMatrix* rot, const G4ThreeVector& pos,
+                                 G4VPhysicalVolume* mother );
+
+  private:
+    //> NULL outside the tree
+    G4Material*        LocateMaterial( G4Navigator* navigator, const G4ThreeVector& point );
+    unsigned short     MaterialIndex ( G4Material* mat );
+
+  public:
+    inline G4bool      IsEnabled()                    { return voxelSize > 0.; };
+    inline G4int       GetNumberOfVoxels( G4int ax )  { return nVoxels[ax]; };
+    inline G4Material* GetVoxelMaterial ( G4int ix, G4int iy, G4int iz )
+    { return materials[ voxels[ ( iz*nVoxels[1] + iy )*nVoxels[0] + ix ] ]; };
+    inline const std::vector<G4Material*>& GetMaterials() { return materials; };
+    inline G4double    GetVoxelSize()                 { return voxelSize; };
+
+  public:
+    inline void        SetVoxelSize   ( G4double size ) { voxelSize   = size; };
+    inline void        SetSubSamples  ( G4int num )     { nSubSamples = num;  };
+};
+
+//////////////////////////////////////////////////////////////////
+/// Material of each voxel along z, given the x and y replica
+/// numbers of the parent touchable
+/////////////////////////////////////////////////////////////////
+class AgataVoxelParameterisation : public G4VNestedParameterisation
+{
+  public:
+    AgataVoxelParameterisation( AgataVoxelMaterialMap* map );
+    ~AgataVoxelParameterisation();
+
+  private:
+    AgataVoxelMaterialMap* theMap;
+    G4double               halfSize;
+
+  public:
+    G4Material* ComputeMaterial( G4VPhysicalVolume* currentVol, const G4int repNo,
+                                 const G4VTouchable* parentTouch );
+    G4int       GetNumberOfMaterials() const;
+    G4Material* GetMaterial( G4int idx ) const;
+    void        ComputeTransformation( const G4int copyNo, G4VPhysicalVolume* physVol ) const;
+};
+
+#endif